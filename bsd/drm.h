@@ -238,6 +238,33 @@ typedef struct drm_ctx_res {
 	drm_ctx_t	*contexts;
 } drm_ctx_res_t;
 
+				/* Context switch requests are read from
+				   the device.  They are text lines, "C
+				   <old> <new>\n", unless binary records are
+				   selected with DRM_IOCTL_EVENT_MODE. */
+typedef enum {
+	_DRM_EVENT_TEXT	  = 0,
+	_DRM_EVENT_BINARY = 1
+} drm_event_format_t;
+
+typedef struct drm_event_mode {
+	drm_event_format_t format;
+} drm_event_mode_t;
+
+#define _DRM_EVENT_CONTEXT 0x01	/* Never 'C' in the first byte, so that
+				   text and binary records can be told
+				   apart. */
+
+typedef struct drm_ctx_event {
+	unsigned int	type;	  /* _DRM_EVENT_CONTEXT			    */
+	unsigned int	sequence; /* Counts every request, so that a gap
+				     shows requests dropped on overflow */
+	drm_context_t	old;
+	drm_context_t	new;
+	unsigned int	tv_sec;	  /* Time the request was queued	    */
+	unsigned int	tv_usec;
+} drm_ctx_event_t;
+
 typedef struct drm_draw {
 	drm_drawable_t	handle;
 } drm_draw_t;
@@ -323,6 +350,7 @@ typedef struct drm_agp_info {
 #define DRM_IOCTL_LOCK	     DRM_IOW( 0x2a, drm_lock_t)
 #define DRM_IOCTL_UNLOCK     DRM_IOW( 0x2b, drm_lock_t)
 #define DRM_IOCTL_FINISH     DRM_IOW( 0x2c, drm_lock_t)
+#define DRM_IOCTL_EVENT_MODE DRM_IOW( 0x2d, drm_event_mode_t)
 
 #define DRM_IOCTL_AGP_ACQUIRE DRM_IO(  0x30)
 #define DRM_IOCTL_AGP_RELEASE DRM_IO(  0x31)
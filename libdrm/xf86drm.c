@@ -85,6 +85,15 @@ extern unsigned long _bus_base(void);
 
 #define DRM_FIXED_DEVICE_MAJOR 145
 
+				/* drmMapBufsFlags flags, for an
+                                   xf86drm.h that predates them */
+#ifndef DRM_MAP_BUFS_PREFAULT
+#define DRM_MAP_BUFS_PREFAULT 0x01 /* Fault the DMA region in at once */
+#endif
+#ifndef DRM_MAP_BUFS_HUGE
+#define DRM_MAP_BUFS_HUGE     0x02 /* Ask for large pages (a hint) */
+#endif
+
 #ifdef __linux__
 #include <sys/sysmacros.h>	/* for makedev() */
 #endif
@@ -97,14 +106,96 @@ extern unsigned long _bus_base(void);
 #define makedev(x,y)    ((dev_t)(((x) << 8) | (y)))
 #endif
 
+#ifndef XFree86LOADER		/* drmEventLoop is available */
+# ifndef DRM_EPOLL
+#  ifdef __linux__
+#   define DRM_EPOLL 1
+#  else
+#   define DRM_EPOLL 0
+#  endif
+# endif
+# if DRM_EPOLL
+#  include <sys/epoll.h>
+# else
+#  include <poll.h>
+# endif
+#endif
+#define DRM_EVENT_MAX 64	/* Events per drmEventLoopDispatch wait */
+#define DRM_EVENT_BUF 4096	/* Bytes per read, the kernel's DRM_BSZ */
+
+#define DRM_SPIN_MAX 8192	/* Most polls of a held lock */
+#define DRM_SPIN_MIN 16		/* Fewest */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define DRM_PAUSE() __asm__ __volatile__("rep; nop" : : : "memory")
+#else
+#define DRM_PAUSE()
+#endif
+
+				/* Publish a pointer to data that readers
+                                   look at without a lock, and read it
+                                   back.  Before GCC 4.7 the reader relies
+                                   on the dependent load, which orders it
+                                   on every CPU except the Alpha. */
+#if defined(__GNUC__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define DRM_PUBLISH(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define DRM_CONSUME(p)    __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#elif defined(__GNUC__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define DRM_PUBLISH(p, v) do { __sync_synchronize(); (p) = (v); } while (0)
+#define DRM_CONSUME(p)    (*(volatile __typeof__(p) *)&(p))
+#else
+#define DRM_PUBLISH(p, v) ((p) = (v))
+#define DRM_CONSUME(p)    (p)
+#endif
+
+#if defined(XTHREADS) && !defined(XFree86Server)
+#define DRM_THREADS 1
+#include <pthread.h>
+static pthread_once_t drmHashOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drmTagLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drmIndexLock = PTHREAD_MUTEX_INITIALIZER;
+#else
+#define DRM_THREADS 0
+#endif
+
+extern void *drmHashCreateConcurrent(void);
+
 static void *drmHashTable = NULL; /* Context switch callbacks */
 
+#define DRM_TAG_DIRECT 4096	/* Handles below this use the vector */
+#define DRM_TAG_MIN    16	/* Smallest vector */
+
+				/* Context handles come from the kernel's
+                                   context bitmap, so they are small and
+                                   dense, and tags are kept in a vector
+                                   indexed by handle.  A vector that grows
+                                   is replaced rather than reallocated, so
+                                   that readers never need a lock; the old
+                                   ones are freed by drmClose. */
+typedef struct drmTagVector {
+    unsigned long       size;
+    struct drmTagVector *old;
+    void                *tags[1]; /* variable sized array */
+} drmTagVector;
+
 typedef struct drmHashEntry {
-    int      fd;
-    void     (*f)(int, void *, void *);
-    void     *tagTable;
+    int          fd;
+    void         (*f)(int, void *, void *);
+    drmTagVector *tags;		/* NULL means no tags */
+    void         *tagTable;	/* Handles from DRM_TAG_DIRECT on */
 } drmHashEntry;
 
+#define DRM_FD_CACHE 256	/* Descriptors with a direct slot */
+
+				/* Entries for small descriptors, so that
+                                   the context tag calls made for every
+                                   context switch need neither a system
+                                   call nor a hash lookup.  Filled in by
+                                   drmOpen and drmGetEntry, cleared by
+                                   drmClose. */
+static drmHashEntry *drmFdCache[DRM_FD_CACHE];
+
 void *drmMalloc(int size)
 {
     void *pt;
@@ -130,36 +221,47 @@ static char *drmStrdup(const char *s)
 }
 
 
-static unsigned long drmGetKeyFromFd(int fd)
+static void drmHashInit(void)
 {
-#ifdef XFree86LOADER
-    struct xf86stat st;
-#else
-    struct stat     st;
-#endif
-
-    st.st_rdev = 0;
-    fstat(fd, &st);
-    return st.st_rdev;
+    drmHashTable = drmHashCreateConcurrent();
 }
 
+/* Entries are keyed by file descriptor, so that descriptors opened on
+   the same device have separate context tags.  The tables used here are
+   safe to share between threads, but two threads may both miss on the
+   same key and race to insert it.  The loser frees its entry and uses
+   the winner's. */
+
 static drmHashEntry *drmGetEntry(int fd)
 {
-    unsigned long key = drmGetKeyFromFd(fd);
+    unsigned long key = fd;
     void          *value;
     drmHashEntry  *entry;
 
-    if (!drmHashTable) drmHashTable = drmHashCreate();
+    if (fd >= 0 && fd < DRM_FD_CACHE && (entry = drmFdCache[fd]))
+	return entry;
+
+#if DRM_THREADS
+    pthread_once(&drmHashOnce, drmHashInit);
+#else
+    if (!drmHashTable) drmHashInit();
+#endif
 
     if (drmHashLookup(drmHashTable, key, &value)) {
 	entry           = drmMalloc(sizeof(*entry));
 	entry->fd       = fd;
 	entry->f        = NULL;
-	entry->tagTable = drmHashCreate();
-	drmHashInsert(drmHashTable, key, entry);
+	entry->tags     = NULL;
+	entry->tagTable = NULL;
+	if (drmHashInsert(drmHashTable, key, entry) == 1
+	    && !drmHashLookup(drmHashTable, key, &value)) {
+	    drmFree(entry);
+	    entry = value;
+	}
     } else {
 	entry = value;
     }
+    if (fd >= 0 && fd < DRM_FD_CACHE) drmFdCache[fd] = entry;
     return entry;
 }
 
@@ -204,10 +306,241 @@ static int drmOpenDevice(const char *path, long dev,
     return drm_open(path);
 }
 
+#ifndef XFree86LOADER
+#define DRM_INDEX 1
+#else
+#define DRM_INDEX 0
+#endif
+
+#if DRM_INDEX
+#define DRM_INDEX_MAX  8	/* One entry per /dev/dri/card minor */
+#define DRM_INDEX_LEN  64
+#define DRM_INDEX_FILE "/dev/dri/.index"
+
+				/* The device index maps driver names and
+                                   bus ids to device nodes, so that
+                                   drmOpen need not probe every node.  It
+                                   is kept in memory and, when built by
+                                   root, in DRM_INDEX_FILE for other
+                                   processes.  An entry is used only if
+                                   the node still has the recorded device
+                                   number and the driver behind it
+                                   answers to the name or bus id;
+                                   otherwise it is dropped, and the probe
+                                   that follows fills it in again. */
+typedef struct drmIndexEntry {
+    char          name[DRM_INDEX_LEN];	/* Driver name, or "" */
+    char          busid[DRM_INDEX_LEN];	/* Bus id, or "" */
+    char          path[DRM_INDEX_LEN];
+    unsigned long dev;			/* st_rdev of path */
+} drmIndexEntry;
+
+static drmIndexEntry drmIndex[DRM_INDEX_MAX];
+static int           drmIndexCount = -1; /* -1 until loaded */
+
+/* Read DRM_INDEX_FILE, unless someone other than root could have written
+   it.  Called with drmIndexLock held. */
+static void drmIndexLoad(void)
+{
+    FILE          *f;
+    struct stat   st;
+    drmIndexEntry *e;
+
+    if (drmIndexCount >= 0) return;
+    drmIndexCount = 0;
+    if (!(f = fopen(DRM_INDEX_FILE, "r"))) return;
+    if (fstat(fileno(f), &st)
+	|| st.st_uid || (st.st_mode & (S_IWGRP|S_IWOTH))) {
+	fclose(f);
+	return;
+    }
+    while (drmIndexCount < DRM_INDEX_MAX) {
+	e = &drmIndex[drmIndexCount];
+	if (fscanf(f, "%63s %63s %63s %lx",
+		   e->name, e->busid, e->path, &e->dev) != 4) break;
+	if (!strcmp(e->name, "-"))  e->name[0]  = '\0';
+	if (!strcmp(e->busid, "-")) e->busid[0] = '\0';
+	++drmIndexCount;
+    }
+    fclose(f);
+}
+
+/* Replace DRM_INDEX_FILE, if root.  Called with drmIndexLock held. */
+static void drmIndexSave(void)
+{
+    char          tmp[DRM_INDEX_LEN];
+    FILE          *f;
+    drmIndexEntry *e;
+    int           i;
+
+    if (geteuid()) return;
+    sprintf(tmp, "%s.%d", DRM_INDEX_FILE, getpid());
+    if (!(f = fopen(tmp, "w"))) return;
+    for (i = 0; i < drmIndexCount; i++) {
+	e = &drmIndex[i];
+	fprintf(f, "%s %s %s %lx\n",
+		e->name[0]  ? e->name  : "-",
+		e->busid[0] ? e->busid : "-",
+		e->path, e->dev);
+    }
+    fchmod(fileno(f), S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (fclose(f) || rename(tmp, DRM_INDEX_FILE)) remove(tmp);
+}
+
+/* Record that path, with device number dev, is driven by name at busid
+   (either may be NULL if not known).  DRM_INDEX_FILE is rewritten only
+   if that changes the index, so that opening a known device writes
+   nothing. */
+static void drmIndexAdd(const char *name, const char *busid,
+			const char *path, unsigned long dev)
+{
+    drmIndexEntry *e;
+    int           changed;
+    int           i;
+
+    if ((name && strlen(name) >= DRM_INDEX_LEN)
+	|| (busid && strlen(busid) >= DRM_INDEX_LEN)
+	|| strlen(path) >= DRM_INDEX_LEN
+	|| (name && strchr(name, ' ')) || (busid && strchr(busid, ' ')))
+	return;
+#if DRM_THREADS
+    pthread_mutex_lock(&drmIndexLock);
+#endif
+    drmIndexLoad();
+    for (i = 0; i < drmIndexCount && strcmp(drmIndex[i].path, path); i++);
+    if (i < DRM_INDEX_MAX) {
+	e = &drmIndex[i];
+	if (i == drmIndexCount) {
+	    ++drmIndexCount;
+	    e->name[0]  = '\0';
+	    e->busid[0] = '\0';
+	    strcpy(e->path, path);
+	    changed = 1;
+	} else {
+	    changed = ((name && strcmp(e->name, name))
+		       || (busid && strcmp(e->busid, busid))
+		       || e->dev != dev);
+	}
+	if (changed) {
+	    if (name)  strcpy(e->name, name);
+	    if (busid) strcpy(e->busid, busid);
+	    e->dev = dev;
+	    drmIndexSave();
+	}
+    }
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmIndexLock);
+#endif
+}
+
+/* Open the node indexed for name or busid, and check it.  Returns the
+   descriptor, or -1 if there is no valid entry. */
+static int drmIndexOpen(const char *name, const char *busid)
+{
+    drmIndexEntry entry;
+    drmVersionPtr version;
+    struct stat   st;
+    char          *buf;
+    int           found = 0;
+    int           valid = 0;
+    int           fd    = -1;
+    int           i;
+
+#if DRM_THREADS
+    pthread_mutex_lock(&drmIndexLock);
+#endif
+    drmIndexLoad();
+    for (i = 0; i < drmIndexCount; i++) {
+	if (busid ? !strcmp(drmIndex[i].busid, busid)
+	          : !strcmp(drmIndex[i].name, name)) {
+	    entry = drmIndex[i];
+	    found = 1;
+	    break;
+	}
+    }
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmIndexLock);
+#endif
+    if (!found) return -1;
+
+    if ((fd = drm_open(entry.path)) >= 0
+	&& !fstat(fd, &st) && (unsigned long)st.st_rdev == entry.dev) {
+	if (busid) {
+	    if ((buf = drmGetBusid(fd))) {
+		valid = !strcmp(buf, busid);
+		drmFreeBusid(buf);
+	    }
+	} else if ((version = drmGetVersionArena(fd))) {
+	    valid = !strcmp(version->name, name);
+	    drmFreeArena(version);
+	}
+    }
+    if (valid) return fd;
+    if (fd >= 0) close(fd);
+
+#if DRM_THREADS
+    pthread_mutex_lock(&drmIndexLock);
+#endif
+    for (i = 0; i < drmIndexCount && strcmp(drmIndex[i].path, entry.path);
+	 i++);
+    if (i < drmIndexCount) {
+	drmIndex[i] = drmIndex[--drmIndexCount];
+	drmIndexSave();
+    }
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmIndexLock);
+#endif
+    return -1;
+}
+
+/* Record the node fd was opened from. */
+static void drmIndexFd(int fd, const char *name, const char *busid,
+		       const char *path)
+{
+    struct stat   st;
+    drmVersionPtr version = NULL;
+
+    if (fstat(fd, &st)) return;
+    if (!name && (version = drmGetVersionArena(fd))) name = version->name;
+    drmIndexAdd(name, busid, path, st.st_rdev);
+    if (version) drmFreeArena(version);
+}
+
+/* Return 1 if an indexed node opens and is driven by its driver. */
+static int drmIndexAvailable(void)
+{
+    char name[DRM_INDEX_MAX][DRM_INDEX_LEN];
+    int  count;
+    int  fd;
+    int  i;
+
+#if DRM_THREADS
+    pthread_mutex_lock(&drmIndexLock);
+#endif
+    drmIndexLoad();
+    for (count = 0; count < drmIndexCount; count++)
+	strcpy(name[count], drmIndex[count].name);
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmIndexLock);
+#endif
+    for (i = 0; i < count; i++) {
+	if ((fd = drmIndexOpen(name[i], NULL)) >= 0) {
+	    close(fd);
+	    return 1;
+	}
+    }
+    return 0;
+}
+#else
+#define drmIndexOpen(name, busid) (-1)
+#define drmIndexFd(fd, name, busid, path)
+#define drmIndexAvailable() 0
+#endif
+
 /* drmAvailable looks for /proc/dri, and returns 1 if it is present.  On
    OSs that do not have a Linux-like /proc, this information will not be
-   available, and we'll have to create a device and check if the driver is
-   loaded that way. */
+   available, and we'll have to check the device index or create a device
+   and check if the driver is loaded that way. */
 
 int drmAvailable(void)
 {
@@ -217,6 +550,7 @@ int drmAvailable(void)
     int           fd;
     
     if (!access("/proc/dri/0", R_OK)) return 1;
+    if (drmIndexAvailable()) return 1;
 
     sprintf(dev_name, "/dev/dri-temp-%d", getpid());
 
@@ -225,9 +559,9 @@ int drmAvailable(void)
 			    S_IRUSR, geteuid(), getegid())) >= 0) {
 				/* Read version to make sure this is
                                    actually a DRI device. */
-	if ((version = drmGetVersion(fd))) {
+	if ((version = drmGetVersionArena(fd))) {
 	    retval = 1;
-	    drmFreeVersion(version);
+	    drmFreeArena(version);
 	}
 	close(fd);
     }
@@ -243,12 +577,15 @@ static int drmOpenByBusid(const char *busid)
     char   *buf;
     int    fd;
 
+    if ((fd = drmIndexOpen(NULL, busid)) >= 0) return fd;
+
     for (i = 0; i < 8; i++) {
 	sprintf(dev_name, "/dev/dri/card%d", i);
 	if ((fd = drm_open(dev_name)) >= 0) {
 	    buf = drmGetBusid(fd);
 	    if (buf && !strcmp(buf, busid)) {
 	      drmFreeBusid(buf);
+	      drmIndexFd(fd, NULL, busid, dev_name);
 	      return fd;
 	    }
 	    if (buf) drmFreeBusid(buf);
@@ -280,6 +617,8 @@ static int drmOpenByName(const char *name)
     group = (xf86ConfigDRI.group >= 0) ? xf86ConfigDRI.group : DRM_DEV_GID;
 #endif
 
+    if ((fd = drmIndexOpen(name, NULL)) >= 0) return fd;
+
 #if defined(XFree86Server)
     if (!drmAvailable()) {
         /* try to load the kernel module now */
@@ -324,8 +663,10 @@ static int drmOpenByName(const char *name)
 			  return drmOpenByBusid(++pt);
 			} else {	/* No busid */
 			  dev = strtol(devstring, NULL, 0);
-			  return drmOpenDevice(dev_name, dev,
-					       mode, user, group);
+			  fd  = drmOpenDevice(dev_name, dev,
+					      mode, user, group);
+			  if (fd >= 0) drmIndexFd(fd, name, NULL, dev_name);
+			  return fd;
 			}
 		    }
 		}
@@ -337,14 +678,16 @@ static int drmOpenByName(const char *name)
                                    So, try to create the next device and
                                    see if it's active. */
 	    dev = makedev(DRM_FIXED_DEVICE_MAJOR, i);
-	    if ((fd = drmOpenDevice(dev_name, dev, mode, user, group))) {
-		if ((version = drmGetVersion(fd))) {
+	    if ((fd = drmOpenDevice(dev_name, dev, mode, user, group)) >= 0) {
+		if ((version = drmGetVersionArena(fd))) {
 		    if (!strcmp(version->name, name)) {
-			drmFreeVersion(version);
+			drmFreeArena(version);
+			drmIndexFd(fd, name, NULL, dev_name);
 			return fd;
 		    }
-		    drmFreeVersion(version);
+		    drmFreeArena(version);
 		}
+		close(fd);
 	    }
 	    remove(dev_name);
 	}
@@ -359,9 +702,12 @@ static int drmOpenByName(const char *name)
 
 int drmOpen(const char *name, const char *busid)
 {
+    int fd;
 
-    if (busid) return drmOpenByBusid(busid);
-    return drmOpenByName(name);
+    if (busid) fd = drmOpenByBusid(busid);
+    else       fd = drmOpenByName(name);
+    if (fd >= 0) drmGetEntry(fd);
+    return fd;
 }
 
 void drmFreeVersion(drmVersionPtr v)
@@ -444,6 +790,73 @@ drmVersionPtr drmGetVersion(int fd)
     return retval;
 }
 
+/* The Arena variants return a query result, and everything it points
+   to, in a single allocation sized from the ioctl's first pass.  The
+   kernel writes the strings straight into it, and the result is
+   released with one drmFreeArena. */
+
+#define DRM_ARENA_ALIGN(n) (((n) + sizeof(long) - 1) & ~(sizeof(long) - 1))
+
+void drmFreeArena(void *arena)
+{
+    drmFree(arena);
+}
+
+drmVersionPtr drmGetVersionArena(int fd)
+{
+    drm_version_t version;
+    drmVersionPtr retval;
+    char          *pt;
+    int           name_len;
+    int           date_len;
+    int           desc_len;
+
+    version.name_len = 0;
+    version.name     = NULL;
+    version.date_len = 0;
+    version.date     = NULL;
+    version.desc_len = 0;
+    version.desc     = NULL;
+    if (ioctl(fd, DRM_IOCTL_VERSION, &version)) return NULL;
+
+    name_len = version.name_len;
+    date_len = version.date_len;
+    desc_len = version.desc_len;
+    if (!(retval = _DRM_MALLOC(sizeof(*retval)
+			       + name_len + date_len + desc_len + 3)))
+	return NULL;
+    pt           = (char *)(retval + 1);
+    version.name = pt;
+    pt          += name_len + 1;
+    version.date = pt;
+    pt          += date_len + 1;
+    version.desc = pt;
+    if (ioctl(fd, DRM_IOCTL_VERSION, &version)) {
+	drmFree(retval);
+	return NULL;
+    }
+
+				/* The kernel reports the full lengths, but
+                                   copies no more than was asked for. */
+    if (version.name_len > name_len) version.name_len = name_len;
+    if (version.date_len > date_len) version.date_len = date_len;
+    if (version.desc_len > desc_len) version.desc_len = desc_len;
+    version.name[version.name_len] = '\0';
+    version.date[version.date_len] = '\0';
+    version.desc[version.desc_len] = '\0';
+
+    retval->version_major      = version.version_major;
+    retval->version_minor      = version.version_minor;
+    retval->version_patchlevel = version.version_patchlevel;
+    retval->name_len           = version.name_len;
+    retval->name               = version.name_len ? version.name : NULL;
+    retval->date_len           = version.date_len;
+    retval->date               = version.date_len ? version.date : NULL;
+    retval->desc_len           = version.desc_len;
+    retval->desc               = version.desc_len ? version.desc : NULL;
+    return retval;
+}
+
 void drmFreeBusid(const char *busid)
 {
     drmFree((void *)busid);
@@ -579,11 +992,20 @@ int drmFreeBufs(int fd, int count, int *list)
 
 int drmClose(int fd)
 {
-    unsigned long key    = drmGetKeyFromFd(fd);
+    unsigned long key    = fd;
     drmHashEntry  *entry = drmGetEntry(fd);
+    drmTagVector  *vector;
+    drmTagVector  *old;
 
-    drmHashDestroy(entry->tagTable);
+    if (fd >= 0 && fd < DRM_FD_CACHE) drmFdCache[fd] = NULL;
+
+    for (vector = entry->tags; vector; vector = old) {
+	old = vector->old;
+	drmFree(vector);
+    }
+    if (entry->tagTable) drmHashDestroy(entry->tagTable);
     entry->fd       = 0;
+    entry->tags     = NULL;
     entry->f        = NULL;
     entry->tagTable = NULL;
 
@@ -645,48 +1067,199 @@ drmBufInfoPtr drmGetBufInfo(int fd)
     return NULL;
 }
 
-drmBufMapPtr drmMapBufs(int fd)
+/* As drmGetBufInfo, but in one allocation, with the kernel's list after
+   the header and the client's after that. */
+drmBufInfoPtr drmGetBufInfoArena(int fd)
 {
-    drm_buf_map_t bufs;
-    drmBufMapPtr  retval;
-    int           i;
+    drm_buf_info_t info;
+    drmBufInfoPtr  retval = NULL;
+    int            count;
+    int            i;
+
+    info.count = 0;
+    info.list  = NULL;
+    if (ioctl(fd, DRM_IOCTL_INFO_BUFS, &info)) return NULL;
+
+    while (info.count) {
+	count = info.count;
+	if (!(retval = _DRM_MALLOC(DRM_ARENA_ALIGN(sizeof(*retval))
+				   + count * (sizeof(*info.list)
+					      + sizeof(*retval->list)))))
+	    return NULL;
+	info.list    = (drm_buf_desc_t *)((char *)retval
+					  + DRM_ARENA_ALIGN(sizeof(*retval)));
+	retval->list = (drmBufDescPtr)(info.list + count);
+	if (ioctl(fd, DRM_IOCTL_INFO_BUFS, &info)) {
+	    drmFree(retval);
+	    return NULL;
+	}
+				/* The kernel copies nothing if buffers
+                                   were added in between, so try again. */
+	if (info.count <= count) break;
+	drmFree(retval);
+	retval = NULL;
+    }
+    if (!retval) return NULL;
+
+    retval->count = info.count;
+    for (i = 0; i < info.count; i++) {
+	retval->list[i].count     = info.list[i].count;
+	retval->list[i].size      = info.list[i].size;
+	retval->list[i].low_mark  = info.list[i].low_mark;
+	retval->list[i].high_mark = info.list[i].high_mark;
+    }
+    return retval;
+}
+
+				/* drmMapBufs returns the map member.  The
+                                   kernel maps the whole DMA region at
+                                   once, and the rest records that
+                                   mapping for drmUnmapBufs.  The
+                                   kernel's copy of the list follows in
+                                   the same allocation; the public list
+                                   is allocated on its own, since callers
+                                   may free it. */
+typedef struct drmBufMapPrivate {
+    drmBufMap     map;
+    void          *virtual;
+    unsigned long size;
+} drmBufMapPrivate;
+
+/* Return the length of the mapping that starts at address.  The kernel
+   does not report the size of the DMA region, and the buffers may not
+   reach its end, so on Linux it is read from /proc/self/maps; elsewhere
+   guess (the end of the last buffer) is used. */
+static unsigned long drmMapLength(void *address, unsigned long guess)
+{
+#if defined(__linux__) && !defined(XFree86LOADER)
+    FILE          *f;
+    char          line[512];
+    unsigned long start;
+    unsigned long end;
+
+    if ((f = fopen("/proc/self/maps", "r"))) {
+	while (fgets(line, sizeof(line), f)) {
+	    if (sscanf(line, "%lx-%lx", &start, &end) == 2
+		&& start == (unsigned long)address) {
+		fclose(f);
+		return end - start;
+	    }
+	}
+	fclose(f);
+    }
+#endif
+    return guess;
+}
+
+/* Fault in every page of the mapping now, rather than one page at a time
+   on first touch.  The pages are only read, unless the kernel can fault
+   them in writable without touching the contents, because another
+   process may be filling a buffer. */
+static void drmPrefault(void *address, unsigned long size)
+{
+    volatile char *pt;
+    unsigned long page = getpagesize();
+    unsigned long i;
+
+#ifdef MADV_POPULATE_WRITE
+    if (!madvise(address, size, MADV_POPULATE_WRITE)) return;
+#endif
+    for (pt = address, i = 0; i < size; i += page) (void)pt[i];
+}
+
+/* Map every DMA buffer, as one mapping of the kernel's DMA region.
+   DRM_MAP_BUFS_PREFAULT faults the region in at once, and
+   DRM_MAP_BUFS_HUGE asks for large pages where the kernel can provide
+   them (it is a hint, and ignored where unsupported). */
+drmBufMapPtr drmMapBufsFlags(int fd, int flags)
+{
+    drm_buf_map_t    bufs;
+    drmBufMapPrivate *retval = NULL;
+    unsigned long    page = getpagesize();
+    unsigned long    end;
+    unsigned long    size = 0;
+    int              count;
+    int              i;
     
     bufs.count = 0;
     bufs.list  = NULL;
     if (ioctl(fd, DRM_IOCTL_MAP_BUFS, &bufs)) return NULL;
 
-    if (bufs.count) {
-	if (!(bufs.list = drmMalloc(bufs.count * sizeof(*bufs.list))))
+    while (bufs.count) {
+	count = bufs.count;
+	if (!(retval = _DRM_MALLOC(DRM_ARENA_ALIGN(sizeof(*retval))
+				   + count * sizeof(*bufs.list))))
 	    return NULL;
-
+	if (!(retval->map.list = drmMalloc(count
+					   * sizeof(*retval->map.list)))) {
+	    drmFree(retval);
+	    return NULL;
+	}
+	bufs.list = (drm_buf_pub_t *)((char *)retval
+				      + DRM_ARENA_ALIGN(sizeof(*retval)));
 	if (ioctl(fd, DRM_IOCTL_MAP_BUFS, &bufs)) {
-	    drmFree(bufs.list);
+	    drmFree(retval->map.list);
+	    drmFree(retval);
 	    return NULL;
 	}
+				/* The kernel maps nothing if buffers
+                                   were added in between, so try again. */
+	if (bufs.count <= count) break;
+	drmFree(retval->map.list);
+	drmFree(retval);
+	retval = NULL;
+    }
+    if (!retval) return NULL;
+
 				/* Now, copy it all back into the
                                    client-visible data structure... */
-	retval = drmMalloc(sizeof(*retval));
-	retval->count = bufs.count;
-	retval->list  = drmMalloc(bufs.count * sizeof(*retval->list));
-	for (i = 0; i < bufs.count; i++) {
-	    retval->list[i].idx     = bufs.list[i].idx;
-	    retval->list[i].total   = bufs.list[i].total;
-	    retval->list[i].used    = 0;
-	    retval->list[i].address = bufs.list[i].address;
-	}
-	return retval;
+    retval->map.count = bufs.count;
+    for (i = 0; i < bufs.count; i++) {
+	retval->map.list[i].idx     = bufs.list[i].idx;
+	retval->map.list[i].total   = bufs.list[i].total;
+	retval->map.list[i].used    = 0;
+	retval->map.list[i].address = bufs.list[i].address;
+	end = ((char *)bufs.list[i].address - (char *)bufs.virtual
+	       + bufs.list[i].total);
+	if (end > size) size = end;
     }
-    return NULL;
+
+    retval->virtual = bufs.virtual;
+    retval->size    = drmMapLength(bufs.virtual,
+				   (size + page - 1) & ~(page - 1));
+#ifdef MADV_HUGEPAGE
+    if (flags & DRM_MAP_BUFS_HUGE)
+	madvise(retval->virtual, retval->size, MADV_HUGEPAGE);
+#endif
+    if (flags & DRM_MAP_BUFS_PREFAULT) drmPrefault(retval->virtual,
+						   retval->size);
+    return &retval->map;
+}
+
+drmBufMapPtr drmMapBufs(int fd)
+{
+    return drmMapBufsFlags(fd, 0);
 }
 
+/* Unmap the DMA region with one munmap.  As before, bufs and its list
+   still belong to the caller, who may free them with drmFree. */
 int drmUnmapBufs(drmBufMapPtr bufs)
 {
-    int i;
-    
-    for (i = 0; i < bufs->count; i++) {
-	munmap(bufs->list[i].address, bufs->list[i].total);
-    }
-    return 0;
+    drmBufMapPrivate *map = (drmBufMapPrivate *)bufs;
+
+    return munmap(map->virtual, map->size) ? -errno : 0;
+}
+
+/* Unmap the DMA region, and free bufs and its list. */
+int drmFreeBufMap(drmBufMapPtr bufs)
+{
+    int retcode;
+
+    if (!bufs) return 0;
+    retcode = drmUnmapBufs(bufs);
+    drmFree(bufs->list);
+    drmFree(bufs);
+    return retcode;
 }
 
 int drmDMA(int fd, drmDMAReqPtr request)
@@ -709,7 +1282,208 @@ int drmDMA(int fd, drmDMAReqPtr request)
     return 0;
 }
 
-int drmGetLock(int fd, drmContext context, drmLockFlags flags)
+/* A drmDMABatch collects the buffers a client sends, with their sizes,
+   and sends each context's buffers with one DRM_IOCTL_DMA.  A context's
+   buffers are sent when count of them are queued, when they add up to
+   bytes or more, when the first was queued usec microseconds ago, or on
+   drmDMABatchFlush.  A zero bytes or usec disables that trigger; the age
+   is checked in drmDMABatchAdd and drmDMABatchPoll.  A batch is not
+   locked, so each thread should use its own. */
+
+typedef struct drmDMAQueue {
+    struct drmDMAQueue *next;
+    drmContext         context;
+    int                count;
+    int                bytes;
+#ifndef XFree86LOADER
+    struct timeval     start;	/* When the first buffer was queued */
+#endif
+    int                *list;
+    int                *sizes;
+} drmDMAQueue, *drmDMAQueuePtr;
+
+typedef struct drmDMABatch {
+    int                fd;
+    drmDMAFlags        flags;
+    int                count;
+    int                bytes;
+    int                usec;
+    drmDMAQueuePtr     queues;	/* Most recently used first */
+    drmDMABatchStats   stats;
+} drmDMABatch, *drmDMABatchPtr;
+
+void *drmDMABatchCreate(int fd, drmDMAFlags flags, int count, int bytes,
+			int usec)
+{
+    drmDMABatchPtr batch;
+
+    if (count < 1 || bytes < 0 || usec < 0) return NULL;
+    if (!(batch = drmMalloc(sizeof(*batch)))) return NULL;
+    batch->fd     = fd;
+    batch->flags  = flags;
+    batch->count  = count;
+    batch->bytes  = bytes;
+    batch->usec   = usec;
+    batch->queues = NULL;
+    memset(&batch->stats, 0, sizeof(batch->stats));
+    return batch;
+}
+
+static int drmDMABatchSend(drmDMABatchPtr batch, drmDMAQueuePtr queue)
+{
+    drmDMAReq request;
+    int       ret;
+
+    if (!queue->count) return 0;
+    request.context       = queue->context;
+    request.send_count    = queue->count;
+    request.send_list     = queue->list;
+    request.send_sizes    = queue->sizes;
+    request.flags         = batch->flags;
+    request.request_count = 0;
+    request.request_size  = 0;
+    request.request_list  = NULL;
+    request.request_sizes = NULL;
+    ++batch->stats.ioctls;
+    if ((ret = drmDMA(batch->fd, &request))) {
+				/* The kernel may have queued some of the
+                                   buffers before failing, and resending
+                                   those fails again, so drop them all as
+                                   a direct drmDMA caller would. */
+	++batch->stats.errors;
+    } else {
+	batch->stats.buffers += queue->count;
+	batch->stats.bytes   += queue->bytes;
+    }
+    queue->count = 0;
+    queue->bytes = 0;
+    return ret;
+}
+
+#ifndef XFree86LOADER
+static int drmDMAQueueAged(drmDMABatchPtr batch, drmDMAQueuePtr queue)
+{
+    struct timeval now;
+
+    if (!batch->usec || !queue->count) return 0;
+    gettimeofday(&now, NULL);
+    return ((now.tv_sec - queue->start.tv_sec) * 1000000
+	    + (now.tv_usec - queue->start.tv_usec) >= batch->usec);
+}
+#else
+#define drmDMAQueueAged(batch, queue) 0
+#endif
+
+int drmDMABatchFlush(void *b)
+{
+    drmDMABatchPtr batch = (drmDMABatchPtr)b;
+    drmDMAQueuePtr queue;
+    int            ret;
+    int            retcode = 0;
+
+    for (queue = batch->queues; queue; queue = queue->next) {
+	if (!queue->count) continue;
+	if ((ret = drmDMABatchSend(batch, queue))) retcode = ret;
+	else ++batch->stats.explicit_flushes;
+    }
+    return retcode;
+}
+
+/* Send the buffers of every context whose first buffer has waited usec
+   microseconds, for clients that may stop queueing for a while. */
+int drmDMABatchPoll(void *b)
+{
+    drmDMABatchPtr batch = (drmDMABatchPtr)b;
+    drmDMAQueuePtr queue;
+    int            ret;
+    int            retcode = 0;
+
+    for (queue = batch->queues; queue; queue = queue->next) {
+	if (!drmDMAQueueAged(batch, queue)) continue;
+	if ((ret = drmDMABatchSend(batch, queue))) retcode = ret;
+	else ++batch->stats.age_flushes;
+    }
+    return retcode;
+}
+
+/* Queue buffer idx, holding size bytes, for context.  Returns 0, or the
+   error from a send; the buffers of a failed send are not queued again,
+   and the caller owns any that the kernel did not take. */
+int drmDMABatchAdd(void *b, drmContext context, int idx, int size)
+{
+    drmDMABatchPtr batch = (drmDMABatchPtr)b;
+    drmDMAQueuePtr queue;
+    drmDMAQueuePtr prev  = NULL;
+    int            ret;
+
+    for (queue = batch->queues; queue; prev = queue, queue = queue->next)
+	if (queue->context == context) break;
+    if (!queue) {
+	if (!(queue = drmMalloc(sizeof(*queue)))) return -ENOMEM;
+	if (!(queue->list = drmMalloc(2 * batch->count * sizeof(int)))) {
+	    drmFree(queue);
+	    return -ENOMEM;
+	}
+	queue->sizes   = queue->list + batch->count;
+	queue->context = context;
+	queue->count   = 0;
+	queue->bytes   = 0;
+	queue->next    = batch->queues;
+	batch->queues  = queue;
+    } else if (prev) {		/* Move to front */
+	prev->next    = queue->next;
+	queue->next   = batch->queues;
+	batch->queues = queue;
+    }
+
+#ifndef XFree86LOADER
+    if (!queue->count && batch->usec) gettimeofday(&queue->start, NULL);
+#endif
+    queue->list[queue->count]  = idx;
+    queue->sizes[queue->count] = size;
+    ++queue->count;
+    queue->bytes += size;
+
+    if (queue->count == batch->count) {
+	if ((ret = drmDMABatchSend(batch, queue))) return ret;
+	++batch->stats.count_flushes;
+    } else if (batch->bytes && queue->bytes >= batch->bytes) {
+	if ((ret = drmDMABatchSend(batch, queue))) return ret;
+	++batch->stats.byte_flushes;
+    } else if (drmDMAQueueAged(batch, queue)) {
+	if ((ret = drmDMABatchSend(batch, queue))) return ret;
+	++batch->stats.age_flushes;
+    }
+    return 0;
+}
+
+int drmDMABatchGetStats(void *b, drmDMABatchStatsPtr stats)
+{
+    drmDMABatchPtr batch = (drmDMABatchPtr)b;
+
+    *stats = batch->stats;
+    return 0;
+}
+
+/* Send everything still queued and free the batch. */
+int drmDMABatchDestroy(void *b)
+{
+    drmDMABatchPtr batch = (drmDMABatchPtr)b;
+    drmDMAQueuePtr queue;
+    drmDMAQueuePtr next;
+    int            retcode;
+
+    retcode = drmDMABatchFlush(batch);
+    for (queue = batch->queues; queue; queue = next) {
+	next = queue->next;
+	drmFree(queue->list);
+	drmFree(queue);
+    }
+    drmFree(batch);
+    return retcode;
+}
+
+static int drmLockIoctl(int fd, drmContext context, drmLockFlags flags)
 {
     drm_lock_t lock;
 
@@ -722,7 +1496,13 @@ int drmGetLock(int fd, drmContext context, drmLockFlags flags)
     if (flags & DRM_HALT_ALL_QUEUES) lock.flags |= _DRM_HALT_ALL_QUEUES;
     if (flags & DRM_HALT_CUR_QUEUES) lock.flags |= _DRM_HALT_CUR_QUEUES;
     
-    while (ioctl(fd, DRM_IOCTL_LOCK, &lock))
+    if (ioctl(fd, DRM_IOCTL_LOCK, &lock)) return -errno;
+    return 0;
+}
+
+int drmGetLock(int fd, drmContext context, drmLockFlags flags)
+{
+    while (drmLockIoctl(fd, context, flags))
 	;
     return 0;
 }
@@ -736,6 +1516,100 @@ int drmUnlock(int fd, drmContext context)
     return ioctl(fd, DRM_IOCTL_UNLOCK, &lock);
 }
 
+static int drmLockSpin = DRM_SPIN_MIN; /* Polls that usually suffice */
+
+/* Poll a held lock until it is released, for up to twice as long as
+   recent successful waits took.  A failed wait halves the estimate, so
+   a lock held for long periods (or a uniprocessor, where the holder
+   cannot run while we spin) soon stops costing more than a few polls.
+   Returns 1 if the lock was seen free. */
+static int drmSpinLock(drmLockPtr lock)
+{
+    int limit = 2 * drmLockSpin + DRM_SPIN_MIN;
+    int i;
+
+    if (limit > DRM_SPIN_MAX) limit = DRM_SPIN_MAX;
+    for (i = 0; i < limit; i++) {
+	if (!(lock->lock & _DRM_LOCK_HELD)) {
+	    drmLockSpin += (i - drmLockSpin) / 8;
+	    return 1;
+	}
+	DRM_PAUSE();
+    }
+    drmLockSpin /= 2;
+    return 0;
+}
+
+/* Take the hardware lock in the SAREA without a system call when this
+   context was its last holder, with the same compare-and-swap as
+   DRM_LIGHT_LOCK (and drm_lock_take in the kernel).  Otherwise the
+   kernel must record the new holder, so DRM_IOCTL_LOCK is used, after
+   spinning briefly if the lock is held; flags that ask the kernel to
+   quiesce or flush always take the ioctl. */
+int drmGetLockFast(int fd, drmLockPtr lock, drmContext context,
+		   drmLockFlags flags)
+{
+    int ret;
+
+    if (!flags) {
+	DRM_CAS(lock, context, DRM_LOCK_HELD | context, ret);
+	if (!ret) return 0;
+	if ((lock->lock & _DRM_LOCK_HELD) && drmSpinLock(lock)) {
+	    DRM_CAS(lock, context, DRM_LOCK_HELD | context, ret);
+	    if (!ret) return 0;
+	}
+    }
+    return drmGetLock(fd, context, flags);
+}
+
+/* Release a lock taken with drmGetLockFast.  If another context has
+   marked the lock contended it is asleep in the kernel, and the ioctl
+   wakes it. */
+int drmUnlockFast(int fd, drmLockPtr lock, drmContext context)
+{
+    int ret;
+
+    DRM_CAS(lock, DRM_LOCK_HELD | context, context, ret);
+    if (!ret) return 0;
+    return drmUnlock(fd, context);
+}
+
+#ifndef XFree86LOADER
+/* As drmGetLockFast, but give up after msec milliseconds, returning
+   -ETIMEDOUT.  Rather than sleep in the kernel, which cannot time out,
+   a held lock is polled with an exponential backoff of up to a
+   millisecond, and the ioctl is issued only once the lock is seen free;
+   if it is taken again in between, the ioctl waits for that holder. */
+int drmGetLockTimeout(int fd, drmLockPtr lock, drmContext context,
+		      drmLockFlags flags, int msec)
+{
+    struct timeval start;
+    struct timeval now;
+    long           delay = 1;	/* usec */
+    int            ret;
+
+    if (!flags) {
+	DRM_CAS(lock, context, DRM_LOCK_HELD | context, ret);
+	if (!ret) return 0;
+    }
+    gettimeofday(&start, NULL);
+    for (;;) {
+	if (!(lock->lock & _DRM_LOCK_HELD) || drmSpinLock(lock)) {
+	    if (!flags) {
+		DRM_CAS(lock, context, DRM_LOCK_HELD | context, ret);
+		if (!ret) return 0;
+	    }
+	    if (!drmLockIoctl(fd, context, flags)) return 0;
+	}
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - start.tv_sec) * 1000
+	    + (now.tv_usec - start.tv_usec) / 1000 >= msec) return -ETIMEDOUT;
+	usleep(delay);
+	if (delay < 1000) delay *= 2;
+    }
+}
+#endif
+
 drmContextPtr drmGetReservedContextList(int fd, int *count)
 {
     drm_ctx_res_t res;
@@ -749,17 +1623,18 @@ drmContextPtr drmGetReservedContextList(int fd, int *count)
 
     if (!res.count) return NULL;
 
-    if (!(list   = drmMalloc(res.count * sizeof(*list)))) return NULL;
-    if (!(retval = drmMalloc(res.count * sizeof(*retval)))) {
-	drmFree(list);
+				/* The kernel's list follows the result,
+                                   in the same allocation. */
+    if (!(retval = _DRM_MALLOC(res.count * (sizeof(*retval)
+					    + sizeof(*list))))) return NULL;
+    list         = (drm_ctx_t *)(retval + res.count);
+    res.contexts = list;
+    if (ioctl(fd, DRM_IOCTL_RES_CTX, &res)) {
+	drmFree(retval);
 	return NULL;
     }
 
-    res.contexts = list;
-    if (ioctl(fd, DRM_IOCTL_RES_CTX, &res)) return NULL;
-
     for (i = 0; i < res.count; i++) retval[i] = list[i].handle;
-    drmFree(list);
 
     *count = res.count;
     return retval;
@@ -1045,76 +1920,166 @@ int drmGetInterruptFromBusID(int fd, int busnum, int devnum, int funcnum)
     return p.irq;
 }
 
+/* Make sure that entry's vector has a slot for context.  Called with
+   drmTagLock held. */
+
+static int drmGrowTags(drmHashEntry *entry, drmContext context)
+{
+    drmTagVector  *old = entry->tags;
+    drmTagVector  *vector;
+    unsigned long size = old ? old->size : DRM_TAG_MIN;
+    unsigned long i;
+
+    if (old && context < old->size) return 0;
+    while (size <= context) size *= 2;
+    vector = drmMalloc(sizeof(*vector) + (size - 1) * sizeof(vector->tags[0]));
+    if (!vector) return -ENOMEM;
+    vector->size = size;
+    vector->old  = old;
+    if (old) for (i = 0; i < old->size; i++) vector->tags[i] = old->tags[i];
+    DRM_PUBLISH(entry->tags, vector); /* After the copy, for readers */
+    return 0;
+}
+
 int drmAddContextTag(int fd, drmContext context, void *tag)
 {
     drmHashEntry  *entry = drmGetEntry(fd);
+    int           retcode = 0;
 
-    if (drmHashInsert(entry->tagTable, context, tag)) {
-	drmHashDelete(entry->tagTable, context);
-	drmHashInsert(entry->tagTable, context, tag);
+#if DRM_THREADS
+    pthread_mutex_lock(&drmTagLock);
+#endif
+    if (context < DRM_TAG_DIRECT) {
+	if (!(retcode = drmGrowTags(entry, context)))
+	    entry->tags->tags[context] = tag;
+    } else {
+	if (!entry->tagTable) entry->tagTable = drmHashCreateConcurrent();
+	if (drmHashInsert(entry->tagTable, context, tag)) {
+	    drmHashDelete(entry->tagTable, context);
+	    drmHashInsert(entry->tagTable, context, tag);
+	}
     }
-    return 0;
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmTagLock);
+#endif
+    return retcode;
 }
 
 int drmDelContextTag(int fd, drmContext context)
 {
     drmHashEntry  *entry = drmGetEntry(fd);
+    int           retcode = 1;
 
-    return drmHashDelete(entry->tagTable, context);
+#if DRM_THREADS
+    pthread_mutex_lock(&drmTagLock);
+#endif
+    if (context < DRM_TAG_DIRECT) {
+	if (entry->tags && context < entry->tags->size
+	    && entry->tags->tags[context]) {
+	    entry->tags->tags[context] = NULL;
+	    retcode = 0;
+	}
+    } else if (entry->tagTable) {
+	retcode = drmHashDelete(entry->tagTable, context);
+    }
+#if DRM_THREADS
+    pthread_mutex_unlock(&drmTagLock);
+#endif
+    return retcode;
 }
 
 void *drmGetContextTag(int fd, drmContext context)
 {
     drmHashEntry  *entry = drmGetEntry(fd);
+    drmTagVector  *vector = DRM_CONSUME(entry->tags);
     void          *value;
     
-    if (drmHashLookup(entry->tagTable, context, &value)) return NULL;
+    if (context < DRM_TAG_DIRECT) {
+	if (vector && context < vector->size) return vector->tags[context];
+	return NULL;
+    }
+    if (!entry->tagTable
+	|| drmHashLookup(entry->tagTable, context, &value)) return NULL;
 
     return value;
 }
 
+/* Read every queued context switch request from entry's descriptor, and
+   pass each to the callback.  The kernel writes either text, "C <old>
+   <new>\n", or drm_ctx_event_t records; a record never starts with 'C',
+   so the two can be mixed (as they are just after drmSetEventMode). */
+
+static void drmHandleEvent(drmHashEntry *entry)
+{
+    ssize_t         count;
+    drm_ctx_t       ctx;
+    typedef void    (*_drmCallback)(int, void *, void *);
+    char            buf[DRM_EVENT_BUF + 1];
+    drm_ctx_event_t event;
+    drmContext      old;
+    drmContext      new;
+    void            *oldctx;
+    void            *newctx;
+    char            *pt;
+    char            *end;
+
+#if 0
+    fprintf(stderr, "Trying %d\n", entry->fd);
+#endif
+    if ((count = read(entry->fd, buf, DRM_EVENT_BUF)) <= 0) return;
+    buf[count] = '\0';
+#if 0
+    fprintf(stderr, "Got %d bytes\n", count);
+#endif
+
+    for (pt = buf, end = buf + count; pt < end;) {
+	if (*pt == 'C') {
+	    for (; *pt && *pt != ' '; ++pt); /* Find first space */
+	    if (!*pt) return;
+	    old = strtol(pt, &pt, 0);
+	    new = strtol(pt, &pt, 0);
+	    while (pt < end && *pt++ != '\n');
+	} else {
+	    if (end - pt < (int)sizeof(event)) return;
+	    memcpy(&event, pt, sizeof(event));
+	    pt += sizeof(event);
+	    if (event.type != _DRM_EVENT_CONTEXT) continue;
+	    old = event.old;
+	    new = event.new;
+	}
+	oldctx = drmGetContextTag(entry->fd, old);
+	newctx = drmGetContextTag(entry->fd, new);
+#if 0
+	fprintf(stderr, "%d %d %p %p\n", old, new, oldctx, newctx);
+#endif
+	if (entry->f) ((_drmCallback)entry->f)(entry->fd, oldctx, newctx);
+	ctx.handle = new;
+	ioctl(entry->fd, DRM_IOCTL_NEW_CTX, &ctx);
+    }
+}
+
+/* Select the format of context switch requests.  Both are understood
+   by the dispatchers below, which ask for binary records; kernels
+   without DRM_IOCTL_EVENT_MODE only write text. */
+int drmSetEventMode(int fd, int binary)
+{
+    drm_event_mode_t mode;
+
+    mode.format = binary ? _DRM_EVENT_BINARY : _DRM_EVENT_TEXT;
+    if (ioctl(fd, DRM_IOCTL_EVENT_MODE, &mode)) return -errno;
+    return 0;
+}
+
 #if defined(XFree86Server) || defined(DRM_USE_MALLOC)
 static void drmSIGIOHandler(int interrupt, void *closure)
 {
     unsigned long key;
     void          *value;
-    ssize_t       count;
-    drm_ctx_t     ctx;
-    typedef void  (*_drmCallback)(int, void *, void *);
-    char          buf[256];
-    drmContext    old;
-    drmContext    new;
-    void          *oldctx;
-    void          *newctx;
-    char          *pt;
-    drmHashEntry  *entry;
 
     if (!drmHashTable) return;
     if (drmHashFirst(drmHashTable, &key, &value)) {
-	entry = value;
 	do {
-#if 0
-	    fprintf(stderr, "Trying %d\n", entry->fd);
-#endif
-	    if ((count = read(entry->fd, buf, sizeof(buf)))) {
-		buf[count] = '\0';
-#if 0
-		fprintf(stderr, "Got %s\n", buf);
-#endif
-		
-		for (pt = buf; *pt != ' '; ++pt); /* Find first space */
-		++pt;
-		old    = strtol(pt, &pt, 0);
-		new    = strtol(pt, NULL, 0);
-		oldctx = drmGetContextTag(entry->fd, old);
-		newctx = drmGetContextTag(entry->fd, new);
-#if 0
-		fprintf(stderr, "%d %d %p %p\n", old, new, oldctx, newctx);
-#endif
-		((_drmCallback)entry->f)(entry->fd, oldctx, newctx);
-		ctx.handle = new;
-		ioctl(entry->fd, DRM_IOCTL_NEW_CTX, &ctx);
-	    }
+	    if (((drmHashEntry *)value)->f) drmHandleEvent(value);
 	} while (drmHashNext(drmHashTable, &key, &value));
     }
 }
@@ -1125,6 +2090,7 @@ int drmInstallSIGIOHandler(int fd, void (*f)(int, void *, void *))
 
     entry     = drmGetEntry(fd);
     entry->f  = f;
+    drmSetEventMode(fd, 1);
 
     return xf86InstallSIGIOHandler(fd, drmSIGIOHandler, 0);
 }
@@ -1138,3 +2104,147 @@ int drmRemoveSIGIOHandler(int fd)
     return xf86RemoveSIGIOHandler(fd);
 }
 #endif
+
+#ifndef XFree86LOADER
+/* An event loop dispatches context switch requests for any number of
+   descriptors without SIGIO.  On Linux the descriptors are registered
+   with epoll (the kernel implements poll for DRM devices), so only
+   those that are ready are read, however many are registered.
+   Elsewhere poll(2) is used.  With epoll, drmEventLoopFd returns a
+   descriptor that becomes readable when drmEventLoopDispatch has work
+   to do, so that the loop can be driven from another select or poll
+   loop.  Without epoll there is no such descriptor and it returns -1;
+   callers must then call drmEventLoopDispatch themselves. */
+
+typedef struct drmEventLoop {
+    int           fd;		/* epoll descriptor, or -1 */
+#if !DRM_EPOLL
+    struct pollfd *fds;
+    int           count;
+    int           size;
+#endif
+} drmEventLoop, *drmEventLoopPtr;
+
+void *drmEventLoopCreate(void)
+{
+    drmEventLoopPtr loop;
+
+    if (!(loop = drmMalloc(sizeof(*loop)))) return NULL;
+#if DRM_EPOLL
+    if ((loop->fd = epoll_create(DRM_EVENT_MAX)) < 0) {
+	drmFree(loop);
+	return NULL;
+    }
+#else
+    loop->fd    = -1;
+    loop->fds   = NULL;
+    loop->count = 0;
+    loop->size  = 0;
+#endif
+    return loop;
+}
+
+int drmEventLoopDestroy(void *l)
+{
+    drmEventLoopPtr loop = (drmEventLoopPtr)l;
+
+#if DRM_EPOLL
+    close(loop->fd);
+#else
+    drmFree(loop->fds);
+#endif
+    drmFree(loop);
+    return 0;
+}
+
+/* Returns the epoll descriptor, or -1 if the loop uses poll(2). */
+int drmEventLoopFd(void *l)
+{
+    drmEventLoopPtr loop = (drmEventLoopPtr)l;
+
+    return loop->fd;
+}
+
+/* Call f(fd, oldctx, newctx) for every context switch request on fd,
+   where oldctx and newctx are the context tags. */
+int drmEventLoopAdd(void *l, int fd, void (*f)(int, void *, void *))
+{
+    drmEventLoopPtr    loop  = (drmEventLoopPtr)l;
+    drmHashEntry       *entry = drmGetEntry(fd);
+#if DRM_EPOLL
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &event)) return -errno;
+#else
+    struct pollfd      *fds;
+    int                size;
+
+    if (loop->count == loop->size) {
+	size = loop->size ? 2 * loop->size : 16;
+	if (!(fds = drmMalloc(size * sizeof(*fds)))) return -ENOMEM;
+	if (loop->count) memcpy(fds, loop->fds, loop->count * sizeof(*fds));
+	drmFree(loop->fds);
+	loop->fds  = fds;
+	loop->size = size;
+    }
+    loop->fds[loop->count].fd      = fd;
+    loop->fds[loop->count].events  = POLLIN;
+    loop->fds[loop->count].revents = 0;
+    ++loop->count;
+#endif
+    entry->f = f;
+    drmSetEventMode(fd, 1);
+    return 0;
+}
+
+int drmEventLoopRemove(void *l, int fd)
+{
+    drmEventLoopPtr    loop  = (drmEventLoopPtr)l;
+    drmHashEntry       *entry = drmGetEntry(fd);
+#if DRM_EPOLL
+    struct epoll_event event;
+
+    if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, &event)) return -errno;
+#else
+    int                i;
+
+    for (i = 0; i < loop->count && loop->fds[i].fd != fd; i++);
+    if (i == loop->count) return -ENOENT;
+    loop->fds[i] = loop->fds[--loop->count];
+#endif
+    entry->f = NULL;
+    return 0;
+}
+
+/* Wait up to timeout milliseconds (-1 waits forever, 0 not at all) for
+   requests, and dispatch those that arrive.  Returns the number of
+   descriptors dispatched, or a negative errno value. */
+int drmEventLoopDispatch(void *l, int timeout)
+{
+    drmEventLoopPtr    loop  = (drmEventLoopPtr)l;
+    int                count;
+    int                i;
+#if DRM_EPOLL
+    struct epoll_event events[DRM_EVENT_MAX];
+
+    if ((count = epoll_wait(loop->fd, events, DRM_EVENT_MAX, timeout)) < 0)
+	return -errno;
+    for (i = 0; i < count; i++)
+	drmHandleEvent(drmGetEntry(events[i].data.fd));
+#else
+    int                ready;
+
+    if ((ready = poll(loop->fds, loop->count, timeout)) < 0) return -errno;
+    for (i = count = 0; i < loop->count && count < ready; i++) {
+	if (loop->fds[i].revents) {
+	    drmHandleEvent(drmGetEntry(loop->fds[i].fd));
+	    ++count;
+	}
+    }
+#endif
+    return count;
+}
+#endif
@@ -0,0 +1,555 @@
+/* xf86drmBufPool.c -- Client-side DMA buffer pool
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This file contains a pool of DMA buffers for clients that would
+ * otherwise call drmDMA to get each buffer and drmFreeBufs to return it.
+ * drmBufPoolGet returns the index of a buffer of the pool's size, and
+ * drmBufPoolPut gives it back.
+ *
+ * Buffers are held at two levels.  Each thread has its own cache, which
+ * it uses without locking.  When a cache is empty it takes up to batch
+ * buffers from the shared list, under the pool's mutex, and when the
+ * shared list is empty too, batch buffers are requested from the kernel
+ * with a single drmDMA.  When a cache holds more than high buffers, all
+ * but low of them move to the shared list, and when the shared list then
+ * holds more than high, all but low of those are returned to the kernel
+ * with a single drmFreeBufs.  The buffers a thread holds when it exits
+ * move to the shared list.
+ *
+ * drmBufPoolGetStats reports how many requests were served from the
+ * thread caches and how many ioctls were saved, compared with one drmDMA
+ * per drmBufPoolGet and one drmFreeBufs per drmBufPoolPut.
+ *
+ * When POOL_THREADS is zero (the default for builds without XTHREADS),
+ * the pool has a single cache and no mutex.
+ *
+ * FUTURE ENHANCEMENTS
+ *
+ * A cache is kept, with its counters, until the pool is destroyed, even
+ * after its thread exits.
+ *
+ */
+
+#define POOL_MAIN 0
+
+#if POOL_MAIN
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <errno.h>
+# include <sys/time.h>
+# include <sys/syscall.h>
+#else
+# include "xf86drm.h"
+# ifdef XFree86LOADER
+#  include "xf86.h"
+#  include "xf86_ansic.h"
+# else
+#  include <stdio.h>
+#  include <stdlib.h>
+#  include <string.h>
+#  include <errno.h>
+# endif
+#endif
+
+#ifndef POOL_THREADS		/* Several threads may use a pool */
+# if POOL_MAIN || (defined(XTHREADS) && !defined(XFree86Server))
+#  define POOL_THREADS 1
+# else
+#  define POOL_THREADS 0
+# endif
+#endif
+
+#if POOL_THREADS
+# include <pthread.h>
+#endif
+
+#define N(x)  drm##x
+
+#define POOL_MAGIC 0xfacade20LU
+
+#if POOL_MAIN
+#define POOL_ALLOC malloc
+#define POOL_FREE  free
+				/* As in xf86drm.h */
+typedef unsigned int drmContext;
+
+typedef struct _drmBufPoolStats {
+    unsigned long gets;		/* drmBufPoolGet calls */
+    unsigned long puts;		/* drmBufPoolPut calls */
+    unsigned long hits;		/* Gets served from the thread's cache */
+    unsigned long dma_ioctls;	/* drmDMA calls made */
+    unsigned long free_ioctls;	/* drmFreeBufs calls made */
+    unsigned long saved;	/* Ioctls saved */
+} drmBufPoolStats, *drmBufPoolStatsPtr;
+
+static int PoolDMA(int fd, drmContext context, int size,
+		   int *list, int *sizes, int count);
+static int PoolFreeBufs(int fd, int count, int *list);
+#else
+#define POOL_ALLOC drmMalloc
+#define POOL_FREE  drmFree
+#endif
+
+typedef struct PoolCache {
+    struct PoolCache *next;	/* Every cache of the pool */
+    struct Pool      *pool;
+    int              count;
+    unsigned long    gets;
+    unsigned long    puts;
+    unsigned long    hits;
+    unsigned long    dma;
+    int              *sizes;	/* batch entries, for drmDMA */
+    int              bufs[1];	/* high + 1 entries */
+} PoolCache, *PoolCachePtr;
+
+typedef struct Pool {
+    unsigned long    magic;
+    int              fd;
+    drmContext       context;
+    int              size;
+    int              batch;
+    int              low;
+    int              high;
+#if POOL_THREADS
+    pthread_key_t    self;	/* This thread's cache */
+    pthread_mutex_t  mutex;	/* Guards the fields below */
+#endif
+    PoolCachePtr     caches;
+    unsigned long    frees;	/* drmFreeBufs calls made */
+    int              count;	/* Buffers in the shared list */
+    int              *bufs;	/* 2 * high + 1 entries */
+} Pool, *PoolPtr;
+
+#if !POOL_MAIN
+static int PoolDMA(int fd, drmContext context, int size,
+		   int *list, int *sizes, int count)
+{
+    drmDMAReq dma;
+    int       ret;
+
+    dma.context       = context;
+    dma.send_count    = 0;
+    dma.send_list     = NULL;
+    dma.send_sizes    = NULL;
+    dma.flags         = DRM_DMA_WAIT;
+    dma.request_count = count;
+    dma.request_size  = size;
+    dma.request_list  = list;
+    dma.request_sizes = sizes;
+    dma.granted_count = 0;
+    if ((ret = drmDMA(fd, &dma))) return ret;
+    return dma.granted_count;
+}
+
+#define PoolFreeBufs drmFreeBufs
+#endif
+
+static void PoolLock(PoolPtr pool)
+{
+#if POOL_THREADS
+    pthread_mutex_lock(&pool->mutex);
+#endif
+}
+
+static void PoolUnlock(PoolPtr pool)
+{
+#if POOL_THREADS
+    pthread_mutex_unlock(&pool->mutex);
+#endif
+}
+
+/* Move all but low of the shared list back to the kernel, if it holds
+   more than high.  Called with the mutex held. */
+static void PoolTrim(PoolPtr pool)
+{
+    if (pool->count <= pool->high) return;
+    PoolFreeBufs(pool->fd, pool->count - pool->low, pool->bufs + pool->low);
+    ++pool->frees;
+    pool->count = pool->low;
+}
+
+/* Move all but keep buffers of cache to the shared list. */
+static void PoolSpill(PoolCachePtr cache, int keep)
+{
+    PoolPtr pool = cache->pool;
+    int     count = cache->count - keep;
+
+    PoolLock(pool);
+    memcpy(pool->bufs + pool->count, cache->bufs + keep,
+	   count * sizeof(*cache->bufs));
+    pool->count += count;
+    cache->count = keep;
+    PoolTrim(pool);
+    PoolUnlock(pool);
+}
+
+#if POOL_THREADS
+static void PoolThreadExit(void *c)
+{
+    PoolCachePtr cache = c;
+
+    if (cache->count) PoolSpill(cache, 0);
+}
+#endif
+
+static PoolCachePtr PoolSelf(PoolPtr pool)
+{
+    PoolCachePtr cache;
+
+#if POOL_THREADS
+    if ((cache = pthread_getspecific(pool->self))) return cache;
+#else
+    if ((cache = pool->caches)) return cache;
+#endif
+    if (!(cache = POOL_ALLOC(sizeof(*cache)
+			     + (pool->high + pool->batch)
+			     * sizeof(*cache->bufs)))) return NULL;
+    memset(cache, 0, sizeof(*cache));
+    cache->pool  = pool;
+    cache->sizes = cache->bufs + pool->high + 1;
+    PoolLock(pool);
+    cache->next  = pool->caches;
+    pool->caches = cache;
+    PoolUnlock(pool);
+#if POOL_THREADS
+    pthread_setspecific(pool->self, cache);
+#endif
+    return cache;
+}
+
+/* Create a pool of buffers of size bytes for context on fd.  Buffers are
+   requested batch at a time; low and high are the watermarks for the
+   caches and the shared list (0 <= low <= high, 1 <= batch <= high). */
+void *N(BufPoolCreate)(int fd, drmContext context, int size,
+		       int batch, int low, int high)
+{
+    PoolPtr pool;
+
+    if (batch < 1 || low < 0 || low > high || batch > high) return NULL;
+    if (!(pool = POOL_ALLOC(sizeof(*pool)))) return NULL;
+    if (!(pool->bufs = POOL_ALLOC((2 * high + 1) * sizeof(*pool->bufs)))) {
+	POOL_FREE(pool);
+	return NULL;
+    }
+#if POOL_THREADS
+    if (pthread_key_create(&pool->self, PoolThreadExit)) {
+	POOL_FREE(pool->bufs);
+	POOL_FREE(pool);
+	return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+#endif
+    pool->magic   = POOL_MAGIC;
+    pool->fd      = fd;
+    pool->context = context;
+    pool->size    = size;
+    pool->batch   = batch;
+    pool->low     = low;
+    pool->high    = high;
+    pool->caches  = NULL;
+    pool->frees   = 0;
+    pool->count   = 0;
+    return pool;
+}
+
+/* Return every buffer held by the pool to the kernel, with one
+   drmFreeBufs, and free the pool.  No other thread may be using it. */
+int N(BufPoolDestroy)(void *p)
+{
+    PoolPtr      pool = (PoolPtr)p;
+    PoolCachePtr cache;
+    PoolCachePtr next;
+    int          *list;
+    int          count;
+
+    if (pool->magic != POOL_MAGIC) return -1;
+
+#if POOL_THREADS
+    pthread_key_delete(pool->self);
+#endif
+    for (count = pool->count, cache = pool->caches; cache; cache = cache->next)
+	count += cache->count;
+    if (count && (list = POOL_ALLOC(count * sizeof(*list)))) {
+	memcpy(list, pool->bufs, pool->count * sizeof(*list));
+	for (count = pool->count, cache = pool->caches; cache;
+	     cache = cache->next) {
+	    memcpy(list + count, cache->bufs, cache->count * sizeof(*list));
+	    count += cache->count;
+	}
+	PoolFreeBufs(pool->fd, count, list);
+	POOL_FREE(list);
+    }
+    for (cache = pool->caches; cache; cache = next) {
+	next = cache->next;
+	POOL_FREE(cache);
+    }
+#if POOL_THREADS
+    pthread_mutex_destroy(&pool->mutex);
+#endif
+    pool->magic = 0;
+    POOL_FREE(pool->bufs);
+    POOL_FREE(pool);
+    return 0;
+}
+
+/* Return the index of a buffer, or a negative errno value. */
+int N(BufPoolGet)(void *p)
+{
+    PoolPtr      pool = (PoolPtr)p;
+    PoolCachePtr cache;
+    int          count;
+    int          ret;
+
+    if (pool->magic != POOL_MAGIC) return -EINVAL;
+    if (!(cache = PoolSelf(pool))) return -ENOMEM;
+
+    ++cache->gets;
+    if (cache->count) {
+	++cache->hits;
+	return cache->bufs[--cache->count];
+    }
+
+    PoolLock(pool);
+    count = pool->count < pool->batch ? pool->count : pool->batch;
+    pool->count -= count;
+    memcpy(cache->bufs, pool->bufs + pool->count, count * sizeof(*pool->bufs));
+    PoolUnlock(pool);
+
+    if (!count) {
+	++cache->dma;
+	if ((ret = PoolDMA(pool->fd, pool->context, pool->size,
+			   cache->bufs, cache->sizes, pool->batch)) < 0)
+	    return ret;
+	if (!(count = ret)) return -EAGAIN;
+    }
+    cache->count = count - 1;
+    return cache->bufs[count - 1];
+}
+
+int N(BufPoolPut)(void *p, int idx)
+{
+    PoolPtr      pool = (PoolPtr)p;
+    PoolCachePtr cache;
+
+    if (pool->magic != POOL_MAGIC) return -EINVAL;
+    if (!(cache = PoolSelf(pool))) {
+	PoolFreeBufs(pool->fd, 1, &idx);
+	return -ENOMEM;
+    }
+
+    ++cache->puts;
+    cache->bufs[cache->count++] = idx;
+    if (cache->count > pool->high) PoolSpill(cache, pool->low);
+    return 0;
+}
+
+int N(BufPoolGetStats)(void *p, drmBufPoolStatsPtr stats)
+{
+    PoolPtr      pool = (PoolPtr)p;
+    PoolCachePtr cache;
+
+    if (pool->magic != POOL_MAGIC) return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    PoolLock(pool);
+    for (cache = pool->caches; cache; cache = cache->next) {
+	stats->gets       += cache->gets;
+	stats->puts       += cache->puts;
+	stats->hits       += cache->hits;
+	stats->dma_ioctls += cache->dma;
+    }
+    stats->free_ioctls = pool->frees;
+    PoolUnlock(pool);
+    stats->saved = (stats->gets + stats->puts
+		    - stats->dma_ioctls - stats->free_ioctls);
+    return 0;
+}
+
+#if POOL_MAIN
+#define KERNEL_BUFS 4096
+#define THREADS     4
+#define HELD        64		/* Most buffers a test thread holds */
+
+				/* A stand-in for the kernel's free list;
+                                   each call costs a system call, as the
+                                   ioctls would. */
+static pthread_mutex_t kernel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int             kernel_free[KERNEL_BUFS];
+static int             kernel_count;
+static unsigned long   kernel_ioctls;
+static int             owner[KERNEL_BUFS];
+
+static int PoolDMA(int fd, drmContext context, int size,
+		   int *list, int *sizes, int count)
+{
+    int i;
+
+    syscall(SYS_getppid);
+    pthread_mutex_lock(&kernel_mutex);
+    ++kernel_ioctls;
+    for (i = 0; i < count && kernel_count; i++) {
+	list[i]  = kernel_free[--kernel_count];
+	sizes[i] = size;
+    }
+    pthread_mutex_unlock(&kernel_mutex);
+    return i;
+}
+
+static int PoolFreeBufs(int fd, int count, int *list)
+{
+    int i;
+
+    syscall(SYS_getppid);
+    pthread_mutex_lock(&kernel_mutex);
+    ++kernel_ioctls;
+    for (i = 0; i < count; i++) kernel_free[kernel_count++] = list[i];
+    pthread_mutex_unlock(&kernel_mutex);
+    return 0;
+}
+
+static double usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+typedef struct Args {
+    void          *pool;
+    int           iterations;
+    unsigned long seed;
+    int           errors;
+    pthread_t     thread;
+} Args;
+
+/* Hold between 1 and HELD buffers at a time, checking that no buffer is
+   ever handed to two owners. */
+static void *stress_thread(void *a)
+{
+    Args *args = a;
+    int  held[HELD];
+    int  count = 0;
+    int  i, idx;
+
+    for (i = 0; i < args->iterations; i++) {
+	args->seed = args->seed * 1103515245 + 12345;
+	if (count < HELD && (!count || (args->seed >> 16) & 1)) {
+	    if ((idx = drmBufPoolGet(args->pool)) < 0) continue;
+	    if (!__sync_bool_compare_and_swap(&owner[idx], 0, 1))
+		++args->errors;
+	    held[count++] = idx;
+	} else {
+	    idx = held[--count];
+	    owner[idx] = 0;
+	    __sync_synchronize();
+	    drmBufPoolPut(args->pool, idx);
+	}
+    }
+    while (count) {
+	idx = held[--count];
+	owner[idx] = 0;
+	drmBufPoolPut(args->pool, idx);
+    }
+    return NULL;
+}
+
+static int check_stress(int iterations)
+{
+    Args            args[THREADS];
+    drmBufPoolStats stats;
+    void            *pool;
+    int             errors = 0;
+    int             i;
+
+    kernel_ioctls = 0;
+    pool = drmBufPoolCreate(0, 1, 4096, 16, 16, 64);
+    for (i = 0; i < THREADS; i++) {
+	args[i].pool       = pool;
+	args[i].iterations = iterations;
+	args[i].seed       = i + 1;
+	args[i].errors     = 0;
+	pthread_create(&args[i].thread, NULL, stress_thread, &args[i]);
+    }
+    for (i = 0; i < THREADS; i++) {
+	pthread_join(args[i].thread, NULL);
+	errors += args[i].errors;
+    }
+    drmBufPoolGetStats(pool, &stats);
+    printf("%d threads: %lu gets, %.1f%% hits, %lu+%lu ioctls, %lu saved\n",
+	   THREADS, stats.gets, 100.0 * stats.hits / stats.gets,
+	   stats.dma_ioctls, stats.free_ioctls, stats.saved);
+    if (stats.dma_ioctls + stats.free_ioctls != kernel_ioctls) {
+	printf("ioctls counted %lu, made %lu\n",
+	       stats.dma_ioctls + stats.free_ioctls, kernel_ioctls);
+	++errors;
+    }
+    drmBufPoolDestroy(pool);
+    if (kernel_count != KERNEL_BUFS) {
+	printf("%d buffers lost\n", KERNEL_BUFS - kernel_count);
+	++errors;
+    }
+    printf("%d errors\n", errors);
+    return errors;
+}
+
+/* Compare a get and a put through the pool with a drmDMA and a
+   drmFreeBufs per buffer. */
+static void do_time(int iterations)
+{
+    void   *pool;
+    double start;
+    int    sizes[1];
+    int    idx = 0;
+    int    i;
+
+    start = usec();
+    for (i = 0; i < iterations; i++) {
+	PoolDMA(0, 1, 4096, &idx, sizes, 1);
+	PoolFreeBufs(0, 1, &idx);
+    }
+    printf("ioctls: %.3f usec per get/put\n", (usec() - start) / iterations);
+
+    pool  = drmBufPoolCreate(0, 1, 4096, 16, 16, 64);
+    start = usec();
+    for (i = 0; i < iterations; i++)
+	drmBufPoolPut(pool, drmBufPoolGet(pool));
+    printf("pool:   %.3f usec per get/put\n", (usec() - start) / iterations);
+    drmBufPoolDestroy(pool);
+}
+
+int main(void)
+{
+    int i;
+
+    for (i = 0; i < KERNEL_BUFS; i++) kernel_free[kernel_count++] = i;
+    i = check_stress(1000000);
+    do_time(1000000);
+    return i != 0;
+}
+#endif
@@ -0,0 +1,978 @@
+/* xf86drmCSL.c -- Concurrent skip list support
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This file contains a skip list that several threads may use at the same
+ * time without locks.  It has the same operations as the lists in
+ * xf86drmSL.c: drmCSLInsert, drmCSLDelete, drmCSLLookup,
+ * drmCSLLookupNeighbors, drmCSLFirst, and drmCSLNext.
+ *
+ * The forward pointers on every level are updated with compare-and-swap,
+ * following [Fraser04] and [Herlihy08].  An entry is deleted by setting
+ * the low bit of each of its forward pointers, top level first; whoever
+ * sets the mark on level 0 owns the deletion.  Marked entries are then
+ * unlinked by the next search that passes them.  Searches that only read
+ * (lookups and iteration) skip marked entries without unlinking them, so
+ * they never write to shared memory.
+ *
+ * Unlinked entries cannot be freed while another thread may still be
+ * looking at them.  Every operation runs inside an epoch [Fraser04]:
+ * each thread announces the global epoch when it starts an operation, and
+ * the epoch can only advance once every thread inside an operation has
+ * seen its current value.  An entry unlinked in epoch E is therefore
+ * unreachable by the time the epoch reaches E + 2, and is freed then by
+ * the thread that retired it.
+ *
+ * Unlike drmSLNext, drmCSLNext does not keep a position in the list:
+ * it returns the first entry whose key is larger than *key.  Callers that
+ * pass back the key returned by the previous call see the same sequence
+ * as with drmSLNext, and several threads may iterate at once.  An
+ * iteration sees every entry that is in the list for the whole
+ * iteration, and none that is absent for the whole of it.
+ *
+ * When CSL_THREADS is zero (the default for builds without XTHREADS),
+ * the same algorithm is used with a single thread record and no pthread
+ * calls.
+ *
+ * FUTURE ENHANCEMENTS
+ *
+ * Thread records are kept until the list is destroyed, together with any
+ * entries they have retired but not yet freed.  The list level never
+ * decreases.
+ *
+ * REFERENCES
+ *
+ * [Fraser04] Keir Fraser.  Practical Lock-Freedom.  Technical Report
+ * UCAM-CL-TR-579, University of Cambridge Computer Laboratory, February
+ * 2004.
+ *
+ * [Herlihy08] Maurice Herlihy and Nir Shavit.  The Art of Multiprocessor
+ * Programming.  Morgan Kaufmann, 2008.  Chapter 14.
+ *
+ * [Pugh90] William Pugh.  Skip Lists: A Probabilistic Alternative to
+ * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.
+ *
+ */
+
+#define CSL_MAIN 0
+
+#if CSL_MAIN
+# include <stdio.h>
+# include <stdlib.h>
+# include <sys/time.h>
+#else
+# include "xf86drm.h"
+# ifdef XFree86LOADER
+#  include "xf86.h"
+#  include "xf86_ansic.h"
+# else
+#  include <stdio.h>
+#  include <stdlib.h>
+# endif
+#endif
+
+#ifndef CSL_THREADS		/* Several threads may use a list */
+# if CSL_MAIN || (defined(XTHREADS) && !defined(XFree86Server))
+#  define CSL_THREADS 1
+# else
+#  define CSL_THREADS 0
+# endif
+#endif
+
+#if CSL_THREADS
+# include <pthread.h>
+#endif
+
+#define N(x)  drm##x
+
+#define CSL_LIST_MAGIC  0xfacade10LU
+#define CSL_ENTRY_MAGIC 0x00fab1e0LU
+#define CSL_FREED_MAGIC 0xdecea5e0LU
+#define CSL_MAX_LEVEL   16
+#define CSL_CACHE_LINE  64
+#define CSL_RECLAIM     64	/* Retired entries before reclaiming */
+
+#if CSL_MAIN
+#define CSL_ALLOC malloc
+#define CSL_FREE  free
+#else
+#define CSL_ALLOC drmMalloc
+#define CSL_FREE  drmFree
+#endif
+
+				/* Shared words are accessed with the GCC
+                                   atomic builtins.  Loads of forward
+                                   pointers acquire, so the contents of an
+                                   entry are visible once it is reached;
+                                   the epoch words are sequentially
+                                   consistent.  Before GCC 4.7 there are
+                                   only the __sync builtins, which are
+                                   full barriers: stronger, but slower. */
+#if defined(__GNUC__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define CSL_LOAD(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define CSL_LOAD_SC(x)   __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define CSL_STORE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define CSL_STORE_SC(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#elif defined(__GNUC__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define CSL_LOAD(x)      __sync_fetch_and_add(&(x), 0)
+#define CSL_LOAD_SC(x)   __sync_fetch_and_add(&(x), 0)
+#define CSL_STORE(x, v)  do {                                           \
+    __sync_synchronize(); (x) = (v); __sync_synchronize();              \
+} while (0)
+#define CSL_STORE_SC(x, v) CSL_STORE(x, v)
+#else
+#error "xf86drmCSL.c needs the GCC 4.1 __sync builtins"
+#endif
+#define CSL_CAS(x, o, n) __sync_bool_compare_and_swap(&(x), (o), (n))
+#define CSL_ADD(x, v)    __sync_fetch_and_add(&(x), (v))
+
+				/* Forward pointers carry the deletion mark
+                                   in their low bit */
+#define CSL_MARKED(p)    ((p) & 1UL)
+#define CSL_MARK(p)      ((p) | 1UL)
+#define CSL_ENTRY(p)     ((CSLEntryPtr)((p) & ~1UL))
+
+#define CSL_LINKING 0		/* Insert is still linking upper levels */
+#define CSL_LINKED  1		/* Fully linked */
+#define CSL_DELETED 2		/* Deleted while the insert was linking */
+
+typedef struct CSLEntry {
+    unsigned long     magic;	   /* CSL_ENTRY_MAGIC */
+    unsigned long     key;
+    void              *value;
+    int               levels;
+    int               state;	   /* CSL_LINKING, CSL_LINKED, CSL_DELETED */
+    struct CSLEntry   *retired;	   /* Next entry waiting to be freed */
+    unsigned long     epoch;	   /* Epoch in which it was retired */
+    unsigned long     forward[1];  /* variable sized array */
+} CSLEntry, *CSLEntryPtr;
+
+typedef struct CSLThread {
+    struct CSLThread  *next;
+    unsigned long     active;	/* Epoch when in an operation, else 0 */
+    unsigned long     seed;	/* For CSLRandomLevel */
+    CSLEntryPtr       retired;	/* Newest first */
+    unsigned long     count;	/* Entries on retired */
+    unsigned long     limit;	/* Reclaim when count reaches this */
+} CSLThread, *CSLThreadPtr;
+
+typedef union CSLThreadPad {	/* Keep records on separate cache lines */
+    CSLThread         thread;
+    char              pad[CSL_CACHE_LINE * ((sizeof(CSLThread)
+					     + CSL_CACHE_LINE - 1)
+					    / CSL_CACHE_LINE)];
+} CSLThreadPad;
+
+typedef struct ConcurrentSkipList {
+    unsigned long    magic;	/* CSL_LIST_MAGIC */
+    int              level;	/* Highest level in use */
+    int              count;
+    CSLEntryPtr      head;
+    unsigned long    epoch;	/* Global epoch, starts at 1 */
+    CSLThreadPtr     threads;	/* All thread records */
+    unsigned long    seeds;	/* Thread records created */
+#if CSL_THREADS
+    pthread_key_t    self;	/* This thread's record */
+#endif
+} ConcurrentSkipList, *ConcurrentSkipListPtr;
+
+#if CSL_MAIN
+extern void *N(CSLCreate)(void);
+extern int  N(CSLDestroy)(void *l);
+extern int  N(CSLLookup)(void *l, unsigned long key, void **value);
+extern int  N(CSLInsert)(void *l, unsigned long key, void *value);
+extern int  N(CSLDelete)(void *l, unsigned long key);
+extern int  N(CSLNext)(void *l, unsigned long *key, void **value);
+extern int  N(CSLFirst)(void *l, unsigned long *key, void **value);
+extern void N(CSLDump)(void *l);
+extern int  N(CSLLookupNeighbors)(void *l, unsigned long key,
+				  unsigned long *prev_key, void **prev_value,
+				  unsigned long *next_key, void **next_value);
+#endif
+
+static CSLEntryPtr CSLCreateEntry(int levels, unsigned long key, void *value)
+{
+    CSLEntryPtr entry;
+
+    entry          = CSL_ALLOC(sizeof(*entry)
+			       + (levels - 1) * sizeof(entry->forward[0]));
+    if (!entry) return NULL;
+    entry->magic   = CSL_ENTRY_MAGIC;
+    entry->key     = key;
+    entry->value   = value;
+    entry->levels  = levels;
+    entry->state   = CSL_LINKING;
+    entry->retired = NULL;
+    entry->epoch   = 0;
+    return entry;
+}
+
+static void CSLFreeEntry(CSLEntryPtr entry)
+{
+    entry->magic = CSL_FREED_MAGIC;
+    CSL_FREE(entry);
+}
+
+/* Return the calling thread's record, creating it on first use. */
+
+static CSLThreadPtr CSLThreadFor(ConcurrentSkipListPtr list)
+{
+    CSLThreadPtr thread;
+    CSLThreadPtr first;
+
+#if CSL_THREADS
+    if ((thread = pthread_getspecific(list->self))) return thread;
+#else
+    if ((thread = list->threads)) return thread;
+#endif
+
+    if (!(thread = CSL_ALLOC(sizeof(CSLThreadPad)))) return NULL;
+    thread->active  = 0;
+    thread->retired = NULL;
+    thread->count   = 0;
+    thread->limit   = CSL_RECLAIM;
+    thread->seed    = (CSL_ADD(list->seeds, 1) + 1) * 0x9e3779b9UL;
+    thread->seed    = (thread->seed & 0xffffffffUL) | 1;
+    do {
+	first        = CSL_LOAD(list->threads);
+	thread->next = first;
+    } while (!CSL_CAS(list->threads, first, thread));
+#if CSL_THREADS
+    pthread_setspecific(list->self, thread);
+#endif
+    return thread;
+}
+
+/* Advance the global epoch from epoch if every thread inside an
+   operation has seen it. */
+
+static void CSLAdvance(ConcurrentSkipListPtr list, unsigned long epoch)
+{
+    CSLThreadPtr  thread;
+    unsigned long active;
+
+    for (thread = CSL_LOAD(list->threads); thread; thread = thread->next) {
+	active = CSL_LOAD_SC(thread->active);
+	if (active && active != epoch) return;
+    }
+    CSL_CAS(list->epoch, epoch, epoch + 1);
+}
+
+/* Free the entries retired by this thread at least two epochs ago. */
+
+static void CSLReclaim(ConcurrentSkipListPtr list, CSLThreadPtr thread)
+{
+    unsigned long epoch = CSL_LOAD_SC(list->epoch);
+    CSLEntryPtr   *pt;
+    CSLEntryPtr   entry;
+    CSLEntryPtr   next;
+
+    for (pt = &thread->retired; *pt; pt = &(*pt)->retired)
+	if ((*pt)->epoch + 2 <= epoch) break;
+    for (entry = *pt, *pt = NULL; entry; entry = next) {
+	next = entry->retired;
+	CSLFreeEntry(entry);
+	--thread->count;
+    }
+}
+
+/* Start an operation.  Returns the calling thread's record, or NULL if
+   it cannot be allocated. */
+
+static CSLThreadPtr CSLEnter(ConcurrentSkipListPtr list)
+{
+    CSLThreadPtr  thread = CSLThreadFor(list);
+    unsigned long epoch;
+
+    if (!thread) return NULL;
+    epoch = CSL_LOAD_SC(list->epoch);
+    CSL_STORE_SC(thread->active, epoch);
+    if (thread->count >= thread->limit) {
+	CSLAdvance(list, epoch);
+	CSLReclaim(list, thread);
+	thread->limit = thread->count + CSL_RECLAIM;
+    }
+    return thread;
+}
+
+static void CSLLeave(CSLThreadPtr thread)
+{
+    CSL_STORE(thread->active, 0);
+}
+
+/* Queue an unlinked entry to be freed once no thread can reach it. */
+
+static void CSLRetire(ConcurrentSkipListPtr list, CSLThreadPtr thread,
+		      CSLEntryPtr entry)
+{
+    entry->epoch    = CSL_LOAD_SC(list->epoch);
+    entry->retired  = thread->retired;
+    thread->retired = entry;
+    ++thread->count;
+}
+
+static int CSLRandomLevel(CSLThreadPtr thread)
+{
+    unsigned long r     = thread->seed;
+    int           level = 1;
+
+    r ^= (r << 13) & 0xffffffffUL;
+    r ^= r >> 17;
+    r ^= (r << 5) & 0xffffffffUL;
+    thread->seed = r;
+
+    while ((r & 0x01) && level < CSL_MAX_LEVEL) {
+	++level;
+	r >>= 1;
+    }
+    return level;
+}
+
+/* Fill in preds and succs with the last entry whose key is smaller than
+   key and the first entry whose key is at least key on every level,
+   unlinking any marked entries on the way.  Returns the level 0
+   successor. */
+
+static CSLEntryPtr CSLFind(ConcurrentSkipListPtr list, unsigned long key,
+			   CSLEntryPtr *preds, CSLEntryPtr *succs)
+{
+    CSLEntryPtr   pred;
+    CSLEntryPtr   curr;
+    unsigned long succ;
+    int           i;
+
+retry:
+    pred = list->head;
+    for (i = CSL_LOAD(list->level); i >= 0; i--) {
+	curr = CSL_ENTRY(CSL_LOAD(pred->forward[i]));
+	while (curr) {
+	    succ = CSL_LOAD(curr->forward[i]);
+	    while (CSL_MARKED(succ)) {
+		if (!CSL_CAS(pred->forward[i], (unsigned long)curr,
+			     succ & ~1UL))
+		    goto retry;
+		curr = CSL_ENTRY(succ);
+		if (!curr) break;
+		succ = CSL_LOAD(curr->forward[i]);
+	    }
+	    if (!curr || curr->key >= key) break;
+	    pred = curr;
+	    curr = CSL_ENTRY(succ);
+	}
+	preds[i] = pred;
+	succs[i] = curr;
+    }
+    for (i = CSL_LOAD(list->level) + 1; i < CSL_MAX_LEVEL; i++) {
+	preds[i] = list->head;	/* Levels added since we started */
+	succs[i] = NULL;
+    }
+    return succs[0];
+}
+
+/* Like CSLFind, but only reads: marked entries are skipped rather than
+   unlinked.  Returns the first unmarked entry whose key is at least key,
+   and sets *prev to the last one before it. */
+
+static CSLEntryPtr CSLSearch(ConcurrentSkipListPtr list, unsigned long key,
+			     CSLEntryPtr *prev)
+{
+    CSLEntryPtr   pred = list->head;
+    CSLEntryPtr   curr = NULL;
+    unsigned long succ;
+    int           i;
+
+    for (i = CSL_LOAD(list->level); i >= 0; i--) {
+	curr = CSL_ENTRY(CSL_LOAD(pred->forward[i]));
+	while (curr) {
+	    succ = CSL_LOAD(curr->forward[i]);
+	    if (CSL_MARKED(succ)) {
+		curr = CSL_ENTRY(succ);
+		continue;
+	    }
+	    if (curr->key >= key) break;
+	    pred = curr;
+	    curr = CSL_ENTRY(succ);
+	}
+    }
+    if (prev) *prev = pred;
+    return curr;
+}
+
+/* Link entry into the list above level 0.  Stops early if the entry is
+   deleted in the meantime. */
+
+static void CSLLinkUpper(ConcurrentSkipListPtr list, CSLEntryPtr entry,
+			 CSLEntryPtr *preds, CSLEntryPtr *succs)
+{
+    unsigned long next;
+    int           i;
+
+    for (i = 1; i < entry->levels; i++) {
+	for (;;) {
+	    next = CSL_LOAD(entry->forward[i]);
+	    if (CSL_MARKED(next)) return;
+	    if (next != (unsigned long)succs[i]
+		&& !CSL_CAS(entry->forward[i], next, (unsigned long)succs[i]))
+		return;		/* Marked since */
+	    if (CSL_CAS(preds[i]->forward[i], (unsigned long)succs[i],
+			(unsigned long)entry))
+		break;
+	    CSLFind(list, entry->key, preds, succs);
+	    if (succs[0] != entry) return; /* Deleted since */
+	}
+    }
+}
+
+void *N(CSLCreate)(void)
+{
+    ConcurrentSkipListPtr list;
+    int                   i;
+
+    list           = CSL_ALLOC(sizeof(*list));
+    if (!list) return NULL;
+    list->magic    = CSL_LIST_MAGIC;
+    list->level    = 0;
+    list->count    = 0;
+    list->epoch    = 1;
+    list->threads  = NULL;
+    list->seeds    = 0;
+    if (!(list->head = CSLCreateEntry(CSL_MAX_LEVEL, 0, NULL))) {
+	CSL_FREE(list);
+	return NULL;
+    }
+    list->head->state = CSL_LINKED;
+    for (i = 0; i < CSL_MAX_LEVEL; i++) list->head->forward[i] = 0;
+#if CSL_THREADS
+    if (pthread_key_create(&list->self, NULL)) {
+	CSLFreeEntry(list->head);
+	CSL_FREE(list);
+	return NULL;
+    }
+#endif
+    return list;
+}
+
+/* The caller must make sure that no other thread is using the list. */
+
+int N(CSLDestroy)(void *l)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           entry;
+    CSLEntryPtr           next;
+    CSLThreadPtr          thread;
+    CSLThreadPtr          tnext;
+
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+
+    for (entry = list->head; entry; entry = next) {
+	if (entry->magic != CSL_ENTRY_MAGIC) return -1; /* Bad magic */
+	next = CSL_ENTRY(entry->forward[0]);
+    }
+    for (entry = list->head; entry; entry = next) {
+	next = CSL_ENTRY(entry->forward[0]);
+	CSLFreeEntry(entry);
+    }
+    for (thread = list->threads; thread; thread = tnext) {
+	tnext = thread->next;
+	for (entry = thread->retired; entry; entry = next) {
+	    next = entry->retired;
+	    CSLFreeEntry(entry);
+	}
+	CSL_FREE(thread);
+    }
+#if CSL_THREADS
+    pthread_key_delete(list->self);
+#endif
+    list->magic = CSL_FREED_MAGIC;
+    CSL_FREE(list);
+    return 0;
+}
+
+int N(CSLInsert)(void *l, unsigned long key, void *value)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           preds[CSL_MAX_LEVEL];
+    CSLEntryPtr           succs[CSL_MAX_LEVEL];
+    CSLEntryPtr           entry;
+    CSLThreadPtr          thread;
+    int                   levels;
+    int                   level;
+    int                   i;
+
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+    if (!(thread = CSLEnter(list))) return -1;
+
+    levels = CSLRandomLevel(thread);
+    if (!(entry = CSLCreateEntry(levels, key, value))) {
+	CSLLeave(thread);
+	return -1;		/* Error */
+    }
+    while ((level = CSL_LOAD(list->level)) < levels - 1
+	   && !CSL_CAS(list->level, level, levels - 1));
+
+    for (;;) {
+	if (CSLFind(list, key, preds, succs) && succs[0]->key == key) {
+	    CSLFreeEntry(entry); /* Already in list */
+	    CSLLeave(thread);
+	    return 1;
+	}
+	for (i = 0; i < levels; i++) entry->forward[i] = (unsigned long)succs[i];
+	if (CSL_CAS(preds[0]->forward[0], (unsigned long)succs[0],
+		    (unsigned long)entry))
+	    break;
+    }
+    CSL_ADD(list->count, 1);
+
+    CSLLinkUpper(list, entry, preds, succs);
+    if (!CSL_CAS(entry->state, CSL_LINKING, CSL_LINKED)) {
+				/* Deleted while we were linking it, so
+                                   the deleter left it to us to unlink
+                                   and retire */
+	CSLFind(list, key, preds, succs);
+	CSLRetire(list, thread, entry);
+    }
+    CSLLeave(thread);
+    return 0;			/* Added to list */
+}
+
+int N(CSLDelete)(void *l, unsigned long key)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           preds[CSL_MAX_LEVEL];
+    CSLEntryPtr           succs[CSL_MAX_LEVEL];
+    CSLEntryPtr           entry;
+    CSLThreadPtr          thread;
+    unsigned long         next;
+    int                   i;
+
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+    if (!(thread = CSLEnter(list))) return -1;
+
+    entry = CSLFind(list, key, preds, succs);
+    if (!entry || entry->key != key) {
+	CSLLeave(thread);
+	return 1;		/* Not found */
+    }
+
+				/* Mark the upper levels, then level 0 */
+    for (i = entry->levels - 1; i > 0; i--) {
+	do {
+	    next = CSL_LOAD(entry->forward[i]);
+	} while (!CSL_MARKED(next)
+		 && !CSL_CAS(entry->forward[i], next, CSL_MARK(next)));
+    }
+    do {
+	next = CSL_LOAD(entry->forward[0]);
+	if (CSL_MARKED(next)) {	/* Another thread deleted it first */
+	    CSLLeave(thread);
+	    return 1;
+	}
+    } while (!CSL_CAS(entry->forward[0], next, CSL_MARK(next)));
+    CSL_ADD(list->count, -1);
+
+    if (CSL_CAS(entry->state, CSL_LINKING, CSL_DELETED)) {
+	CSLFind(list, key, preds, succs); /* The insert will retire it */
+    } else {
+	CSLFind(list, key, preds, succs);
+	CSLRetire(list, thread, entry);
+    }
+    CSLLeave(thread);
+    return 0;
+}
+
+int N(CSLLookup)(void *l, unsigned long key, void **value)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           entry;
+    CSLThreadPtr          thread;
+
+    *value = NULL;
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+    if (!(thread = CSLEnter(list))) return -1;
+
+    entry = CSLSearch(list, key, NULL);
+    if (entry && entry->key == key) {
+	*value = entry->value;
+	CSLLeave(thread);
+	return 0;
+    }
+    CSLLeave(thread);
+    return -1;
+}
+
+int N(CSLLookupNeighbors)(void *l, unsigned long key,
+			  unsigned long *prev_key, void **prev_value,
+			  unsigned long *next_key, void **next_value)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           prev;
+    CSLEntryPtr           next;
+    CSLThreadPtr          thread;
+    int                   retcode = 0;
+
+    *prev_key   = *next_key   = key;
+    *prev_value = *next_value = NULL;
+    if (list->magic != CSL_LIST_MAGIC) return 0; /* Bad magic */
+    if (!(thread = CSLEnter(list))) return 0;
+
+    next = CSLSearch(list, key, &prev);
+    *prev_key   = prev->key;	/* The head has key 0 and no value */
+    *prev_value = prev->value;
+    ++retcode;
+    if (next) {
+	*next_key   = next->key;
+	*next_value = next->value;
+	++retcode;
+    }
+    CSLLeave(thread);
+    return retcode;
+}
+
+/* Return the first entry whose key is larger than *key. */
+
+int N(CSLNext)(void *l, unsigned long *key, void **value)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           entry;
+    CSLThreadPtr          thread;
+
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+    if (*key == ~0UL) return 0;
+    if (!(thread = CSLEnter(list))) return -1;
+
+    entry = CSLSearch(list, *key + 1, NULL);
+    if (entry) {
+	*key   = entry->key;
+	*value = entry->value;
+    }
+    CSLLeave(thread);
+    return entry ? 1 : 0;
+}
+
+int N(CSLFirst)(void *l, unsigned long *key, void **value)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           entry;
+    CSLThreadPtr          thread;
+
+    if (list->magic != CSL_LIST_MAGIC) return -1; /* Bad magic */
+    if (!(thread = CSLEnter(list))) return -1;
+
+    entry = CSLSearch(list, 0, NULL);
+    if (entry) {
+	*key   = entry->key;
+	*value = entry->value;
+    }
+    CSLLeave(thread);
+    return entry ? 1 : 0;
+}
+
+/* Dump internal data structures for debugging.  The caller must make
+   sure that no other thread is using the list. */
+void N(CSLDump)(void *l)
+{
+    ConcurrentSkipListPtr list = (ConcurrentSkipListPtr)l;
+    CSLEntryPtr           entry;
+    CSLEntryPtr           next;
+    int                   i;
+
+    if (list->magic != CSL_LIST_MAGIC) {
+	printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
+	       list->magic, CSL_LIST_MAGIC);
+	return;
+    }
+
+    printf("Level = %d, count = %d, epoch = %lu\n",
+	   list->level, list->count, list->epoch);
+    for (entry = list->head; entry; entry = CSL_ENTRY(entry->forward[0])) {
+	if (entry->magic != CSL_ENTRY_MAGIC) {
+	    printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
+		   entry->magic, CSL_ENTRY_MAGIC);
+	}
+	printf("\nEntry %p <0x%08lx, %p> has %2d levels%s\n",
+	       (void *)entry, entry->key, entry->value, entry->levels,
+	       CSL_MARKED(entry->forward[0]) ? " (deleted)" : "");
+	for (i = 0; i < entry->levels; i++) {
+	    if ((next = CSL_ENTRY(entry->forward[i]))) {
+		printf("   %2d: %p <0x%08lx, %p>\n",
+		       i, (void *)next, next->key, next->value);
+	    } else {
+		printf("   %2d: %p\n", i, (void *)next);
+	    }
+	}
+    }
+}
+
+#if CSL_MAIN
+static void print(void *list)
+{
+    unsigned long key;
+    void          *value;
+
+    if (N(CSLFirst)(list, &key, &value)) {
+	do {
+	    printf("key = %5lu, value = %p\n", key, value);
+	} while (N(CSLNext)(list, &key, &value));
+    }
+}
+
+static void print_neighbors(void *list, unsigned long key)
+{
+    unsigned long prev_key = 0;
+    unsigned long next_key = 0;
+    void          *prev_value;
+    void          *next_value;
+    int           retval;
+
+    retval = N(CSLLookupNeighbors)(list, key,
+				   &prev_key, &prev_value,
+				   &next_key, &next_value);
+    printf("Neighbors of %5lu: %d %5lu %5lu\n",
+	   key, retval, prev_key, next_key);
+}
+
+static double elapsed(struct timeval *start)
+{
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    return (double)(stop.tv_sec - start->tv_sec) * 1000000.0
+	+ (stop.tv_usec - start->tv_usec);
+}
+
+#define STRESS_KEYS   65536	/* Key space shared by all threads */
+#define STRESS_OPS    400000	/* Operations per thread */
+
+typedef struct StressArg {
+    void          *list;
+    int           id;
+    int           writers;
+    int           percent;	/* Of operations that write */
+    unsigned long ops;
+    unsigned long errors;
+    char          *present;	/* Keys this writer has inserted */
+    pthread_t     thread;
+} StressArg;
+
+/* Writers insert and delete their own keys (those equal to their id
+   modulo the number of writers) and remember which are present; every
+   thread also looks up keys, checks neighbors, and scans short ranges,
+   checking that what it sees is consistent. */
+static void *stress_thread(void *closure)
+{
+    StressArg     *arg = closure;
+    unsigned long r    = (arg->id + 1) * 2654435761UL;
+    unsigned long i, j, key, prev_key, next_key;
+    void          *value, *prev_value, *next_value;
+
+    for (i = 0; i < arg->ops; i++) {
+	r   = r * 1103515245UL + 12345UL;
+	key = (r >> 8) % STRESS_KEYS;
+	if (arg->present && (long)((r >> 4) % 100) < arg->percent) {
+	    key -= key % arg->writers;
+	    key += arg->id;
+	    if (key >= STRESS_KEYS) continue;
+	    if (arg->present[key]) {
+		if (N(CSLDelete)(arg->list, key)) ++arg->errors;
+		arg->present[key] = 0;
+	    } else {
+		if (N(CSLInsert)(arg->list, key, (void *)key)) ++arg->errors;
+		arg->present[key] = 1;
+	    }
+	    continue;
+	}
+	switch ((r >> 16) % 8) {
+	case 0:
+	    N(CSLLookupNeighbors)(arg->list, key, &prev_key, &prev_value,
+				  &next_key, &next_value);
+	    if (prev_key >= key && prev_value) ++arg->errors;
+	    if (next_value && (next_key < key
+			       || (unsigned long)next_value != next_key))
+		++arg->errors;
+	    break;
+	case 1:
+	    if (N(CSLFirst)(arg->list, &next_key, &value) < 0) ++arg->errors;
+	    for (j = 0, prev_key = key; j < 16; j++) {
+		if (!N(CSLNext)(arg->list, &prev_key, &value)) break;
+		if ((unsigned long)value != prev_key) ++arg->errors;
+	    }
+	    break;
+	default:
+	    if (!N(CSLLookup)(arg->list, key, &value)
+		&& (unsigned long)value != key)
+		++arg->errors;
+	    break;
+	}
+    }
+    return NULL;
+}
+
+/* Fill a list with the even keys, run threads against it, then check
+   that it holds exactly the keys that the writers left in it, in
+   order. */
+static void do_stress(int readers, int writers)
+{
+    void          *list  = N(CSLCreate)();
+    StressArg     args[32];
+    int           n      = readers + writers;
+    int           i;
+    unsigned long errors = 0;
+    unsigned long key, previous = 0;
+    void          *value;
+    unsigned long count  = 0, expected = 0;
+    int           present;
+
+    for (key = 0; key < STRESS_KEYS; key += 2)
+	N(CSLInsert)(list, key, (void *)key);
+    for (i = 0; i < n; i++) {
+	args[i].list    = list;
+	args[i].id      = i;
+	args[i].writers = writers;
+	args[i].percent = i < writers ? 50 : 0;
+	args[i].ops     = STRESS_OPS;
+	args[i].errors  = 0;
+	args[i].present = NULL;
+	if (i < writers) {
+	    args[i].present = calloc(STRESS_KEYS, 1);
+	    for (key = i; key < STRESS_KEYS; key += writers)
+		args[i].present[key] = !(key & 1);
+	}
+    }
+    for (i = 0; i < n; i++)
+	pthread_create(&args[i].thread, NULL, stress_thread, &args[i]);
+    for (i = 0; i < n; i++) {
+	pthread_join(args[i].thread, NULL);
+	errors += args[i].errors;
+    }
+
+    for (key = 0; key < STRESS_KEYS; key++) {
+	present = writers ? args[key % writers].present[key] : !(key & 1);
+	if (!present) {
+	    if (!N(CSLLookup)(list, key, &value)) ++errors;
+	} else {
+	    ++expected;
+	    if (N(CSLLookup)(list, key, &value)
+		|| (unsigned long)value != key) ++errors;
+	}
+    }
+    if (N(CSLFirst)(list, &key, &value)) {
+	do {
+	    if (count && key <= previous) ++errors;
+	    previous = key;
+	    ++count;
+	} while (N(CSLNext)(list, &key, &value));
+    }
+    if (count != expected
+	|| count != (unsigned long)((ConcurrentSkipListPtr)list)->count)
+	++errors;
+    printf("%2d readers, %2d writers: %lu errors, %lu entries after (%lu)\n",
+	   readers, writers, errors, count, expected);
+    for (i = 0; i < writers; i++) free(args[i].present);
+    N(CSLDestroy)(list);
+}
+
+/* Measure aggregate throughput of a 90% lookup, 10% update mix as
+   threads are added. */
+static void do_scale(void)
+{
+    StressArg      args[32];
+    struct timeval start;
+    double         usec;
+    void           *list;
+    int            n, i;
+    unsigned long  key;
+
+    for (n = 1; n <= 16; n *= 2) {
+	list = N(CSLCreate)();
+	for (key = 0; key < STRESS_KEYS; key += 2)
+	    N(CSLInsert)(list, key, (void *)key);
+	for (i = 0; i < n; i++) {
+	    args[i].list    = list;
+	    args[i].id      = i;
+	    args[i].writers = n;
+	    args[i].percent = 10;
+	    args[i].ops     = STRESS_OPS;
+	    args[i].errors  = 0;
+	    args[i].present = calloc(STRESS_KEYS, 1);
+	    for (key = i; key < STRESS_KEYS; key += n)
+		args[i].present[key] = !(key & 1);
+	}
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n; i++)
+	    pthread_create(&args[i].thread, NULL, stress_thread, &args[i]);
+	for (i = 0; i < n; i++) pthread_join(args[i].thread, NULL);
+	usec = elapsed(&start);
+	printf("%2d threads: %8.2f Mops/s\n", n, (double)n * STRESS_OPS / usec);
+	for (i = 0; i < n; i++) free(args[i].present);
+	N(CSLDestroy)(list);
+    }
+}
+
+int main(void)
+{
+    void *list;
+
+    list = N(CSLCreate)();
+    printf( "list at %p\n", list);
+
+    print(list);
+    printf("\n==============================\n\n");
+
+    N(CSLInsert)(list, 123, NULL);
+    N(CSLInsert)(list, 213, NULL);
+    N(CSLInsert)(list, 50, NULL);
+    print(list);
+    printf("\n==============================\n\n");
+
+    print_neighbors(list, 0);
+    print_neighbors(list, 50);
+    print_neighbors(list, 51);
+    print_neighbors(list, 123);
+    print_neighbors(list, 200);
+    print_neighbors(list, 213);
+    print_neighbors(list, 256);
+    printf("\n==============================\n\n");
+
+    N(CSLDelete)(list, 50);
+    print(list);
+    printf("\n==============================\n\n");
+
+    N(CSLDump)(list);
+    N(CSLDestroy)(list);
+
+    printf("\n***** Concurrent stress ****\n");
+    do_stress(4, 0);
+    do_stress(0, 4);
+    do_stress(4, 4);
+    do_stress(2, 8);
+
+    printf("\n***** Scaling ****\n");
+    do_scale();
+
+    return 0;
+}
+#endif
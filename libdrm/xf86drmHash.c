@@ -29,9 +29,9 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward implementation of a fixed-sized
- * hash table using self-organizing linked lists [Knuth73, pp. 398-399] for
- * collision resolution.  There are two potentially interesting things
+ * This file contains a straightforward implementation of a dynamic hash
+ * table using self-organizing linked lists [Knuth73, pp. 398-399] for
+ * collision resolution.  There are three potentially interesting things
  * about this implementation:
  *
  * 1) The table is power-of-two sized.  Prime sized tables are more
@@ -42,22 +42,50 @@
  * 2) The hash computation uses a table of random integers [Hanson97,
  * pp. 39-41].
  *
+ * 3) The table grows using linear hashing [Larson88].  The buckets live
+ * in fixed-size segments that are reached through a directory, so that
+ * growing the table never moves an existing bucket.  Whenever the load
+ * factor exceeds HASH_MAX_LOAD, the single bucket at the split pointer is
+ * divided between itself and a new bucket at the end of the table.  The
+ * cost of expansion is therefore spread evenly over the insertions, and
+ * no insertion ever rehashes the whole table.
+ *
+ * When HASH_OPEN is non-zero, an alternative open-addressing backend is
+ * used instead.  It keeps the keys and values in flat parallel arrays and
+ * resolves collisions with Robin Hood linear probing [Celis85], so that a
+ * lookup touches a few adjacent cache lines and never writes to the
+ * table.  Deletion shifts the following entries back instead of leaving
+ * tombstones.  Unlike the chained backend, this one doubles (and
+ * rehashes) the whole table when it becomes more than HASH_OPEN_LOAD
+ * full.  The HASH_MAIN driver compiles both backends and compares them.
+ *
+ * The chained backend allocates its buckets from a pool that belongs to
+ * the table: buckets are carved out of chunks of geometrically increasing
+ * size, deleted buckets are kept on a free list for reuse, and all of the
+ * chunks are released at once by drmHashDestroy.  Memory from deleted
+ * entries is therefore only returned when the table is destroyed.
+ *
+ * When HASH_THREADS is non-zero (the default for threaded client
+ * builds), drmHashCreateConcurrent returns a table that is split into
+ * HASH_STRIPES backend tables, each protected by a reader/writer lock.
+ * Lookups in such a table do not organize the chains, so readers never
+ * write to shared state and never block each other, while writers only
+ * lock the stripe holding their key.
+ *
  * FUTURE ENHANCEMENTS
  *
- * With a table size of 512, the current implementation is sufficient for a
- * few hundred keys.  Since this is well above the expected size of the
- * tables for which this implementation was designed, the implementation of
- * dynamic hash tables was postponed until the need arises.  A common (and
- * naive) approach to dynamic hash table implementation simply creates a
- * new hash table when necessary, rehashes all the data into the new table,
- * and destroys the old table.  The approach in [Larson88] is superior in
- * two ways: 1) only a portion of the table is expanded when needed,
- * distributing the expansion cost over several insertions, and 2) portions
- * of the table can be locked, enabling a scalable thread-safe
- * implementation.
+ * The table never shrinks.  [Larson88] describes the inverse of the split
+ * operation, which could be used to contract the table when many entries
+ * are deleted.  Since the tables for which this implementation was
+ * designed rarely shrink, contraction was postponed until the need
+ * arises.
  *
  * REFERENCES
  *
+ * [Celis85] Pedro Celis, Per-Ake Larson, and J. Ian Munro. "Robin Hood
+ * Hashing".  Proceedings of the 26th Annual Symposium on Foundations of
+ * Computer Science, October 1985, pp. 281-288.
+ *
  * [Hanson97] David R. Hanson.  C Interfaces and Implementations:
  * Techniques for Creating Reusable Software.  Reading, Massachusetts:
  * Addison-Wesley, 1997.
@@ -75,6 +103,7 @@
 #if HASH_MAIN
 # include <stdio.h>
 # include <stdlib.h>
+# include <sys/time.h>
 #else
 # include "xf86drm.h"
 # ifdef XFree86LOADER
@@ -86,27 +115,63 @@
 # endif
 #endif
 
+#ifndef HASH_THREADS		/* Thread-safe tables are available */
+# if defined(XTHREADS) && !defined(XFree86Server)
+#  define HASH_THREADS 1
+# else
+#  define HASH_THREADS 0
+# endif
+#endif
+
+#if HASH_THREADS
+# include <pthread.h>
+#endif
+
 #define N(x)  drm##x
 
 #define HASH_MAGIC 0xdeadbeef
 #define HASH_DEBUG 0
-#define HASH_SIZE  512		/* Good for about 100 entries */
-				/* If you change this value, you probably
-                                   have to change the HashHash hashing
-                                   function! */
+#define HASH_SEGMENT_SHIFT 8
+#define HASH_SEGMENT_SIZE  (1 << HASH_SEGMENT_SHIFT) /* Buckets per segment */
+#define HASH_MIN_SIZE      HASH_SEGMENT_SIZE /* Initial number of buckets */
+#define HASH_MAX_LOAD      1	/* Split a bucket when entries/buckets
+                                   exceeds this value */
+#define HASH_POOL_MIN      16	/* Buckets in the first pool chunk */
+#define HASH_POOL_MAX      1024	/* Largest pool chunk, in buckets */
+#define HASH_BATCH         16	/* Lookups in flight in LookupBatch */
+
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 1))
+#define HASH_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HASH_PREFETCH(p)
+#endif
+
+#ifndef HASH_OPEN
+#define HASH_OPEN          0	/* Use the open-addressing backend */
+#endif
+#define HASH_OPEN_MAGIC    0xdeadf1a7
+#define HASH_OPEN_SIZE     256	/* Initial number of slots */
+#define HASH_OPEN_LOAD     75	/* Grow when more than 75% full */
+#define HASH_OPEN_MAX_DIST 255	/* Grow when a probe gets this long */
+
+#define HASH_STRIPE_MAGIC  0xdeadc0de
+#define HASH_STRIPE_SHIFT  4
+#define HASH_STRIPES       (1 << HASH_STRIPE_SHIFT) /* Locks per table */
 
 #if HASH_MAIN
 #define HASH_ALLOC malloc
 #define HASH_FREE  free
-#define HASH_RANDOM_DECL
+#define HASH_RANDOM_DECL        int i
 #define HASH_RANDOM_INIT(seed)  srandom(seed)
-#define HASH_RANDOM             random()
+#define HASH_RANDOM_FILL(v, n)  for (i = 0; i < (n); i++) (v)[i] = random()
+#define HASH_RANDOM_DONE
 #else
 #define HASH_ALLOC drmMalloc
 #define HASH_FREE  drmFree
 #define HASH_RANDOM_DECL        void *state
 #define HASH_RANDOM_INIT(seed)  state = drmRandomCreate(seed)
-#define HASH_RANDOM             drmRandom(state)
+#define HASH_RANDOM_FILL(v, n)  if (state) drmRandomFill(state, v, n)
+#define HASH_RANDOM_DONE        if (state) drmRandomDestroy(state)
 
 #endif
 
@@ -116,108 +181,343 @@ typedef struct HashBucket {
     struct HashBucket *next;
 } HashBucket, *HashBucketPtr;
 
+typedef HashBucketPtr *HashSegmentPtr;
+
+				/* Buckets are carved out of chunks that
+                                   belong to the table, and freed buckets
+                                   are kept on a list threaded through
+                                   their next pointers. */
+typedef struct HashChunk {
+    struct HashChunk  *next;
+    HashBucket        buckets[1]; /* variable sized array */
+} HashChunk, *HashChunkPtr;
+
+				/* Open addressing: slot i is empty if
+                                   dist[i] is 0, otherwise keys[i] is
+                                   dist[i]-1 slots away from its home
+                                   slot. */
+typedef struct HashOpenTable {
+    unsigned long    magic;	/* HASH_OPEN_MAGIC */
+    unsigned long    entries;
+    unsigned long    size;	/* Slots, a power of two */
+    unsigned long    *keys;
+    void             **values;
+    unsigned char    *dist;
+    unsigned long    p0;	/* Position for iteration */
+} HashOpenTable, *HashOpenTablePtr;
+
 typedef struct HashTable {
     unsigned long    magic;
     unsigned long    entries;
     unsigned long    hits;	/* At top of linked list */
     unsigned long    partials;	/* Not at top of linked list */
     unsigned long    misses;	/* Not in table */
-    HashBucketPtr    buckets[HASH_SIZE];
-    int              p0;
+    unsigned long    splits;	/* Buckets split */
+    HashSegmentPtr   *directory; /* Segments of HASH_SEGMENT_SIZE buckets */
+    unsigned long    dirsize;	/* Slots in directory */
+    unsigned long    segments;	/* Segments allocated */
+    unsigned long    maxp;	/* Buckets at start of this expansion */
+    unsigned long    p;		/* Next bucket to split */
+    unsigned long    p0;	/* Position for iteration */
     HashBucketPtr    p1;
+    HashChunkPtr     chunks;	/* Node pool */
+    unsigned long    chunksize;	/* Buckets in the next chunk */
+    HashBucketPtr    free;	/* Unused buckets */
 } HashTable, *HashTablePtr;
 
+#if HASH_THREADS
+				/* A concurrent table is a set of backend
+                                   tables, each guarded by its own
+                                   reader/writer lock. */
+typedef struct HashStripe {
+    pthread_rwlock_t lock;
+    void             *table;
+} HashStripe;
+
+typedef union HashStripePad {	/* Keep stripes on separate cache lines */
+    HashStripe       stripe;
+    char             pad[128];
+} HashStripePad;
+
+typedef struct HashStripedTable {
+    unsigned long    magic;	/* HASH_STRIPE_MAGIC */
+    unsigned long    s0;	/* Stripe for iteration */
+    HashStripePad    stripes[HASH_STRIPES];
+} HashStripedTable, *HashStripedTablePtr;
+#endif
+
 #if HASH_MAIN
 extern void *N(HashCreate)(void);
+extern void *N(HashCreateConcurrent)(void);
 extern int  N(HashDestroy)(void *t);
-extern int  N(HashLookup)(void *t, unsigned long key, unsigned long *value);
-extern int  N(HashInsert)(void *t, unsigned long key, unsigned long value);
+extern int  N(HashLookup)(void *t, unsigned long key, void **value);
+extern int  N(HashLookupBatch)(void *t, const unsigned long *keys,
+			       void **values, int count);
+extern int  N(HashInsert)(void *t, unsigned long key, void *value);
 extern int  N(HashDelete)(void *t, unsigned long key);
+extern int  N(HashFirst)(void *t, unsigned long *key, void **value);
+extern int  N(HashNext)(void *t, unsigned long *key, void **value);
 #endif
 
-static unsigned long HashHash(unsigned long key)
+static unsigned long HashScatter[256];
+
+static void HashScatterInit(void)
 {
-    unsigned long        hash = 0;
-    unsigned long        tmp  = key;
-    static int           init = 0;
-    static unsigned long scatter[256];
-    int                  i;
+    HASH_RANDOM_DECL;
+
+    HASH_RANDOM_INIT(37);
+    HASH_RANDOM_FILL(HashScatter, 256);
+    HASH_RANDOM_DONE;
+}
+
+/* Initialize the scatter table used by HashHash.  This is called when a
+   table is created, so that the hash function itself has no state to
+   check (or, with HASH_THREADS, to race on). */
+
+static void HashInit(void)
+{
+#if HASH_THREADS
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, HashScatterInit);
+#else
+    static int            init = 0;
 
     if (!init) {
-	HASH_RANDOM_DECL;
-	HASH_RANDOM_INIT(37);
-	for (i = 0; i < 256; i++) scatter[i] = HASH_RANDOM;
+	HashScatterInit();
 	++init;
     }
+#endif
+}
+
+static unsigned long HashHash(unsigned long key)
+{
+    unsigned long        hash = 0;
+    unsigned long        tmp  = key;
 
     while (tmp) {
-	hash = (hash << 1) + scatter[tmp & 0xff];
+	hash = (hash << 1) + HashScatter[tmp & 0xff];
 	tmp >>= 8;
     }
 
-    hash %= HASH_SIZE;
 #if HASH_DEBUG
-    printf( "Hash(%d) = %d\n", key, hash);
+    printf( "Hash(%lu) = %lu\n", key, hash);
 #endif
     return hash;
 }
 
-void *N(HashCreate)(void)
+#if HASH_MAIN || !HASH_OPEN
+/* Return a pointer to the head of the bucket with the given index.  The
+   caller is responsible for making sure that the bucket exists. */
+
+static HashBucketPtr *HashBucketAt(HashTablePtr table, unsigned long index)
+{
+    return &table->directory[index >> HASH_SEGMENT_SHIFT]
+	[index & (HASH_SEGMENT_SIZE - 1)];
+}
+
+/* Map a hash value to a bucket, as described in [Larson88]: buckets below
+   the split pointer have already been split, so they are addressed with
+   one more bit of the hash value. */
+
+static unsigned long HashAddress(HashTablePtr table, unsigned long hash)
+{
+    unsigned long address = hash & (table->maxp - 1);
+
+    if (address < table->p) address = hash & ((table->maxp << 1) - 1);
+    return address;
+}
+
+static HashSegmentPtr HashSegmentCreate(void)
+{
+    HashSegmentPtr segment;
+    int            i;
+
+    segment = HASH_ALLOC(HASH_SEGMENT_SIZE * sizeof(*segment));
+    if (!segment) return NULL;
+    for (i = 0; i < HASH_SEGMENT_SIZE; i++) segment[i] = NULL;
+    return segment;
+}
+
+/* Make sure the bucket with the given index exists, allocating a new
+   segment (and a larger directory) when necessary. */
+
+static int HashExtend(HashTablePtr table, unsigned long index)
+{
+    unsigned long  segment = index >> HASH_SEGMENT_SHIFT;
+    HashSegmentPtr *directory;
+    unsigned long  i;
+
+    if (segment < table->segments) return 0;
+
+    if (segment >= table->dirsize) {
+	directory = HASH_ALLOC(2 * table->dirsize * sizeof(*directory));
+	if (!directory) return -1;
+	for (i = 0; i < table->dirsize; i++)
+	    directory[i] = table->directory[i];
+	for (; i < 2 * table->dirsize; i++) directory[i] = NULL;
+	HASH_FREE(table->directory);
+	table->directory  = directory;
+	table->dirsize   *= 2;
+    }
+
+    if (!(table->directory[segment] = HashSegmentCreate())) return -1;
+    ++table->segments;
+    return 0;
+}
+
+/* Split the bucket at the split pointer between itself and a new bucket
+   at the end of the table, and advance the split pointer. */
+
+static void HashSplit(HashTablePtr table)
+{
+    unsigned long old     = table->p;
+    unsigned long new     = table->maxp + table->p;
+    HashBucketPtr *oldp;
+    HashBucketPtr *newp;
+    HashBucketPtr bucket;
+    HashBucketPtr next;
+
+    if (HashExtend(table, new)) return; /* Out of memory: keep load high */
+
+    oldp   = HashBucketAt(table, old);
+    newp   = HashBucketAt(table, new);
+    bucket = *oldp;
+    *oldp  = NULL;
+    for (; bucket; bucket = next) {
+	next = bucket->next;
+	if (HashHash(bucket->key) & table->maxp) {
+	    bucket->next = *newp;
+	    *newp        = bucket;
+	} else {
+	    bucket->next = *oldp;
+	    *oldp        = bucket;
+	}
+    }
+
+    if (++table->p == table->maxp) {
+	table->maxp <<= 1;
+	table->p      = 0;
+    }
+    ++table->splits;
+#if HASH_DEBUG
+    printf("Split %lu into %lu\n", old, new);
+#endif
+}
+
+/* Allocate a bucket from the table's pool.  When the pool is empty, a new
+   chunk is added, each one twice the size of the last (up to
+   HASH_POOL_MAX), so that small tables stay small. */
+
+static HashBucketPtr HashBucketAlloc(HashTablePtr table)
+{
+    HashChunkPtr  chunk;
+    HashBucketPtr bucket;
+    unsigned long i;
+
+    if (!table->free) {
+	chunk = HASH_ALLOC(sizeof(*chunk)
+			   + (table->chunksize - 1) * sizeof(chunk->buckets[0]));
+	if (!chunk) return NULL;
+	chunk->next   = table->chunks;
+	table->chunks = chunk;
+	for (i = table->chunksize; i-- > 0;) {
+	    chunk->buckets[i].next = table->free;
+	    table->free            = &chunk->buckets[i];
+	}
+	if (table->chunksize < HASH_POOL_MAX) table->chunksize *= 2;
+    }
+    bucket      = table->free;
+    table->free = bucket->next;
+    return bucket;
+}
+
+static void HashBucketFree(HashTablePtr table, HashBucketPtr bucket)
+{
+    bucket->next = table->free;
+    table->free  = bucket;
+}
+
+static void *HashChainCreate(void)
 {
     HashTablePtr table;
     int          i;
 
-    table           = HASH_ALLOC(sizeof(*table));
+    HashInit();
+    table            = HASH_ALLOC(sizeof(*table));
     if (!table) return NULL;
-    table->magic    = HASH_MAGIC;
-    table->entries  = 0;
-    table->hits     = 0;
-    table->partials = 0;
-    table->misses   = 0;
+    table->magic     = HASH_MAGIC;
+    table->entries   = 0;
+    table->hits      = 0;
+    table->partials  = 0;
+    table->misses    = 0;
+    table->splits    = 0;
+    table->dirsize   = 1;
+    table->segments  = 1;
+    table->maxp      = HASH_MIN_SIZE;
+    table->p         = 0;
+    table->p0        = 0;
+    table->p1        = NULL;
+    table->chunks    = NULL;
+    table->chunksize = HASH_POOL_MIN;
+    table->free      = NULL;
 
-    for (i = 0; i < HASH_SIZE; i++) table->buckets[i] = NULL;
+    table->directory = HASH_ALLOC(table->dirsize * sizeof(*table->directory));
+    if (!table->directory) {
+	HASH_FREE(table);
+	return NULL;
+    }
+    for (i = 0; i < HASH_MIN_SIZE / HASH_SEGMENT_SIZE; i++) {
+	if (!(table->directory[i] = HashSegmentCreate())) {
+	    while (i--) HASH_FREE(table->directory[i]);
+	    HASH_FREE(table->directory);
+	    HASH_FREE(table);
+	    return NULL;
+	}
+    }
     return table;
 }
 
-int N(HashDestroy)(void *t)
+static int HashChainDestroy(void *t)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    HashBucketPtr next;
-    int           i;
+    HashChunkPtr  chunk;
+    HashChunkPtr  next;
+    unsigned long i;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
     
-    for (i = 0; i < HASH_SIZE; i++) {
-	for (bucket = table->buckets[i]; bucket;) {
-	    next = bucket->next;
-	    HASH_FREE(bucket);
-	    bucket = next;
-	}
+    for (chunk = table->chunks; chunk; chunk = next) {
+	next = chunk->next;
+	HASH_FREE(chunk);
     }
+    for (i = 0; i < table->segments; i++) HASH_FREE(table->directory[i]);
+    HASH_FREE(table->directory);
+    table->magic = 0;
     HASH_FREE(table);
     return 0;
 }
 
 /* Find the bucket and organize the list so that this bucket is at the
-   top. */
+   top.  If h is not NULL, it is set to the head of the list. */
 
 static HashBucketPtr HashFind(HashTablePtr table,
-			      unsigned long key, unsigned long *h)
+			      unsigned long key, HashBucketPtr **h)
 {
-    unsigned long hash = HashHash(key);
-    HashBucketPtr prev = NULL;
+    HashBucketPtr *head = HashBucketAt(table,
+				       HashAddress(table, HashHash(key)));
+    HashBucketPtr prev  = NULL;
     HashBucketPtr bucket;
 
-    if (h) *h = hash;
+    if (h) *h = head;
 
-    for (bucket = table->buckets[hash]; bucket; bucket = bucket->next) {
+    for (bucket = *head; bucket; bucket = bucket->next) {
 	if (bucket->key == key) {
 	    if (prev) {
 				/* Organize */
-		prev->next           = bucket->next;
-		bucket->next         = table->buckets[hash];
-		table->buckets[hash] = bucket;
+		prev->next   = bucket->next;
+		bucket->next = *head;
+		*head        = bucket;
 		++table->partials;
 	    } else {
 		++table->hits;
@@ -230,7 +530,7 @@ static HashBucketPtr HashFind(HashTablePtr table,
     return NULL;
 }
 
-int N(HashLookup)(void *t, unsigned long key, void **value)
+static int HashChainLookup(void *t, unsigned long key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
     HashBucketPtr bucket;
@@ -243,70 +543,643 @@ int N(HashLookup)(void *t, unsigned long key, void **value)
     return 0;			/* Found */
 }
 
-int N(HashInsert)(void *t, unsigned long key, void *value)
+/* Look up count keys, HASH_BATCH at a time.  The bucket heads for all of
+   the keys in a batch are located and prefetched first, then the first
+   bucket of each chain, and only then are the chains searched, so that
+   the cache misses for different keys overlap.  The lists are not
+   organized. */
+
+static int HashChainLookupBatch(void *t, const unsigned long *keys,
+				void **values, int count)
+{
+    HashTablePtr  table = (HashTablePtr)t;
+    HashBucketPtr *heads[HASH_BATCH];
+    HashBucketPtr first[HASH_BATCH];
+    HashBucketPtr bucket;
+    int           found = 0;
+    int           i, j, n;
+
+    if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
+
+    for (i = 0; i < count; i += HASH_BATCH) {
+	n = count - i < HASH_BATCH ? count - i : HASH_BATCH;
+	for (j = 0; j < n; j++) {
+	    heads[j] = HashBucketAt(table,
+				    HashAddress(table, HashHash(keys[i + j])));
+	    HASH_PREFETCH(heads[j]);
+	}
+	for (j = 0; j < n; j++) {
+	    first[j] = *heads[j];
+	    if (first[j]) HASH_PREFETCH(first[j]);
+	}
+	for (j = 0; j < n; j++) {
+	    for (bucket = first[j]; bucket; bucket = bucket->next)
+		if (bucket->key == keys[i + j]) break;
+	    if (bucket) {
+		values[i + j] = bucket->value;
+		++found;
+	    } else {
+		values[i + j] = NULL;
+	    }
+	}
+    }
+    return found;
+}
+
+#if HASH_THREADS && !HASH_OPEN
+/* Like HashChainLookup, but without organizing the list or updating the
+   statistics, so that any number of readers can share the table. */
+
+static int HashChainPeek(void *t, unsigned long key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
     HashBucketPtr bucket;
-    unsigned long hash;
+
+    if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
+
+    bucket = *HashBucketAt(table, HashAddress(table, HashHash(key)));
+    for (; bucket; bucket = bucket->next) {
+	if (bucket->key == key) {
+	    *value = bucket->value;
+	    return 0;		/* Found */
+	}
+    }
+    return 1;			/* Not found */
+}
+#endif
+
+static int HashChainInsert(void *t, unsigned long key, void *value)
+{
+    HashTablePtr  table = (HashTablePtr)t;
+    HashBucketPtr bucket;
+    HashBucketPtr *head;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
     
-    if (HashFind(table, key, &hash)) return 1; /* Already in table */
+    if (HashFind(table, key, &head)) return 1; /* Already in table */
 
-    bucket               = HASH_ALLOC(sizeof(*bucket));
+    bucket         = HashBucketAlloc(table);
     if (!bucket) return -1;	/* Error */
-    bucket->key          = key;
-    bucket->value        = value;
-    bucket->next         = table->buckets[hash];
-    table->buckets[hash] = bucket;
+    bucket->key    = key;
+    bucket->value  = value;
+    bucket->next   = *head;
+    *head          = bucket;
+    ++table->entries;
 #if HASH_DEBUG
-    printf("Inserted %d at %d/%p\n", key, hash, bucket);
+    printf("Inserted %lu at %p\n", key, bucket);
 #endif
+				/* Expand by one bucket if the table
+                                   has become too full. */
+    if (table->entries > HASH_MAX_LOAD * (table->maxp + table->p))
+	HashSplit(table);
     return 0;			/* Added to table */
 }
 
-int N(HashDelete)(void *t, unsigned long key)
+static int HashChainDelete(void *t, unsigned long key)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    unsigned long hash;
+    HashBucketPtr *head;
     HashBucketPtr bucket;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
     
-    bucket = HashFind(table, key, &hash);
+    bucket = HashFind(table, key, &head);
 
     if (!bucket) return 1;	/* Not found */
 
-    table->buckets[hash] = bucket->next;
-    HASH_FREE(bucket);
+    *head = bucket->next;	/* HashFind moved bucket to the top */
+    HashBucketFree(table, bucket);
+    --table->entries;
     return 0;
 }
 
-int N(HashNext)(void *t, unsigned long *key, void **value)
+static int HashChainNext(void *t, unsigned long *key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
     
-    for (; table->p0 < HASH_SIZE;
-	 ++table->p0, table->p1 = table->buckets[table->p0]) {
+    while (table->p0 < table->maxp + table->p) {
 	if (table->p1) {
 	    *key       = table->p1->key;
 	    *value     = table->p1->value;
 	    table->p1  = table->p1->next;
 	    return 1;
 	}
+	if (++table->p0 < table->maxp + table->p)
+	    table->p1 = *HashBucketAt(table, table->p0);
     }
     return 0;
 }
 
-int N(HashFirst)(void *t, unsigned long *key, void **value)
+static int HashChainFirst(void *t, unsigned long *key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
     
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
     table->p0 = 0;
-    table->p1 = table->buckets[0];
-    return N(HashNext)(table, key, value);
+    table->p1 = *HashBucketAt(table, 0);
+    return HashChainNext(table, key, value);
+}
+#endif
+
+#if HASH_MAIN || HASH_OPEN
+/* Give the table size empty slots.  On failure the table is unchanged. */
+
+static int HashOpenAlloc(HashOpenTablePtr table, unsigned long size)
+{
+    unsigned long i;
+    unsigned long *keys;
+    void          **values;
+    unsigned char *dist;
+
+    keys   = HASH_ALLOC(size * sizeof(*keys));
+    values = HASH_ALLOC(size * sizeof(*values));
+    dist   = HASH_ALLOC(size * sizeof(*dist));
+    if (!keys || !values || !dist) {
+	if (keys)   HASH_FREE(keys);
+	if (values) HASH_FREE(values);
+	if (dist)   HASH_FREE(dist);
+	return -1;
+    }
+    for (i = 0; i < size; i++) dist[i] = 0;
+    table->keys   = keys;
+    table->values = values;
+    table->dist   = dist;
+    table->size   = size;
+    return 0;
+}
+
+static void *HashOpenCreate(void)
+{
+    HashOpenTablePtr table;
+
+    HashInit();
+    table          = HASH_ALLOC(sizeof(*table));
+    if (!table) return NULL;
+    table->magic   = HASH_OPEN_MAGIC;
+    table->entries = 0;
+    table->p0      = 0;
+    if (HashOpenAlloc(table, HASH_OPEN_SIZE)) {
+	HASH_FREE(table);
+	return NULL;
+    }
+    return table;
+}
+
+static int HashOpenDestroy(void *t)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    HASH_FREE(table->keys);
+    HASH_FREE(table->values);
+    HASH_FREE(table->dist);
+    table->magic = 0;
+    HASH_FREE(table);
+    return 0;
+}
+
+/* Return the slot holding key, searching from its home slot, or -1 if key
+   is not in the table.  The table is only read. */
+
+static long HashOpenProbe(HashOpenTablePtr table,
+			  unsigned long key, unsigned long slot)
+{
+    unsigned long mask = table->size - 1;
+    unsigned int  dist;
+
+    for (dist = 1; dist <= table->dist[slot]; dist++) {
+	if (table->keys[slot] == key) return slot;
+	slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static long HashOpenFind(HashOpenTablePtr table, unsigned long key)
+{
+    return HashOpenProbe(table, key, HashHash(key) & (table->size - 1));
+}
+
+static int HashOpenLookup(void *t, unsigned long key, void **value)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+    long             slot;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    if ((slot = HashOpenFind(table, key)) < 0) return 1; /* Not found */
+    *value = table->values[slot];
+    return 0;			/* Found */
+}
+
+#define HashOpenPeek HashOpenLookup /* Lookups never write to the table */
+
+/* Look up count keys, HASH_BATCH at a time, prefetching the home slot of
+   every key in a batch before probing any of them. */
+
+static int HashOpenLookupBatch(void *t, const unsigned long *keys,
+			       void **values, int count)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+    unsigned long    mask  = table->size - 1;
+    unsigned long    home[HASH_BATCH];
+    long             slot;
+    int              found = 0;
+    int              i, j, n;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    for (i = 0; i < count; i += HASH_BATCH) {
+	n = count - i < HASH_BATCH ? count - i : HASH_BATCH;
+	for (j = 0; j < n; j++) {
+	    home[j] = HashHash(keys[i + j]) & mask;
+	    HASH_PREFETCH(&table->dist[home[j]]);
+	    HASH_PREFETCH(&table->keys[home[j]]);
+	}
+	for (j = 0; j < n; j++) {
+	    if ((slot = HashOpenProbe(table, keys[i + j], home[j])) >= 0) {
+		values[i + j] = table->values[slot];
+		++found;
+	    } else {
+		values[i + j] = NULL;
+	    }
+	}
+    }
+    return found;
+}
+
+/* Place a key that is known not to be in the table.  Returns -1 if some
+   probe sequence would get too long, in which case the table must grow.
+   This is found before anything is moved: the slots ahead of the probe
+   are never written, so the displacements can be followed without
+   making them, and a table that is too full is left untouched. */
+
+static int HashOpenPlace(HashOpenTablePtr table,
+			 unsigned long key, void *value)
+{
+    unsigned long mask = table->size - 1;
+    unsigned long home = HashHash(key) & mask;
+    unsigned long slot = home;
+    unsigned int  dist = 1;
+    unsigned long tmp_key;
+    void          *tmp_value;
+    unsigned int  tmp_dist;
+
+    for (; table->dist[slot]; slot = (slot + 1) & mask) {
+	if (table->dist[slot] < dist) dist = table->dist[slot];
+	if (++dist > HASH_OPEN_MAX_DIST) return -1;
+    }
+
+    slot = home;
+    dist = 1;
+    for (;;) {
+	if (!table->dist[slot]) {
+	    table->keys[slot]   = key;
+	    table->values[slot] = value;
+	    table->dist[slot]   = dist;
+	    return 0;
+	}
+	if (table->dist[slot] < dist) {
+				/* Robin Hood: take from the rich */
+	    tmp_key             = table->keys[slot];
+	    tmp_value           = table->values[slot];
+	    tmp_dist            = table->dist[slot];
+	    table->keys[slot]   = key;
+	    table->values[slot] = value;
+	    table->dist[slot]   = dist;
+	    key                 = tmp_key;
+	    value               = tmp_value;
+	    dist                = tmp_dist;
+	}
+	++dist;
+	slot = (slot + 1) & mask;
+    }
+}
+
+static int HashOpenGrow(HashOpenTablePtr table)
+{
+    HashOpenTable old;
+    unsigned long i;
+
+    old = *table;
+    if (HashOpenAlloc(table, old.size * 2)) return -1;
+    for (i = 0; i < old.size; i++) {
+	if (!old.dist[i]) continue;
+	if (HashOpenPlace(table, old.keys[i], old.values[i])) {
+				/* Cannot happen with a reasonable hash
+                                   function: give up and keep the old
+                                   table. */
+	    HASH_FREE(table->keys);
+	    HASH_FREE(table->values);
+	    HASH_FREE(table->dist);
+	    *table = old;
+	    return -1;
+	}
+    }
+    HASH_FREE(old.keys);
+    HASH_FREE(old.values);
+    HASH_FREE(old.dist);
+    return 0;
+}
+
+static int HashOpenInsert(void *t, unsigned long key, void *value)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    if (HashOpenFind(table, key) >= 0) return 1; /* Already in table */
+
+    if ((table->entries + 1) * 100 > table->size * HASH_OPEN_LOAD
+	&& HashOpenGrow(table)) return -1; /* Error */
+
+    while (HashOpenPlace(table, key, value)) {
+	if (HashOpenGrow(table)) return -1; /* Error */
+    }
+    ++table->entries;
+    return 0;			/* Added to table */
+}
+
+static int HashOpenDelete(void *t, unsigned long key)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+    unsigned long    mask  = table->size - 1;
+    unsigned long    slot;
+    unsigned long    next;
+    long             found;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    if ((found = HashOpenFind(table, key)) < 0) return 1; /* Not found */
+
+				/* Shift the following entries back until
+                                   an empty slot, or an entry in its home
+                                   slot, is found. */
+    slot = found;
+    for (next = (slot + 1) & mask;
+	 table->dist[next] > 1;
+	 slot = next, next = (next + 1) & mask) {
+	table->keys[slot]   = table->keys[next];
+	table->values[slot] = table->values[next];
+	table->dist[slot]   = table->dist[next] - 1;
+    }
+    table->dist[slot] = 0;
+    --table->entries;
+    return 0;
+}
+
+static int HashOpenNext(void *t, unsigned long *key, void **value)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+
+    for (; table->p0 < table->size; ++table->p0) {
+	if (table->dist[table->p0]) {
+	    *key   = table->keys[table->p0];
+	    *value = table->values[table->p0];
+	    ++table->p0;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static int HashOpenFirst(void *t, unsigned long *key, void **value)
+{
+    HashOpenTablePtr table = (HashOpenTablePtr)t;
+
+    if (table->magic != HASH_OPEN_MAGIC) return -1; /* Bad magic */
+
+    table->p0 = 0;
+    return HashOpenNext(table, key, value);
+}
+#endif
+
+#if HASH_OPEN
+#define HASH_BACKEND(x) HashOpen##x
+#else
+#define HASH_BACKEND(x) HashChain##x
+#endif
+
+#if HASH_THREADS
+/* Choose the stripe from the key with a multiplicative hash, so that the
+   choice is independent of the HashHash bits used to address buckets
+   within the stripe. */
+
+static HashStripe *HashStripeFor(HashStripedTablePtr table, unsigned long key)
+{
+    unsigned long fold = (key ^ (key >> 16 >> 16)) & 0xffffffffUL;
+    unsigned long s    = ((fold * 2654435761UL) & 0xffffffffUL)
+			 >> (32 - HASH_STRIPE_SHIFT);
+
+    return &table->stripes[s].stripe;
+}
+
+static void *HashStripedCreate(void)
+{
+    HashStripedTablePtr table;
+    HashStripe          *stripe;
+    int                 i;
+
+    table = HASH_ALLOC(sizeof(*table));
+    if (!table) return NULL;
+    for (i = 0; i < HASH_STRIPES; i++) {
+	stripe        = &table->stripes[i].stripe;
+	stripe->table = HASH_BACKEND(Create)();
+	if (!stripe->table || pthread_rwlock_init(&stripe->lock, NULL)) {
+	    if (stripe->table) HASH_BACKEND(Destroy)(stripe->table);
+	    while (i--) {
+		stripe = &table->stripes[i].stripe;
+		HASH_BACKEND(Destroy)(stripe->table);
+		pthread_rwlock_destroy(&stripe->lock);
+	    }
+	    HASH_FREE(table);
+	    return NULL;
+	}
+    }
+    table->magic = HASH_STRIPE_MAGIC;
+    table->s0    = 0;
+    return table;
+}
+
+static int HashStripedDestroy(HashStripedTablePtr table)
+{
+    HashStripe *stripe;
+    int        i;
+
+    for (i = 0; i < HASH_STRIPES; i++) {
+	stripe = &table->stripes[i].stripe;
+	HASH_BACKEND(Destroy)(stripe->table);
+	pthread_rwlock_destroy(&stripe->lock);
+    }
+    table->magic = 0;
+    HASH_FREE(table);
+    return 0;
+}
+
+static int HashStripedLookup(HashStripedTablePtr table,
+			     unsigned long key, void **value)
+{
+    HashStripe *stripe = HashStripeFor(table, key);
+    int        retcode;
+
+    pthread_rwlock_rdlock(&stripe->lock);
+    retcode = HASH_BACKEND(Peek)(stripe->table, key, value);
+    pthread_rwlock_unlock(&stripe->lock);
+    return retcode;
+}
+
+/* The keys may belong to any stripe, so they are looked up one at a time,
+   each under its stripe's read lock. */
+
+static int HashStripedLookupBatch(HashStripedTablePtr table,
+				  const unsigned long *keys,
+				  void **values, int count)
+{
+    int found = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	if (!HashStripedLookup(table, keys[i], &values[i])) ++found;
+	else values[i] = NULL;
+    }
+    return found;
+}
+
+static int HashStripedInsert(HashStripedTablePtr table,
+			     unsigned long key, void *value)
+{
+    HashStripe *stripe = HashStripeFor(table, key);
+    int        retcode;
+
+    pthread_rwlock_wrlock(&stripe->lock);
+    retcode = HASH_BACKEND(Insert)(stripe->table, key, value);
+    pthread_rwlock_unlock(&stripe->lock);
+    return retcode;
+}
+
+static int HashStripedDelete(HashStripedTablePtr table, unsigned long key)
+{
+    HashStripe *stripe = HashStripeFor(table, key);
+    int        retcode;
+
+    pthread_rwlock_wrlock(&stripe->lock);
+    retcode = HASH_BACKEND(Delete)(stripe->table, key);
+    pthread_rwlock_unlock(&stripe->lock);
+    return retcode;
+}
+
+/* Iterate over the stripes in turn.  The iteration position lives in the
+   backend tables, so each step takes the stripe's write lock. */
+
+static int HashStripedNext(HashStripedTablePtr table,
+			   unsigned long *key, void **value, int first)
+{
+    HashStripe *stripe;
+    int        retcode;
+
+    for (; table->s0 < HASH_STRIPES; ++table->s0, first = 1) {
+	stripe = &table->stripes[table->s0].stripe;
+	pthread_rwlock_wrlock(&stripe->lock);
+	if (first) retcode = HASH_BACKEND(First)(stripe->table, key, value);
+	else       retcode = HASH_BACKEND(Next)(stripe->table, key, value);
+	pthread_rwlock_unlock(&stripe->lock);
+	if (retcode) return retcode;
+    }
+    return 0;
+}
+
+#define HASH_STRIPED(t) (*(unsigned long *)(t) == HASH_STRIPE_MAGIC)
+#endif
+
+void *N(HashCreate)(void)
+{
+    return HASH_BACKEND(Create)();
+}
+
+/* Create a table that may be used by several threads at once.  Lookups
+   only take a read lock, and never write to the table, so they do not
+   block each other; inserts and deletes lock only one of HASH_STRIPES
+   stripes.  Iteration (drmHashFirst/drmHashNext) must still be serialized
+   by the caller, and since the locks are not async-signal-safe, a
+   concurrent table must not be used from a signal handler.  Without
+   HASH_THREADS this is the same as drmHashCreate. */
+
+void *N(HashCreateConcurrent)(void)
+{
+#if HASH_THREADS
+    HashInit();
+    return HashStripedCreate();
+#else
+    return HASH_BACKEND(Create)();
+#endif
+}
+
+int N(HashDestroy)(void *t)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) return HashStripedDestroy(t);
+#endif
+    return HASH_BACKEND(Destroy)(t);
+}
+
+int N(HashLookup)(void *t, unsigned long key, void **value)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) return HashStripedLookup(t, key, value);
+#endif
+    return HASH_BACKEND(Lookup)(t, key, value);
+}
+
+/* Look up count keys at once, storing the value for keys[i] in values[i]
+   (or NULL if keys[i] is not in the table).  Returns the number of keys
+   found, or -1 on error.  Memory latency is hidden by locating and
+   prefetching the buckets for several keys before searching any of them.
+   Unlike drmHashLookup, the chains are not reorganized. */
+
+int N(HashLookupBatch)(void *t, const unsigned long *keys,
+		       void **values, int count)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t))
+	return HashStripedLookupBatch(t, keys, values, count);
+#endif
+    return HASH_BACKEND(LookupBatch)(t, keys, values, count);
+}
+
+int N(HashInsert)(void *t, unsigned long key, void *value)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) return HashStripedInsert(t, key, value);
+#endif
+    return HASH_BACKEND(Insert)(t, key, value);
+}
+
+int N(HashDelete)(void *t, unsigned long key)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) return HashStripedDelete(t, key);
+#endif
+    return HASH_BACKEND(Delete)(t, key);
+}
+
+int N(HashNext)(void *t, unsigned long *key, void **value)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) return HashStripedNext(t, key, value, 0);
+#endif
+    return HASH_BACKEND(Next)(t, key, value);
+}
+
+int N(HashFirst)(void *t, unsigned long *key, void **value)
+{
+#if HASH_THREADS
+    if (HASH_STRIPED(t)) {
+	((HashStripedTablePtr)t)->s0 = 0;
+	return HashStripedNext(t, key, value, 1);
+    }
+#endif
+    return HASH_BACKEND(First)(t, key, value);
 }
 
 #if HASH_MAIN
@@ -333,85 +1206,386 @@ static void update_dist(int count)
     else                     ++dist[count];
 }
 
-static void compute_dist(HashTablePtr table)
+static void compute_dist(void *t)
 {
-    int           i;
-    HashBucketPtr bucket;
+    HashTablePtr     table = (HashTablePtr)t;
+    HashOpenTablePtr open  = (HashOpenTablePtr)t;
+    unsigned long    i;
+    HashBucketPtr    bucket;
+    unsigned long    key;
+    void             *value;
+    unsigned long    count = 0;
     
-    printf("Entries = %ld, hits = %ld, partials = %ld, misses = %ld\n",
-	   table->entries, table->hits, table->partials, table->misses);
     clear_dist();
-    for (i = 0; i < HASH_SIZE; i++) {
-	bucket = table->buckets[i];
-	update_dist(count_entries(bucket));
+    if (table->magic == HASH_OPEN_MAGIC) {
+	printf("Entries = %ld, slots = %ld (probe lengths follow)\n",
+	       open->entries, open->size);
+	for (i = 0; i < open->size; i++)
+	    if (open->dist[i]) update_dist(open->dist[i]);
+    } else {
+	printf("Entries = %ld, hits = %ld, partials = %ld, misses = %ld\n",
+	       table->entries, table->hits, table->partials, table->misses);
+	printf("Buckets = %ld, segments = %ld, splits = %ld\n",
+	       table->maxp + table->p, table->segments, table->splits);
+	for (i = 0; i < table->maxp + table->p; i++) {
+	    bucket = *HashBucketAt(table, i);
+	    update_dist(count_entries(bucket));
+	}
     }
     for (i = 0; i < DIST_LIMIT; i++) {
-	if (i != DIST_LIMIT-1) printf("%5d %10d\n", i, dist[i]);
+	if (i != DIST_LIMIT-1) printf("%5ld %10d\n", i, dist[i]);
 	else                   printf("other %10d\n", dist[i]);
     }
+
+    if (N(HashFirst)(table, &key, &value)) {
+	do {
+	    ++count;
+	} while (N(HashNext)(table, &key, &value));
+    }
+    if (count != table->entries)
+	printf("Iteration returned %lu entries, expected %lu\n",
+	       count, table->entries);
 }
 
-static void check_table(HashTablePtr table,
+static void check_table(void *table,
 			unsigned long key, unsigned long value)
 {
-    unsigned long retval  = 0;
+    void          *retval  = NULL;
     int           retcode = N(HashLookup)(table, key, &retval);
     
     switch (retcode) {
     case -1:
 	printf("Bad magic = 0x%08lx:"
 	       " key = %lu, expected = %lu, returned = %lu\n",
-	       table->magic, key, value, retval);
+	       *(unsigned long *)table, key, value, (unsigned long)retval);
 	break;
     case 1:
 	printf("Not found: key = %lu, expected = %lu returned = %lu\n",
-	       key, value, retval);
+	       key, value, (unsigned long)retval);
 	break;
     case 0:
-	if (value != retval)
+	if (value != (unsigned long)retval)
 	    printf("Bad value: key = %lu, expected = %lu, returned = %lu\n",
-		   key, value, retval);
+		   key, value, (unsigned long)retval);
 	break;
     default:
 	printf("Bad retcode = %d: key = %lu, expected = %lu, returned = %lu\n",
-	       retcode, key, value, retval);
+	       retcode, key, value, (unsigned long)retval);
 	break;
     }
 }
 
+static void check_missing(void *table, unsigned long key)
+{
+    void          *retval;
+
+    if (N(HashLookup)(table, key, &retval) != 1)
+	printf("Found deleted key = %lu\n", key);
+}
+
+/* Distinct, but well scattered, 32-bit keys (multiplication by an odd
+   constant is a permutation modulo 2^32). */
+static unsigned long scatter(unsigned long i)
+{
+    return (i * 2654435761UL) & 0xffffffffUL;
+}
+
+/* Look up keys from first to last in batches of count, where key i
+   should be present (with value i) only if it is even. */
+static void check_batch(void *table, unsigned long first, unsigned long last,
+			int count)
+{
+    unsigned long keys[100];
+    void          *values[100];
+    unsigned long i;
+    int           j, n, found;
+
+    for (i = first; i < last; i += n) {
+	n     = last - i < (unsigned long)count ? last - i : count;
+	found = 0;
+	for (j = 0; j < n; j++) {
+	    keys[j] = scatter(i + j);
+	    if (!((i + j) & 1)) ++found;
+	}
+	if (N(HashLookupBatch)(table, keys, values, n) != found)
+	    printf("Batch at %lu found the wrong number of keys\n", i);
+	for (j = 0; j < n; j++) {
+	    if ((i + j) & 1 ? values[j] != NULL
+		: (unsigned long)values[j] != i + j)
+		printf("Batch: key = %lu, returned = %lu\n",
+		       keys[j], (unsigned long)values[j]);
+	}
+    }
+}
+
+static void insert(void *table, unsigned long key, unsigned long value)
+{
+    if (N(HashInsert)(table, key, (void *)value))
+	printf("Insert failed: key = %lu\n", key);
+}
+
+static double elapsed(struct timeval *start)
+{
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    return (double)(stop.tv_sec - start->tv_sec) * 1000000.0
+	+ (stop.tv_usec - start->tv_usec);
+}
+
+typedef struct HashBackend {
+    const char *name;
+    void       *(*create)(void);
+    int        (*destroy)(void *t);
+    int        (*lookup)(void *t, unsigned long key, void **value);
+    int        (*insert)(void *t, unsigned long key, void *value);
+    int        (*delete)(void *t, unsigned long key);
+    int        (*first)(void *t, unsigned long *key, void **value);
+    int        (*next)(void *t, unsigned long *key, void **value);
+    int        (*batch)(void *t, const unsigned long *keys,
+			void **values, int count);
+} HashBackend;
+
+static HashBackend backends[] = {
+    { "chained", HashChainCreate, HashChainDestroy, HashChainLookup,
+      HashChainInsert, HashChainDelete, HashChainFirst, HashChainNext,
+      HashChainLookupBatch },
+    { "open",    HashOpenCreate,  HashOpenDestroy,  HashOpenLookup,
+      HashOpenInsert,  HashOpenDelete,  HashOpenFirst,  HashOpenNext,
+      HashOpenLookupBatch },
+};
+
+/* Time size inserts, iter passes of size successful lookups (singly and
+   in batches of 64), the same number of unsuccessful lookups, one
+   iteration over the table, and size deletes.  Times are reported
+   in nanoseconds per operation. */
+static void do_time(HashBackend *b, unsigned long size, int iter)
+{
+    void           *table = b->create();
+    struct timeval start;
+    double         ins, hit, batch, miss, walk, del;
+    unsigned long  i;
+    int            j, k, n;
+    unsigned long  key;
+    void           *value;
+    unsigned long  errors = 0;
+    unsigned long  keys[64];
+    void           *values[64];
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++) b->insert(table, scatter(i), (void *)i);
+    ins = elapsed(&start) * 1000.0 / size;
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < iter; j++)
+	for (i = 0; i < size; i++)
+	    if (b->lookup(table, scatter(i), &value)) ++errors;
+    hit = elapsed(&start) * 1000.0 / ((double)size * iter);
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < iter; j++)
+	for (i = 0; i < size; i += n) {
+	    n = size - i < 64 ? size - i : 64;
+	    for (k = 0; k < n; k++) keys[k] = scatter(i + k);
+	    if (b->batch(table, keys, values, n) != n) ++errors;
+	}
+    batch = elapsed(&start) * 1000.0 / ((double)size * iter);
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < iter; j++)
+	for (i = size; i < 2 * size; i++)
+	    if (!b->lookup(table, scatter(i), &value)) ++errors;
+    miss = elapsed(&start) * 1000.0 / ((double)size * iter);
+
+    gettimeofday(&start, NULL);
+    i = 0;
+    if (b->first(table, &key, &value) == 1) {
+	do {
+	    ++i;
+	} while (b->next(table, &key, &value));
+    }
+    walk = elapsed(&start) * 1000.0 / size;
+    if (i != size) ++errors;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++) b->delete(table, scatter(i));
+    del = elapsed(&start) * 1000.0 / size;
+
+    printf("%-8s %8lu keys: insert %6.1f, hit %6.1f, batch %6.1f,"
+	   " miss %6.1f, iterate %6.1f, delete %6.1f ns/op%s\n",
+	   b->name, size, ins, hit, batch, miss, walk, del,
+	   errors ? " *ERRORS*" : "");
+    b->destroy(table);
+}
+
+static void compare_backends(void)
+{
+    static const unsigned long sizes[] = { 100, 10000, 1000000 };
+    unsigned int               i, j;
+
+    printf("\n***** Backend comparison ****\n");
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+	for (j = 0; j < sizeof(backends)/sizeof(backends[0]); j++)
+	    do_time(&backends[j], sizes[i], 10000000 / sizes[i] + 1);
+}
+
+#if HASH_THREADS
+#define STRESS_KEYS  100000	/* Keys that are always in the table */
+#define STRESS_CHURN 20000	/* Keys each writer inserts and deletes */
+
+typedef struct StressArg {
+    void          *table;
+    unsigned long id;
+    unsigned long ops;
+    unsigned long errors;
+    pthread_t     thread;
+} StressArg;
+
+/* Look up ops random keys from the stable set. */
+static void *stress_reader(void *closure)
+{
+    StressArg     *arg = closure;
+    unsigned long k    = arg->id;
+    unsigned long i;
+    void          *value;
+
+    for (i = 0; i < arg->ops; i++) {
+	k = (k * 1103515245UL + 12345UL) % STRESS_KEYS;
+	if (N(HashLookup)(arg->table, scatter(k), &value)
+	    || (unsigned long)value != k) ++arg->errors;
+    }
+    return NULL;
+}
+
+/* Insert, check and delete a private range of keys, ops times. */
+static void *stress_writer(void *closure)
+{
+    StressArg     *arg  = closure;
+    unsigned long base  = STRESS_KEYS + arg->id * STRESS_CHURN;
+    unsigned long i, pass;
+    void          *value;
+
+    for (pass = 0; pass < arg->ops; pass++) {
+	for (i = base; i < base + STRESS_CHURN; i++)
+	    if (N(HashInsert)(arg->table, scatter(i), (void *)i))
+		++arg->errors;
+	for (i = base; i < base + STRESS_CHURN; i++)
+	    if (N(HashLookup)(arg->table, scatter(i), &value)
+		|| (unsigned long)value != i) ++arg->errors;
+	for (i = base; i < base + STRESS_CHURN; i++)
+	    if (N(HashDelete)(arg->table, scatter(i))) ++arg->errors;
+    }
+    return NULL;
+}
+
+static void *stress_table(void)
+{
+    void          *table = N(HashCreateConcurrent)();
+    unsigned long i;
+
+    for (i = 0; i < STRESS_KEYS; i++) insert(table, scatter(i), i);
+    return table;
+}
+
+/* Run readers and writers on one table at the same time, then make sure
+   that the table holds exactly the stable keys. */
+static void do_stress(int readers, int writers)
+{
+    void          *table = stress_table();
+    StressArg     args[16];
+    int           n      = readers + writers;
+    int           i;
+    unsigned long errors = 0;
+    unsigned long key;
+    void          *value;
+    unsigned long count  = 0;
+
+    for (i = 0; i < n; i++) {
+	args[i].table  = table;
+	args[i].id     = i;
+	args[i].ops    = i < readers ? 2000000 : 5;
+	args[i].errors = 0;
+	pthread_create(&args[i].thread, NULL,
+		       i < readers ? stress_reader : stress_writer, &args[i]);
+    }
+    for (i = 0; i < n; i++) {
+	pthread_join(args[i].thread, NULL);
+	errors += args[i].errors;
+    }
+
+    for (i = 0; i < STRESS_KEYS; i++) check_table(table, scatter(i), i);
+    if (N(HashFirst)(table, &key, &value)) {
+	do {
+	    ++count;
+	} while (N(HashNext)(table, &key, &value));
+    }
+    printf("%d readers, %d writers: %lu errors, %lu entries after (%d)\n",
+	   readers, writers, errors, count, STRESS_KEYS);
+    N(HashDestroy)(table);
+}
+
+/* Measure aggregate lookup throughput as threads are added. */
+static void do_scale(void)
+{
+    void           *table = stress_table();
+    StressArg      args[16];
+    struct timeval start;
+    double         usec;
+    int            n, i;
+
+    for (n = 1; n <= 16; n *= 2) {
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n; i++) {
+	    args[i].table  = table;
+	    args[i].id     = i;
+	    args[i].ops    = 2000000;
+	    args[i].errors = 0;
+	    pthread_create(&args[i].thread, NULL, stress_reader, &args[i]);
+	}
+	for (i = 0; i < n; i++) pthread_join(args[i].thread, NULL);
+	usec = elapsed(&start);
+	printf("%2d threads: %8.2f Mlookups/s\n",
+	       n, (double)n * 2000000 / usec);
+    }
+    N(HashDestroy)(table);
+}
+#endif
+
 int main(void)
 {
-    HashTablePtr table;
+    void         *table;
     int          i;
 
+    printf("Testing the %s backend\n", HASH_OPEN ? "open" : "chained");
+
     printf("\n***** 256 consecutive integers ****\n");
     table = N(HashCreate)();
-    for (i = 0; i < 256; i++) N(HashInsert)(table, i, i);
+    for (i = 0; i < 256; i++) insert(table, i, i);
     for (i = 0; i < 256; i++) check_table(table, i, i);
-    for (i = 256; i >= 0; i--) check_table(table, i, i);
+    for (i = 255; i >= 0; i--) check_table(table, i, i);
     compute_dist(table);
     N(HashDestroy)(table);
     
     printf("\n***** 1024 consecutive integers ****\n");
     table = N(HashCreate)();
-    for (i = 0; i < 1024; i++) N(HashInsert)(table, i, i);
+    for (i = 0; i < 1024; i++) insert(table, i, i);
     for (i = 0; i < 1024; i++) check_table(table, i, i);
-    for (i = 1024; i >= 0; i--) check_table(table, i, i);
+    for (i = 1023; i >= 0; i--) check_table(table, i, i);
     compute_dist(table);
     N(HashDestroy)(table);
     
     printf("\n***** 1024 consecutive page addresses (4k pages) ****\n");
     table = N(HashCreate)();
-    for (i = 0; i < 1024; i++) N(HashInsert)(table, i*4096, i);
+    for (i = 0; i < 1024; i++) insert(table, i*4096, i);
     for (i = 0; i < 1024; i++) check_table(table, i*4096, i);
-    for (i = 1024; i >= 0; i--) check_table(table, i*4096, i);
+    for (i = 1023; i >= 0; i--) check_table(table, i*4096, i);
     compute_dist(table);
     N(HashDestroy)(table);
     
     printf("\n***** 1024 random integers ****\n");
     table = N(HashCreate)();
     srandom(0xbeefbeef);
-    for (i = 0; i < 1024; i++) N(HashInsert)(table, random(), i);
+    for (i = 0; i < 1024; i++) insert(table, random(), i);
     srandom(0xbeefbeef);
     for (i = 0; i < 1024; i++) check_table(table, random(), i);
     srandom(0xbeefbeef);
@@ -422,13 +1596,58 @@ int main(void)
     printf("\n***** 5000 random integers ****\n");
     table = N(HashCreate)();
     srandom(0xbeefbeef);
-    for (i = 0; i < 5000; i++) N(HashInsert)(table, random(), i);
+    for (i = 0; i < 5000; i++) insert(table, random(), i);
     srandom(0xbeefbeef);
     for (i = 0; i < 5000; i++) check_table(table, random(), i);
     srandom(0xbeefbeef);
     for (i = 0; i < 5000; i++) check_table(table, random(), i);
     compute_dist(table);
     N(HashDestroy)(table);
+
+    printf("\n***** 131072 consecutive integers ****\n");
+    table = N(HashCreate)();
+    for (i = 0; i < 131072; i++) insert(table, i, i);
+    for (i = 0; i < 131072; i++) check_table(table, i, i);
+    for (i = 131071; i >= 0; i--) check_table(table, i, i);
+    compute_dist(table);
+    N(HashDestroy)(table);
+
+    printf("\n***** 131072 consecutive page addresses (4k pages) ****\n");
+    table = N(HashCreate)();
+    for (i = 0; i < 131072; i++) insert(table, (unsigned long)i*4096, i);
+    for (i = 0; i < 131072; i++) check_table(table, (unsigned long)i*4096, i);
+    compute_dist(table);
+    N(HashDestroy)(table);
+
+    printf("\n***** 250000 scattered integers, delete half ****\n");
+    table = N(HashCreate)();
+    for (i = 0; i < 250000; i++) insert(table, scatter(i), i);
+    for (i = 0; i < 250000; i++) check_table(table, scatter(i), i);
+    for (i = 1; i < 250000; i += 2) N(HashDelete)(table, scatter(i));
+    for (i = 0; i < 250000; i++) {
+	if (i & 1) check_missing(table, scatter(i));
+	else       check_table(table, scatter(i), i);
+    }
+    check_batch(table, 0, 250000, 100);
+    check_batch(table, 7, 1000, 13);
+    compute_dist(table);
+				/* Reuse the deleted buckets */
+    for (i = 1; i < 250000; i += 2) insert(table, scatter(i), i + 1);
+    for (i = 0; i < 250000; i++)
+	check_table(table, scatter(i), (i & 1) ? i + 1 : i);
+    N(HashDestroy)(table);
+
+    compare_backends();
+
+#if HASH_THREADS
+    printf("\n***** Concurrent table stress ****\n");
+    do_stress(4, 0);
+    do_stress(4, 4);
+    do_stress(1, 8);
+
+    printf("\n***** Concurrent lookup scaling ****\n");
+    do_scale();
+#endif
     
     return 0;
 }
@@ -38,6 +38,16 @@
  * that is suitable for testing a hash table implementation and for
  * implementing skip lists.
  *
+ * drmRandomFill and drmRandomFillDouble produce many values at once,
+ * exactly the values that the same number of drmRandom or
+ * drmRandomDouble calls would have returned.  Where unsigned long has 64
+ * bits, they reduce a*x mod m by folding the high bits of the product
+ * back into the low ones instead of dividing [PMS93], and they run
+ * RANDOM_LANES interleaved copies of the sequence, each a^RANDOM_LANES
+ * steps apart, so that the multiplications are independent of each
+ * other and can be pipelined or vectorized by the compiler.  Elsewhere
+ * they simply call drmRandom.
+ *
  * FUTURE ENHANCEMENTS
  *
  * If initial seeds are not selected randomly, two instances of the PRNG
@@ -78,6 +88,7 @@
 #if RANDOM_MAIN
 # include <stdio.h>
 # include <stdlib.h>
+# include <sys/time.h>
 #else
 # include "xf86drm.h"
 # ifdef XFree86LOADER
@@ -93,6 +104,16 @@
 
 #define RANDOM_MAGIC 0xfeedbeef
 #define RANDOM_DEBUG 0
+#define RANDOM_LANES 8		/* Interleaved sequences in drmRandomFill */
+
+#ifndef RANDOM_WIDE		/* unsigned long holds a*x */
+# if defined(__alpha__) || defined(__ia64__) || defined(__x86_64__) \
+     || defined(_LP64) || defined(__LP64__)
+#  define RANDOM_WIDE 1
+# else
+#  define RANDOM_WIDE 0
+# endif
+#endif
 
 #if RANDOM_MAIN
 #define RANDOM_ALLOC malloc
@@ -110,6 +131,9 @@ typedef struct RandomState {
     unsigned long r;		/* m mod a */
     unsigned long check;
     long          seed;
+#if RANDOM_WIDE
+    unsigned long jump;		/* a^RANDOM_LANES mod m */
+#endif
 } RandomState;
 
 #if RANDOM_MAIN
@@ -117,6 +141,22 @@ extern void          *N(RandomCreate)(unsigned long seed);
 extern int           N(RandomDestroy)(void *state);
 extern unsigned long N(Random)(void *state);
 extern double        N(RandomDouble)(void *state);
+extern int           N(RandomFill)(void *state, unsigned long *out,
+				   int count);
+extern int           N(RandomFillDouble)(void *state, double *out,
+					 int count);
+#endif
+
+#if RANDOM_WIDE
+/* Return x mod m for x < 2^62, where m = 2^31-1. */
+#define RANDOM_FOLD(x) (((x) & 0x7fffffffUL) + ((x) >> 31))
+
+static unsigned long RandomMod(unsigned long x)
+{
+    x = RANDOM_FOLD(x);
+    x = RANDOM_FOLD(x);
+    return x >= 0x7fffffffUL ? x - 0x7fffffffUL : x;
+}
 #endif
 
 void *N(RandomCreate)(unsigned long seed)
@@ -146,6 +186,15 @@ void *N(RandomCreate)(unsigned long seed)
     if (state->seed <= 0)        state->seed = 1;
     if (state->seed >= state->m) state->seed = state->m - 1;
 
+#if RANDOM_WIDE
+    {
+	int i;
+
+	for (i = 0, state->jump = 1; i < RANDOM_LANES; i++)
+	    state->jump = RandomMod(state->jump * state->a);
+    }
+#endif
+
     return state;
 }
 
@@ -176,22 +225,136 @@ double N(RandomDouble)(void *state)
     return (double)N(Random)(state)/(double)s->m;
 }
 
+/* Store the next count values of the sequence in out.  Returns 0, or -1
+   if state is not valid. */
+int N(RandomFill)(void *state, unsigned long *out, int count)
+{
+    RandomState   *s = (RandomState *)state;
+    int           i = 0;
+#if RANDOM_WIDE
+    unsigned long lanes[RANDOM_LANES];
+    unsigned long jump = s->jump;
+    int           j;
+#endif
+
+    if (s->magic != RANDOM_MAGIC) return -1;
+
+#if RANDOM_WIDE
+    if (s->m == 0x7fffffffUL && count >= 2 * RANDOM_LANES) {
+				/* The first RANDOM_LANES values start
+                                   one sequence each */
+	for (j = 0; j < RANDOM_LANES; j++)
+	    out[j] = lanes[j] = N(Random)(state);
+	for (i = RANDOM_LANES; i + RANDOM_LANES <= count; i += RANDOM_LANES) {
+	    for (j = 0; j < RANDOM_LANES; j++) {
+		lanes[j]   = RandomMod(lanes[j] * jump);
+		out[i + j] = lanes[j];
+	    }
+	}
+	s->seed = lanes[RANDOM_LANES - 1];
+    }
+#endif
+    for (; i < count; i++) out[i] = N(Random)(state);
+    return 0;
+}
+
+/* Store the next count values that drmRandomDouble would return in
+   out.  Returns 0, or -1 if state is not valid. */
+int N(RandomFillDouble)(void *state, double *out, int count)
+{
+    RandomState   *s = (RandomState *)state;
+    unsigned long buffer[256];
+    double        m  = (double)s->m;
+    int           i, j, n;
+
+    if (s->magic != RANDOM_MAGIC) return -1;
+
+    for (i = 0; i < count; i += n) {
+	n = count - i < 256 ? count - i : 256;
+	N(RandomFill)(state, buffer, n);
+	for (j = 0; j < n; j++) out[i + j] = (double)buffer[j] / m;
+    }
+    return 0;
+}
+
 #if RANDOM_MAIN
+static double elapsed(struct timeval *start)
+{
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    return (double)(stop.tv_sec - start->tv_sec) * 1000000.0
+	+ (stop.tv_usec - start->tv_usec);
+}
+
+/* Walk a whole period, first with drmRandom and then with drmRandomFill,
+   and report how long each value took. */
 static void check_period(long seed)
 {
-    unsigned long count = 0;
-    unsigned long initial;
-    void          *state;
+    unsigned long  count = 0;
+    unsigned long  initial;
+    unsigned long  buffer[4096];
+    void           *state;
+    struct timeval start;
+    double         usec;
+    int            i;
     
     state = N(RandomCreate)(seed);
+    gettimeofday(&start, NULL);
     initial = N(Random)(state);
     ++count;
     while (initial != N(Random)(state)) {
 	if (!++count) break;
     }
-    printf("With seed of %10ld, period = %10lu (0x%08lx)\n",
-	   seed, count, count);
+    usec = elapsed(&start);
+    printf("With seed of %10ld, period = %10lu (0x%08lx), %5.2f ns/value\n",
+	   seed, count, count, usec * 1000.0 / count);
+    N(RandomDestroy)(state);
+
+    state = N(RandomCreate)(seed);
+    gettimeofday(&start, NULL);
+    N(RandomFill)(state, buffer, 1);
+    initial = buffer[0];
+    for (count = 1;; count += 4096) {
+	N(RandomFill)(state, buffer, 4096);
+	for (i = 0; i < 4096 && buffer[i] != initial; i++);
+	if (i < 4096) {
+	    count += i;
+	    break;
+	}
+    }
+    usec = elapsed(&start);
+    printf("   drmRandomFill period = %10lu (0x%08lx), %5.2f ns/value\n",
+	   count, count, usec * 1000.0 / count);
+    N(RandomDestroy)(state);
+}
+
+/* Check that the fill functions return exactly what the same number of
+   single calls would, for counts around the lane boundaries. */
+static void check_fill(void)
+{
+    static const int counts[] = { 0, 1, 7, 8, 15, 16, 17, 31, 33, 255, 256,
+				  257, 1000, 4099 };
+    unsigned long    out[4099];
+    double           dout[4099];
+    void             *state, *state2;
+    int              i, j;
+    int              errors = 0;
+
+    state  = N(RandomCreate)(31415926);
+    state2 = N(RandomCreate)(31415926);
+    for (i = 0; i < (int)(sizeof(counts)/sizeof(counts[0])); i++) {
+	N(RandomFill)(state, out, counts[i]);
+	for (j = 0; j < counts[i]; j++)
+	    if (out[j] != N(Random)(state2)) ++errors;
+	N(RandomFillDouble)(state, dout, counts[i]);
+	for (j = 0; j < counts[i]; j++)
+	    if (dout[j] != N(RandomDouble)(state2)) ++errors;
+    }
+    if (N(Random)(state) != N(Random)(state2)) ++errors;
+    printf("drmRandomFill: %s\n", errors ? "*INCORRECT*" : "CORRECT");
     N(RandomDestroy)(state);
+    N(RandomDestroy)(state2);
 }
 
 int main(void)
@@ -209,6 +372,8 @@ int main(void)
 	   rand - state->check ? "*INCORRECT*" : "CORRECT");
     N(RandomDestroy)(state);
 
+    check_fill();
+
     printf("Checking periods...\n");
     check_period(1);
     check_period(2);
@@ -31,10 +31,35 @@
  *
  * This file contains a straightforward skip list implementation.n
  *
+ * Entries are allocated from a pool that belongs to the list: they are
+ * carved out of SL_POOL_CHUNK byte chunks, deleted entries are kept on a
+ * free list for each entry size, and all of the chunks are released at
+ * once by drmSLDestroy.
+ *
+ * When SL_UNROLLED is non-zero, the list uses an unrolled layout instead:
+ * the skip list is only an index, and each index node owns a
+ * cache-line aligned block of up to SL_BLOCK_KEYS sorted keys.  Index
+ * nodes are packed densely in their own pool, so a search touches a few
+ * small nodes and then scans a single block, instead of chasing one
+ * pointer per key.  Full blocks are split in half, and a block is merged
+ * with its successor when together they are at most half full.  The
+ * drmSL* interface is the same for both layouts.
+ *
+ * drmSLLookup returns an opaque pointer to the entry for a key, and
+ * drmSLLookupValue returns the value stored with it.
+ *
+ * drmSLLookupRange and drmSLLookupRangeArray visit every entry with a key
+ * in a closed range with a single search.  drmSLBuildSorted fills an
+ * empty list from sorted keys in linear time, assigning levels by
+ * position (as in a perfectly balanced skip list) instead of at random.
+ *
  * FUTURE ENHANCEMENTS
  *
  * REFERENCES
  *
+ * [Marsaglia03] George Marsaglia.  Xorshift RNGs.  Journal of Statistical
+ * Software 8(14), July 2003.
+ *
  * [Pugh90] William Pugh.  Skip Lists: A Probabilistic Alternative to
  * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.
  *
@@ -65,22 +90,39 @@
 #define SL_MAX_LEVEL   16
 #define SL_DEBUG       0
 #define SL_RANDOM_SEED 0xc01055a1LU
+#define SL_POOL_CHUNK  4096	/* Bytes per node pool chunk */
+#define SL_CACHE_LINE  64
+
+#ifndef SL_UNROLLED
+#define SL_UNROLLED       0	/* Use the unrolled layout */
+#endif
+#define SL_UNROLLED_MAGIC 0xfacade01LU
+#define SL_BLOCK_KEYS     16	/* Keys per unrolled block */
 
 #if SL_MAIN
 #define SL_ALLOC malloc
 #define SL_FREE  free
-#define SL_RANDOM_DECL        static int state = 0;
-#define SL_RANDOM_INIT(seed)  if (!state) { srandom(seed); ++state; }
-#define SL_RANDOM             random()
 #else
 #define SL_ALLOC drmMalloc
 #define SL_FREE  drmFree
-#define SL_RANDOM_DECL        static void *state = NULL
-#define SL_RANDOM_INIT(seed)  if (!state) state = drmRandomCreate(seed)
-#define SL_RANDOM             drmRandom(state)
-
 #endif
 
+				/* Nodes are carved out of chunks that
+                                   belong to the list.  Freed nodes are
+                                   kept on one free list per size class,
+                                   threaded through their first word. */
+typedef union SLChunk {
+    union SLChunk    *next;
+    double           align;	/* Nodes follow the header */
+} SLChunk, *SLChunkPtr;
+
+typedef struct SLPool {
+    SLChunkPtr       chunks;
+    char             *next;	/* Unused space in the newest chunk */
+    unsigned long    avail;	/* Bytes at next */
+    void             *free[SL_MAX_LEVEL + 2]; /* Freed nodes, by class */
+} SLPool, *SLPoolPtr;
+
 typedef struct SLEntry {
     unsigned long     magic;	   /* SL_ENTRY_MAGIC */
     unsigned long     key;
@@ -95,30 +137,183 @@ typedef struct SkipList {
     int              count;
     SLEntryPtr       head;
     SLEntryPtr       p0;	/* Position for iteration */
+    unsigned long    seed;	/* For SLRandomLevel */
+    SLPool           pool;	/* Entries, by levels */
 } SkipList, *SkipListPtr;
 
+				/* Unrolled layout: each node of the
+                                   index owns a cache-line aligned block
+                                   of up to SL_BLOCK_KEYS sorted keys.
+                                   Every key in a block is at least the
+                                   key of its index node, and smaller than
+                                   the key of the next index node. */
+typedef struct SLBlock {
+    unsigned long     keys[SL_BLOCK_KEYS];
+    void              *values[SL_BLOCK_KEYS];
+} SLBlock, *SLBlockPtr;
+
+typedef struct SLIndex {
+    unsigned long     key;	   /* block->keys[0], except for the head */
+    SLBlockPtr        block;
+    int               count;	   /* Keys in block */
+    int               levels;
+    struct SLIndex    *forward[1]; /* variable sized array */
+} SLIndex, *SLIndexPtr;
+
+typedef struct SLUnrolledList {
+    unsigned long    magic;	/* SL_UNROLLED_MAGIC */
+    int              level;
+    int              count;
+    SLIndexPtr       head;	/* Owns the first block */
+    SLIndexPtr       p0;	/* Position for iteration */
+    int              p1;
+    unsigned long    seed;	/* For SLRandomLevel */
+    SLPool           index;	/* Index nodes, by levels */
+    SLPool           blocks;
+} SLUnrolledList, *SLUnrolledListPtr;
+
 #if SL_MAIN
 extern void *N(SLCreate)(void);
 extern int  N(SLDestroy)(void *l);
 extern int  N(SLLookup)(void *l, unsigned long key, void **value);
+extern int  N(SLLookupValue)(void *l, unsigned long key, void **value);
 extern int  N(SLInsert)(void *l, unsigned long key, void *value);
 extern int  N(SLDelete)(void *l, unsigned long key);
 extern int  N(SLNext)(void *l, unsigned long *key, void **value);
 extern int  N(SLFirst)(void *l, unsigned long *key, void **value);
 extern void N(SLDump)(void *l);
+extern int  N(SLLookupRange)(void *l, unsigned long lo, unsigned long hi,
+			     int (*callback)(unsigned long key, void *value,
+					     void *closure),
+			     void *closure);
+extern int  N(SLLookupRangeArray)(void *l, unsigned long lo,
+				  unsigned long hi, unsigned long *keys,
+				  void **values, int max);
+extern int  N(SLBuildSorted)(void *l, const unsigned long *keys,
+			     void * const *values, int count);
 extern int  N(SLLookupNeighbors)(void *l, unsigned long key,
 				 unsigned long *prev_key, void **prev_value,
 				 unsigned long *next_key, void **next_value);
 #endif
 
-static SLEntryPtr SLCreateEntry(int max_level, unsigned long key, void *value)
+static void SLPoolInit(SLPoolPtr pool)
+{
+    int i;
+
+    pool->chunks = NULL;
+    pool->next   = NULL;
+    pool->avail  = 0;
+    for (i = 0; i < SL_MAX_LEVEL + 2; i++) pool->free[i] = NULL;
+}
+
+/* Allocate a node of the given size class from the pool.  Nodes that do
+   not fit in what is left of the newest chunk start a new chunk (the
+   remainder of the old one is not used).  Chunks are cache-line aligned,
+   so nodes whose size is a multiple of SL_CACHE_LINE are too. */
+
+static void *SLPoolAlloc(SLPoolPtr pool, int sizeclass, unsigned long size)
+{
+    void          *node;
+    SLChunkPtr    chunk;
+    unsigned long start;
+
+    if ((node = pool->free[sizeclass])) {
+	pool->free[sizeclass] = *(void **)node;
+	return node;
+    }
+    if (size > pool->avail) {
+	if (!(chunk = SL_ALLOC(SL_POOL_CHUNK))) return NULL;
+	chunk->next  = pool->chunks;
+	pool->chunks = chunk;
+	start        = ((unsigned long)(chunk + 1) + SL_CACHE_LINE - 1)
+		       & ~(unsigned long)(SL_CACHE_LINE - 1);
+	pool->next   = (char *)start;
+	pool->avail  = (char *)chunk + SL_POOL_CHUNK - pool->next;
+    }
+    node         = pool->next;
+    pool->next  += size;
+    pool->avail -= size;
+    return node;
+}
+
+static void SLPoolFree(SLPoolPtr pool, int sizeclass, void *node)
+{
+    *(void **)node        = pool->free[sizeclass];
+    pool->free[sizeclass] = node;
+}
+
+static void SLPoolDestroy(SLPoolPtr pool)
+{
+    SLChunkPtr chunk;
+    SLChunkPtr next;
+
+    for (chunk = pool->chunks; chunk; chunk = next) {
+	next = chunk->next;
+	SL_FREE(chunk);
+    }
+    pool->chunks = NULL;
+}
+
+/* Return the number of trailing zero bits in a non-zero 32-bit word. */
+#if defined(__GNUC__) \
+    && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+#define SLCtz(x) __builtin_ctzl(x)
+#else
+static int SLCtz(unsigned long x)
+{
+    static const int debruijn[32] = {
+	 0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8, 
+	31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9
+    };
+
+    return debruijn[(((x & -x) * 0x077cb531UL) & 0xffffffffUL) >> 27];
+}
+#endif
+
+/* Return a level between 1 and SL_MAX_LEVEL, each with half the
+   probability of the one before.  Each list has its own xorshift
+   [Marsaglia03] state, so lists do not share a generator, and the level
+   is the number of trailing zeros in one random word. */
+static int SLRandomLevel(unsigned long *seed)
+{
+    unsigned long r = *seed;
+
+    r ^= (r << 13) & 0xffffffffUL;
+    r ^= r >> 17;
+    r ^= (r << 5) & 0xffffffffUL;
+    *seed = r;
+
+    return 1 + SLCtz(r | (1UL << (SL_MAX_LEVEL - 1)));
+}
+
+/* Return the level for the n'th entry (counting from 1) of a list built
+   from sorted keys: every second entry has level 1 or more, every fourth
+   level 2 or more, and so on, as in a perfectly balanced skip list. */
+static int SLSortedLevel(unsigned long n)
+{
+    return SLCtz(n | (1UL << (SL_MAX_LEVEL - 1)));
+}
+
+/* Check that keys are strictly increasing. */
+static int SLSorted(const unsigned long *keys, int count)
+{
+    int i;
+
+    for (i = 1; i < count; i++) if (keys[i] <= keys[i - 1]) return 0;
+    return 1;
+}
+
+#if SL_MAIN || !SL_UNROLLED
+static SLEntryPtr SLCreateEntry(SkipListPtr list, int max_level,
+				unsigned long key, void *value)
 {
     SLEntryPtr entry;
     
     if (max_level < 0 || max_level > SL_MAX_LEVEL) max_level = SL_MAX_LEVEL;
 
-    entry         = SL_ALLOC(sizeof(*entry)
-			     + (max_level + 1) * sizeof(entry->forward[0]));
+    entry         = SLPoolAlloc(&list->pool, max_level + 1,
+				sizeof(*entry)
+				+ (max_level + 1) * sizeof(entry->forward[0]));
     if (!entry) return NULL;
     entry->magic  = SL_ENTRY_MAGIC;
     entry->key    = key;
@@ -128,18 +323,7 @@ static SLEntryPtr SLCreateEntry(int max_level, unsigned long key, void *value)
     return entry;
 }
 
-static int SLRandomLevel(void)
-{
-    int level = 1;
-    SL_RANDOM_DECL;
-
-    SL_RANDOM_INIT(SL_RANDOM_SEED);
-    
-    while ((SL_RANDOM & 0x01) && level < SL_MAX_LEVEL) ++level;
-    return level;
-}
-
-void *N(SLCreate)(void)
+static void *SLClassicCreate(void)
 {
     SkipListPtr  list;
     int          i;
@@ -148,29 +332,30 @@ void *N(SLCreate)(void)
     if (!list) return NULL;
     list->magic    = SL_LIST_MAGIC;
     list->level    = 0;
-    list->head     = SLCreateEntry(SL_MAX_LEVEL, 0, NULL);
     list->count    = 0;
+    list->seed     = SL_RANDOM_SEED;
+    SLPoolInit(&list->pool);
+    if (!(list->head = SLCreateEntry(list, SL_MAX_LEVEL, 0, NULL))) {
+	SL_FREE(list);
+	return NULL;
+    }
 
     for (i = 0; i <= SL_MAX_LEVEL; i++) list->head->forward[i] = NULL;
     
     return list;
 }
 
-int N(SLDestroy)(void *l)
+static int SLClassicDestroy(void *l)
 {
     SkipListPtr   list  = (SkipListPtr)l;
     SLEntryPtr    entry;
-    SLEntryPtr    next;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    for (entry = list->head; entry; entry = next) {
+    for (entry = list->head; entry; entry = entry->forward[0])
 	if (entry->magic != SL_ENTRY_MAGIC) return -1; /* Bad magic */
-	next         = entry->forward[0];
-	entry->magic = SL_FREED_MAGIC;
-	SL_FREE(entry);
-    }
 
+    SLPoolDestroy(&list->pool);
     list->magic = SL_FREED_MAGIC;
     SL_FREE(list);
     return 0;
@@ -193,7 +378,7 @@ static SLEntryPtr SLLocate(void *l, unsigned long key, SLEntryPtr *update)
     return entry->forward[0];
 }
 
-int N(SLInsert)(void *l, unsigned long key, void *value)
+static int SLClassicInsert(void *l, unsigned long key, void *value)
 {
     SkipListPtr   list  = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -208,13 +393,14 @@ int N(SLInsert)(void *l, unsigned long key, void *value)
     if (entry && entry->key == key) return 1; /* Already in list */
 
 
-    level = SLRandomLevel();
+    level = SLRandomLevel(&list->seed);
     if (level > list->level) {
 	level = ++list->level;
 	update[level] = list->head;
     }
 
-    entry = SLCreateEntry(level, key, value);
+    entry = SLCreateEntry(list, level, key, value);
+    if (!entry) return -1;	/* Error */
 
 				/* Fix up forward pointers */
     for (i = 0; i <= level; i++) {
@@ -226,7 +412,7 @@ int N(SLInsert)(void *l, unsigned long key, void *value)
     return 0;			/* Added to table */
 }
 
-int N(SLDelete)(void *l, unsigned long key)
+static int SLClassicDelete(void *l, unsigned long key)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    update[SL_MAX_LEVEL + 1];
@@ -246,39 +432,63 @@ int N(SLDelete)(void *l, unsigned long key)
     }
 
     entry->magic = SL_FREED_MAGIC;
-    SL_FREE(entry);
+    SLPoolFree(&list->pool, entry->levels, entry);
 
     while (list->level && !list->head->forward[list->level]) --list->level;
     --list->count;
     return 0;
 }
 
-int N(SLLookup)(void *l, unsigned long key, void **value)
+static SLEntryPtr SLClassicFind(SkipListPtr list, unsigned long key)
 {
-    SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
     SLEntryPtr    entry;
+    int           i;
 
-    entry = SLLocate(list, key, update);
+				/* Like SLLocate, without recording the
+                                   path */
+    for (i = list->level, entry = list->head; i >= 0; i--)
+	while (entry->forward[i] && entry->forward[i]->key < key)
+	    entry = entry->forward[i];
+    entry = entry->forward[0];
+
+    if (entry && entry->key == key) return entry;
+    return NULL;
+}
+
+static int SLClassicLookup(void *l, unsigned long key, void **value)
+{
+    SkipListPtr   list = (SkipListPtr)l;
+    SLEntryPtr    entry;
 
-    if (entry && entry->key == key) {
-	*value = entry;
-	return 0;
-    }
     *value = NULL;
-    return -1;
+    if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
+
+    if (!(entry = SLClassicFind(list, key))) return -1;
+    *value = entry->value;
+    return 0;
 }
 
-int N(SLLookupNeighbors)(void *l, unsigned long key,
-			 unsigned long *prev_key, void **prev_value,
-			 unsigned long *next_key, void **next_value)
+static int SLClassicLookupEntry(void *l, unsigned long key, void **entry)
+{
+    SkipListPtr   list = (SkipListPtr)l;
+
+    *entry = NULL;
+    if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
+
+    return (*entry = SLClassicFind(list, key)) ? 0 : -1;
+}
+
+static int SLClassicLookupNeighbors(void *l, unsigned long key,
+				    unsigned long *prev_key,
+				    void **prev_value,
+				    unsigned long *next_key,
+				    void **next_value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    SLEntryPtr    entry;
     int           retcode = 0;
 
-    entry = SLLocate(list, key, update);
+    SLLocate(list, key, update);
 
     *prev_key   = *next_key   = key;
     *prev_value = *next_value = NULL;
@@ -296,7 +506,7 @@ int N(SLLookupNeighbors)(void *l, unsigned long key,
     return retcode;
 }
 
-int N(SLNext)(void *l, unsigned long *key, void **value)
+static int SLClassicNext(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -315,18 +525,75 @@ int N(SLNext)(void *l, unsigned long *key, void **value)
     return 0;
 }
 
-int N(SLFirst)(void *l, unsigned long *key, void **value)
+static int SLClassicFirst(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
     
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
     
     list->p0 = list->head->forward[0];
-    return N(SLNext)(list, key, value);
+    return SLClassicNext(list, key, value);
+}
+
+static int SLClassicLookupRange(void *l, unsigned long lo, unsigned long hi,
+				int (*callback)(unsigned long key, void *value,
+						void *closure),
+				void *closure)
+{
+    SkipListPtr   list  = (SkipListPtr)l;
+    SLEntryPtr    entry;
+    int           count = 0;
+    int           i;
+
+    if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
+
+    for (i = list->level, entry = list->head; i >= 0; i--)
+	while (entry->forward[i] && entry->forward[i]->key < lo)
+	    entry = entry->forward[i];
+
+    for (entry = entry->forward[0];
+	 entry && entry->key <= hi;
+	 entry = entry->forward[0]) {
+	++count;
+	if (callback(entry->key, entry->value, closure)) break;
+    }
+    return count;
+}
+
+static int SLClassicBuildSorted(void *l, const unsigned long *keys,
+				void * const *values, int count)
+{
+    SkipListPtr   list = (SkipListPtr)l;
+    SLEntryPtr    last[SL_MAX_LEVEL + 1];
+    SLEntryPtr    entry;
+    int           retcode = 0;
+    int           level;
+    int           i, j;
+
+    if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
+    if (list->count || !SLSorted(keys, count)) return 1;
+
+    for (i = 0; i <= SL_MAX_LEVEL; i++) last[i] = list->head;
+    for (i = 0; i < count; i++) {
+	level = SLSortedLevel(i + 1);
+	entry = SLCreateEntry(list, level, keys[i], values ? values[i] : NULL);
+	if (!entry) {
+	    retcode = -1;	/* Error, keep what was built */
+	    break;
+	}
+	for (j = 0; j <= level; j++) {
+	    last[j]->forward[j] = entry;
+	    last[j]             = entry;
+	}
+	if (level > list->level) list->level = level;
+	++list->count;
+    }
+    for (i = 0; i <= SL_MAX_LEVEL; i++) last[i]->forward[i] = NULL;
+    return retcode;
 }
 
 /* Dump internal data structures for debugging. */
-void N(SLDump)(void *l)
+static void SLClassicDump(void *l)
 {
     SkipListPtr   list = (SkipListPtr)l;
     SLEntryPtr    entry;
@@ -345,69 +612,632 @@ void N(SLDump)(void *l)
 		   list->magic, SL_ENTRY_MAGIC);
 	}
 	printf("\nEntry %p <0x%08lx, %p> has %2d levels\n",
-	       entry, entry->key, entry->value, entry->levels);
+	       (void *)entry, entry->key, entry->value, entry->levels);
 	for (i = 0; i < entry->levels; i++) {
 	    if (entry->forward[i]) {
 		printf("   %2d: %p <0x%08lx, %p>\n",
 		       i,
-		       entry->forward[i],
+		       (void *)entry->forward[i],
 		       entry->forward[i]->key,
 		       entry->forward[i]->value);
 	    } else {
-		printf("   %2d: %p\n", i, entry->forward[i]);
+		printf("   %2d: %p\n", i, (void *)entry->forward[i]);
 	    }
 	}
     }
 }
+#endif
+
+#if SL_MAIN || SL_UNROLLED
+static SLIndexPtr SLUnrolledNode(SLUnrolledListPtr list, int levels,
+				 unsigned long key)
+{
+    SLIndexPtr node;
+    int        i;
+
+    node = SLPoolAlloc(&list->index, levels,
+		       sizeof(*node) + (levels - 1) * sizeof(node->forward[0]));
+    if (!node) return NULL;
+    node->block = SLPoolAlloc(&list->blocks, 0, sizeof(*node->block));
+    if (!node->block) {
+	SLPoolFree(&list->index, levels, node);
+	return NULL;
+    }
+    node->key    = key;
+    node->count  = 0;
+    node->levels = levels;
+    for (i = 0; i < levels; i++) node->forward[i] = NULL;
+    return node;
+}
+
+static void *SLUnrolledCreate(void)
+{
+    SLUnrolledListPtr list;
+
+    list        = SL_ALLOC(sizeof(*list));
+    if (!list) return NULL;
+    list->magic = SL_UNROLLED_MAGIC;
+    list->level = 0;
+    list->count = 0;
+    list->p0    = NULL;
+    list->p1    = 0;
+    list->seed  = SL_RANDOM_SEED;
+    SLPoolInit(&list->index);
+    SLPoolInit(&list->blocks);
+    if (!(list->head = SLUnrolledNode(list, SL_MAX_LEVEL, 0))) {
+	SLPoolDestroy(&list->index);
+	SL_FREE(list);
+	return NULL;
+    }
+    return list;
+}
+
+static int SLUnrolledDestroy(void *l)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    SLPoolDestroy(&list->index);
+    SLPoolDestroy(&list->blocks);
+    list->magic = SL_FREED_MAGIC;
+    SL_FREE(list);
+    return 0;
+}
+
+/* Return the last index node whose key is no larger than key (or, if
+   strict is set, smaller than key).  If update is not NULL, the last such
+   node on each level is recorded there. */
+
+static SLIndexPtr SLUnrolledLocate(SLUnrolledListPtr list, unsigned long key,
+				   SLIndexPtr *update, int strict)
+{
+    SLIndexPtr node = list->head;
+    SLIndexPtr next;
+    int        i;
+
+    for (i = list->level; i >= 0; i--) {
+	while ((next = node->forward[i])
+	       && (next->key < key || (!strict && next->key == key)))
+	    node = next;
+	if (update) update[i] = node;
+    }
+    return node;
+}
+
+/* Return the position of the first key in node's block that is not
+   smaller than key. */
+
+static int SLUnrolledSearch(SLIndexPtr node, unsigned long key)
+{
+    unsigned long *keys = node->block->keys;
+    int           i;
+
+    for (i = 0; i < node->count && keys[i] < key; i++);
+    return i;
+}
+
+/* Remove an index node (and its block) from the list. */
+
+static void SLUnrolledUnlink(SLUnrolledListPtr list, SLIndexPtr node)
+{
+    SLIndexPtr update[SL_MAX_LEVEL];
+    int        i;
+
+    SLUnrolledLocate(list, node->key, update, 1);
+    for (i = 0; i < node->levels; i++)
+	if (update[i]->forward[i] == node)
+	    update[i]->forward[i] = node->forward[i];
+    SLPoolFree(&list->blocks, 0, node->block);
+    SLPoolFree(&list->index, node->levels, node);
+    while (list->level && !list->head->forward[list->level]) --list->level;
+}
+
+static int SLUnrolledInsert(void *l, unsigned long key, void *value)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    SLIndexPtr        update[SL_MAX_LEVEL];
+    SLIndexPtr        node;
+    SLIndexPtr        new;
+    SLBlockPtr        block;
+    int               half = SL_BLOCK_KEYS / 2;
+    int               levels;
+    int               i, j;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    node  = SLUnrolledLocate(list, key, update, 0);
+    j     = SLUnrolledSearch(node, key);
+    block = node->block;
+    if (j < node->count && block->keys[j] == key) return 1; /* Already in list */
+
+    if (node->count == SL_BLOCK_KEYS) {
+				/* Split the block, moving the upper half
+                                   to a new index node */
+	levels = SLRandomLevel(&list->seed);
+	new    = SLUnrolledNode(list, levels, block->keys[half]);
+	if (!new) return -1;	/* Error */
+	for (i = half; i < SL_BLOCK_KEYS; i++) {
+	    new->block->keys[i - half]   = block->keys[i];
+	    new->block->values[i - half] = block->values[i];
+	}
+	new->count  = SL_BLOCK_KEYS - half;
+	node->count = half;
+
+	for (i = list->level + 1; i < levels; i++) update[i] = list->head;
+	if (levels - 1 > list->level) list->level = levels - 1;
+	for (i = 0; i < levels; i++) {
+	    new->forward[i]       = update[i]->forward[i];
+	    update[i]->forward[i] = new;
+	}
+
+	if (j > half) {
+	    node   = new;
+	    block  = new->block;
+	    j     -= half;
+	}
+    }
+
+    for (i = node->count; i > j; i--) {
+	block->keys[i]   = block->keys[i - 1];
+	block->values[i] = block->values[i - 1];
+    }
+    block->keys[j]   = key;
+    block->values[j] = value;
+    if (!j && node != list->head) node->key = key;
+    ++node->count;
+    ++list->count;
+    return 0;			/* Added to table */
+}
+
+static int SLUnrolledDelete(void *l, unsigned long key)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    SLIndexPtr        node;
+    SLIndexPtr        next;
+    SLBlockPtr        block;
+    int               i, j;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    node  = SLUnrolledLocate(list, key, NULL, 0);
+    j     = SLUnrolledSearch(node, key);
+    block = node->block;
+    if (j == node->count || block->keys[j] != key) return 1; /* Not found */
+
+    for (i = j + 1; i < node->count; i++) {
+	block->keys[i - 1]   = block->keys[i];
+	block->values[i - 1] = block->values[i];
+    }
+    --node->count;
+    --list->count;
+
+				/* Merge the next block into this one if
+                                   this one is empty, or if together they
+                                   are at most half full. */
+    next = node->forward[0];
+    if (next && (!node->count
+		 || node->count + next->count <= SL_BLOCK_KEYS / 2)) {
+	for (i = 0; i < next->count; i++) {
+	    block->keys[node->count + i]   = next->block->keys[i];
+	    block->values[node->count + i] = next->block->values[i];
+	}
+	node->count += next->count;
+	SLUnrolledUnlink(list, next);
+    } else if (!node->count && node != list->head) {
+	SLUnrolledUnlink(list, node);
+	return 0;
+    }
+    if (node->count && node != list->head) node->key = block->keys[0];
+    return 0;
+}
+
+				/* Returns the slot holding key's value,
+                                   or NULL */
+static void **SLUnrolledFind(SLUnrolledListPtr list, unsigned long key)
+{
+    SLIndexPtr        node;
+    int               j;
+
+    node = SLUnrolledLocate(list, key, NULL, 0);
+    j    = SLUnrolledSearch(node, key);
+    if (j < node->count && node->block->keys[j] == key)
+	return &node->block->values[j];
+    return NULL;
+}
+
+static int SLUnrolledLookup(void *l, unsigned long key, void **value)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    void              **slot;
+
+    *value = NULL;
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    if (!(slot = SLUnrolledFind(list, key))) return -1;
+    *value = *slot;
+    return 0;
+}
+
+				/* There are no per-key entries, so the
+                                   value's slot in its block stands in
+                                   for one */
+static int SLUnrolledLookupEntry(void *l, unsigned long key, void **entry)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+
+    *entry = NULL;
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    return (*entry = SLUnrolledFind(list, key)) ? 0 : -1;
+}
+
+static int SLUnrolledLookupNeighbors(void *l, unsigned long key,
+				     unsigned long *prev_key,
+				     void **prev_value,
+				     unsigned long *next_key,
+				     void **next_value)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    SLIndexPtr        node;
+    SLIndexPtr        next;
+    int               j;
+    int               retcode = 1;
+
+    *prev_key   = *next_key   = key;
+    *prev_value = *next_value = NULL;
+    if (list->magic != SL_UNROLLED_MAGIC) return 0; /* Bad magic */
+
+				/* Every block but the first starts with
+                                   its node's key, so the predecessor is
+                                   in this block if there is one. */
+    node = SLUnrolledLocate(list, key, NULL, 1);
+    j    = SLUnrolledSearch(node, key);
+    if (j) {
+	*prev_key   = node->block->keys[j - 1];
+	*prev_value = node->block->values[j - 1];
+    } else {			/* Like the head of the classic list */
+	*prev_key   = 0;
+    }
+    if (j < node->count) {
+	*next_key   = node->block->keys[j];
+	*next_value = node->block->values[j];
+	++retcode;
+    } else if ((next = node->forward[0])) {
+	*next_key   = next->block->keys[0];
+	*next_value = next->block->values[0];
+	++retcode;
+    }
+    return retcode;
+}
+
+static int SLUnrolledNext(void *l, unsigned long *key, void **value)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    for (; list->p0; list->p0 = list->p0->forward[0], list->p1 = 0) {
+	if (list->p1 < list->p0->count) {
+	    *key   = list->p0->block->keys[list->p1];
+	    *value = list->p0->block->values[list->p1];
+	    ++list->p1;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static int SLUnrolledFirst(void *l, unsigned long *key, void **value)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    list->p0 = list->head;
+    list->p1 = 0;
+    return SLUnrolledNext(list, key, value);
+}
+
+static int SLUnrolledLookupRange(void *l, unsigned long lo, unsigned long hi,
+				 int (*callback)(unsigned long key,
+						 void *value, void *closure),
+				 void *closure)
+{
+    SLUnrolledListPtr list  = (SLUnrolledListPtr)l;
+    SLIndexPtr        node;
+    int               count = 0;
+    int               j;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+
+    node = SLUnrolledLocate(list, lo, NULL, 0);
+    for (j = SLUnrolledSearch(node, lo); node; node = node->forward[0], j = 0) {
+	for (; j < node->count; j++) {
+	    if (node->block->keys[j] > hi) return count;
+	    ++count;
+	    if (callback(node->block->keys[j], node->block->values[j], closure))
+		return count;
+	}
+    }
+    return count;
+}
+
+/* Blocks are filled completely, so that lookups touch as few blocks as
+   possible; the first insert into a block will split it. */
+static int SLUnrolledBuildSorted(void *l, const unsigned long *keys,
+				 void * const *values, int count)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    SLIndexPtr        last[SL_MAX_LEVEL];
+    SLIndexPtr        node;
+    unsigned long     blocks = 0;
+    int               retcode = 0;
+    int               levels;
+    int               i, j;
+
+    if (list->magic != SL_UNROLLED_MAGIC) return -1; /* Bad magic */
+    if (list->count || !SLSorted(keys, count)) return 1;
+
+    for (i = 0; i < SL_MAX_LEVEL; i++) last[i] = list->head;
+    node = list->head;
+    for (i = 0; i < count; i++) {
+	if (node->count == SL_BLOCK_KEYS) {
+	    levels = SLSortedLevel(++blocks) + 1;
+	    if (!(node = SLUnrolledNode(list, levels, keys[i]))) {
+		retcode = -1;	/* Error, keep what was built */
+		break;
+	    }
+	    for (j = 0; j < levels; j++) {
+		last[j]->forward[j] = node;
+		last[j]             = node;
+	    }
+	    if (levels - 1 > list->level) list->level = levels - 1;
+	}
+	node->block->keys[node->count]   = keys[i];
+	node->block->values[node->count] = values ? values[i] : NULL;
+	++node->count;
+	++list->count;
+    }
+    return retcode;
+}
+
+/* Dump internal data structures for debugging. */
+static void SLUnrolledDump(void *l)
+{
+    SLUnrolledListPtr list = (SLUnrolledListPtr)l;
+    SLIndexPtr        node;
+    int               i;
+
+    if (list->magic != SL_UNROLLED_MAGIC) {
+	printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
+	       list->magic, SL_UNROLLED_MAGIC);
+	return;
+    }
+
+    printf("Level = %d, count = %d\n", list->level, list->count);
+    for (node = list->head; node; node = node->forward[0]) {
+	printf("\nNode %p <0x%08lx> has %2d levels and %2d keys:",
+	       (void *)node, node->key, node->levels, node->count);
+	for (i = 0; i < node->count; i++)
+	    printf(" <0x%08lx, %p>",
+		   node->block->keys[i], node->block->values[i]);
+	printf("\n");
+	for (i = 0; i < node->levels; i++) {
+	    if (node->forward[i]) {
+		printf("   %2d: %p <0x%08lx>\n",
+		       i, (void *)node->forward[i], node->forward[i]->key);
+	    } else {
+		printf("   %2d: %p\n", i, (void *)node->forward[i]);
+	    }
+	}
+    }
+}
+#endif
+
+#if SL_UNROLLED
+#define SL_BACKEND(x) SLUnrolled##x
+#else
+#define SL_BACKEND(x) SLClassic##x
+#endif
+
+void *N(SLCreate)(void)
+{
+    return SL_BACKEND(Create)();
+}
+
+int N(SLDestroy)(void *l)
+{
+    return SL_BACKEND(Destroy)(l);
+}
+
+int N(SLInsert)(void *l, unsigned long key, void *value)
+{
+    return SL_BACKEND(Insert)(l, key, value);
+}
+
+int N(SLDelete)(void *l, unsigned long key)
+{
+    return SL_BACKEND(Delete)(l, key);
+}
+
+/* Set *value to an opaque pointer to the entry for key, which is valid
+   until the list is next changed.  Returns 0 if key is present, else -1
+   with *value set to NULL.  Use drmSLLookupValue for the value itself. */
+int N(SLLookup)(void *l, unsigned long key, void **value)
+{
+    return SL_BACKEND(LookupEntry)(l, key, value);
+}
+
+/* Like drmSLLookup, but set *value to the value stored with key. */
+int N(SLLookupValue)(void *l, unsigned long key, void **value)
+{
+    return SL_BACKEND(Lookup)(l, key, value);
+}
+
+int N(SLLookupNeighbors)(void *l, unsigned long key,
+			 unsigned long *prev_key, void **prev_value,
+			 unsigned long *next_key, void **next_value)
+{
+    return SL_BACKEND(LookupNeighbors)(l, key, prev_key, prev_value,
+				       next_key, next_value);
+}
+
+int N(SLNext)(void *l, unsigned long *key, void **value)
+{
+    return SL_BACKEND(Next)(l, key, value);
+}
+
+int N(SLFirst)(void *l, unsigned long *key, void **value)
+{
+    return SL_BACKEND(First)(l, key, value);
+}
+
+/* Call callback for each entry whose key is in [lo, hi], in order, until
+   it returns non-zero.  Returns the number of calls made. */
+int N(SLLookupRange)(void *l, unsigned long lo, unsigned long hi,
+		     int (*callback)(unsigned long key, void *value,
+				     void *closure),
+		     void *closure)
+{
+    return SL_BACKEND(LookupRange)(l, lo, hi, callback, closure);
+}
+
+typedef struct SLRangeArray {
+    unsigned long *keys;
+    void          **values;
+    int           count;
+    int           max;
+} SLRangeArray;
+
+static int SLRangeStore(unsigned long key, void *value, void *closure)
+{
+    SLRangeArray *array = closure;
+
+    if (array->count == array->max) return 1;
+    if (array->keys)   array->keys[array->count]   = key;
+    if (array->values) array->values[array->count] = value;
+    return ++array->count == array->max;
+}
+
+/* Store up to max entries whose keys are in [lo, hi] in keys and values
+   (either of which may be NULL).  Returns the number stored. */
+int N(SLLookupRangeArray)(void *l, unsigned long lo, unsigned long hi,
+			  unsigned long *keys, void **values, int max)
+{
+    SLRangeArray array;
+    int          retcode;
+
+    array.keys   = keys;
+    array.values = values;
+    array.count  = 0;
+    array.max    = max;
+    if (max <= 0) return 0;
+    retcode = SL_BACKEND(LookupRange)(l, lo, hi, SLRangeStore, &array);
+    return retcode < 0 ? retcode : array.count;
+}
+
+/* Fill an empty list from count strictly increasing keys (and values,
+   which may be NULL) in linear time.  Levels are assigned by position
+   rather than at random.  Returns 1, leaving the list alone, if the list
+   is not empty or the keys are not sorted; returns -1 if memory runs
+   out, in which case the list holds a prefix of the keys. */
+int N(SLBuildSorted)(void *l, const unsigned long *keys,
+		     void * const *values, int count)
+{
+    return SL_BACKEND(BuildSorted)(l, keys, values, count);
+}
+
+/* Dump internal data structures for debugging. */
+void N(SLDump)(void *l)
+{
+    SL_BACKEND(Dump)(l);
+}
 
 #if SL_MAIN
-static void print(SkipListPtr list)
+typedef struct SLBackend {
+    const char *name;
+    void       *(*create)(void);
+    int        (*destroy)(void *l);
+    int        (*insert)(void *l, unsigned long key, void *value);
+    int        (*delete)(void *l, unsigned long key);
+    int        (*lookup)(void *l, unsigned long key, void **value);
+    int        (*neighbors)(void *l, unsigned long key,
+			    unsigned long *prev_key, void **prev_value,
+			    unsigned long *next_key, void **next_value);
+    int        (*next)(void *l, unsigned long *key, void **value);
+    int        (*first)(void *l, unsigned long *key, void **value);
+    void       (*dump)(void *l);
+    int        (*range)(void *l, unsigned long lo, unsigned long hi,
+			int (*callback)(unsigned long key, void *value,
+					void *closure),
+			void *closure);
+    int        (*build)(void *l, const unsigned long *keys,
+			void * const *values, int count);
+    int        (*entry)(void *l, unsigned long key, void **entry);
+} SLBackend;
+
+static SLBackend backends[] = {
+    { "classic",  SLClassicCreate, SLClassicDestroy, SLClassicInsert,
+      SLClassicDelete, SLClassicLookup, SLClassicLookupNeighbors,
+      SLClassicNext, SLClassicFirst, SLClassicDump, SLClassicLookupRange,
+      SLClassicBuildSorted, SLClassicLookupEntry },
+    { "unrolled", SLUnrolledCreate, SLUnrolledDestroy, SLUnrolledInsert,
+      SLUnrolledDelete, SLUnrolledLookup, SLUnrolledLookupNeighbors,
+      SLUnrolledNext, SLUnrolledFirst, SLUnrolledDump,
+      SLUnrolledLookupRange, SLUnrolledBuildSorted,
+      SLUnrolledLookupEntry },
+};
+
+static void print(SLBackend *b, void *list)
 {
     unsigned long key;
     void          *value;
     
-    if (N(SLFirst)(list, &key, &value)) {
+    if (b->first(list, &key, &value)) {
 	do {
 	    printf("key = %5lu, value = %p\n", key, value);
-	} while (N(SLNext)(list, &key, &value));
+	} while (b->next(list, &key, &value));
     }
 }
 
-static double do_time(int size, int iter)
+static double do_time(SLBackend *b, int size, int iter)
 {
-    SkipListPtr    list;
+    void           *list;
     int            i, j;
-    unsigned long  keys[1000000];
+    static unsigned long keys[1000000];
     unsigned long  previous;
     unsigned long  key;
     void           *value;
     struct timeval start, stop;
-    double         usec;
-    SL_RANDOM_DECL;
+    double         usec, insert;
 
-    SL_RANDOM_INIT(12345);
+    srandom(12345);
+    for (i = 0; i < size; i++) keys[i] = random();
     
-    list = N(SLCreate)();
+    list = b->create();
 
-    for (i = 0; i < size; i++) {
-	keys[i] = SL_RANDOM;
-	N(SLInsert)(list, keys[i], NULL);
-    }
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++) b->insert(list, keys[i], (void *)keys[i]);
+    gettimeofday(&stop, NULL);
+    insert = (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		      - start.tv_sec * 1000000 - start.tv_usec) / size;
 
     previous = 0;
-    if (N(SLFirst)(list, &key, &value)) {
+    if (b->first(list, &key, &value)) {
 	do {
 	    if (key <= previous) {
 		printf( "%lu !< %lu\n", previous, key);
 	    }
 	    previous = key;
-	} while (N(SLNext)(list, &key, &value));
+	} while (b->next(list, &key, &value));
     }
     
     gettimeofday(&start, NULL);
     for (j = 0; j < iter; j++) {
 	for (i = 0; i < size; i++) {
-	    if (N(SLLookup)(list, keys[i], &value))
+	    if (b->lookup(list, keys[i], &value)
+		|| (unsigned long)value != keys[i])
 		printf("Error %lu %d\n", keys[i], i);
 	}
     }
@@ -416,14 +1246,241 @@ static double do_time(int size, int iter)
     usec = (double)(stop.tv_sec * 1000000 + stop.tv_usec
 		    - start.tv_sec * 1000000 - start.tv_usec) / (size * iter);
     
-    printf("%0.2f microseconds for list length %d\n", usec, size);
+    printf("%0.2f microseconds per lookup (%0.2f per insert)"
+	   " for %s list length %d\n", usec, insert, b->name, size);
 
-    N(SLDestroy)(list);
+    b->destroy(list);
     
     return usec;
 }
 
-static void print_neighbors(void *list, unsigned long key)
+/* Delete and reinsert every other key, so that freed entries are reused,
+   and check that the list still holds every key, in order, with the
+   right value. */
+static void check_reuse(SLBackend *b, int size)
+{
+    void          *list = b->create();
+    int           i;
+    unsigned long key;
+    void          *value;
+    unsigned long count = 0;
+
+    for (i = 0; i < size; i++) b->insert(list, i, (void *)(long)i);
+    for (i = 0; i < size; i += 2) b->delete(list, i);
+    for (i = 0; i < size; i += 2) b->insert(list, i, (void *)(long)i);
+    for (i = 0; i < size; i += 2) b->delete(list, i);
+    for (i = 0; i < size; i += 2) b->insert(list, i, (void *)(long)i);
+
+    if (b->first(list, &key, &value)) {
+	do {
+	    if (key != count || (unsigned long)value != count)
+		printf("Bad entry %lu = %lu, expected %lu\n",
+		       key, (unsigned long)value, count);
+	    ++count;
+	} while (b->next(list, &key, &value));
+    }
+    printf("%lu of %d entries after reuse\n", count, size);
+    b->destroy(list);
+}
+
+/* Insert and delete random keys, mirroring every change in a classic
+   list, and check that the unrolled list agrees with it on lookups,
+   neighbors, and iteration. */
+static void check_unrolled(int size)
+{
+    SLBackend     *c = &backends[0];
+    SLBackend     *u = &backends[1];
+    void          *cl = c->create();
+    void          *ul = u->create();
+    int           i;
+    int           errors = 0;
+    unsigned long key, key2;
+    unsigned long pk, nk, pk2, nk2;
+    void          *value, *value2;
+    void          *pv, *nv, *pv2, *nv2;
+
+    srandom(54321);
+    for (i = 0; i < size; i++) {
+	key = random() % (size / 4);
+	if (random() & 1) {
+	    if (c->insert(cl, key, (void *)key) != u->insert(ul, key, (void *)key))
+		++errors;
+	} else {
+	    if (c->delete(cl, key) != u->delete(ul, key)) ++errors;
+	}
+	key = random() % (size / 4);
+	if (c->lookup(cl, key, &value) != u->lookup(ul, key, &value2)
+	    || value != value2)
+	    ++errors;
+	if (c->neighbors(cl, key, &pk, &pv, &nk, &nv)
+	    != u->neighbors(ul, key, &pk2, &pv2, &nk2, &nv2)
+	    || pk != pk2 || pv != pv2 || nk != nk2 || nv != nv2)
+	    ++errors;
+    }
+
+    i = c->first(cl, &key, &value);
+    if (i != u->first(ul, &key2, &value2)) ++errors;
+    while (i) {
+	if (key != key2 || value != value2) ++errors;
+	i = c->next(cl, &key, &value);
+	if (i != u->next(ul, &key2, &value2)) ++errors;
+    }
+    printf("%d errors in %d random operations\n", errors, size);
+    c->destroy(cl);
+    u->destroy(ul);
+}
+
+static int sum_range(unsigned long key, void *value, void *closure)
+{
+    unsigned long *sum = closure;
+
+    if ((unsigned long)value != key) *sum += 1000000000UL;
+    *sum += key;
+    return 0;
+}
+
+/* Build a list of size keys with BuildSorted, check that it agrees with
+   the keys on lookups and range scans, and that it can still be updated;
+   then compare the time taken with inserting the same keys. */
+static void check_build(SLBackend *b, int size)
+{
+    static unsigned long keys[1000000];
+    static void          *values[1000000];
+    void                 *list;
+    int                  i, count;
+    int                  errors = 0;
+    unsigned long        lo, hi, sum, expected, key;
+    void                 *value;
+    struct timeval       start, stop;
+    double               build, insert;
+
+    for (i = 0; i < size; i++) {
+	keys[i]   = 3UL * i + 1;
+	values[i] = (void *)keys[i];
+    }
+
+    list = b->create();
+    gettimeofday(&start, NULL);
+    if (b->build(list, keys, values, size)) ++errors;
+    gettimeofday(&stop, NULL);
+    build = (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		     - start.tv_sec * 1000000 - start.tv_usec) / size;
+
+    if (b->build(list, keys, values, size) != 1) ++errors; /* Not empty */
+    for (i = 0; i < size; i++)
+	if (b->lookup(list, keys[i], &value) || value != values[i]) ++errors;
+
+    srandom(4242);
+    for (i = 0; i < 1000; i++) {
+	lo       = random() % (3UL * size + 10);
+	hi       = lo + random() % 1000;
+	sum      = 0;
+	expected = 0;
+	for (key = lo; key <= hi; key++)
+	    if (key % 3 == 1 && key < 3UL * size) expected += key;
+	b->range(list, lo, hi, sum_range, &sum);
+	if (sum != expected) ++errors;
+    }
+
+    for (i = 0; i < size; i += 2) b->delete(list, keys[i]);
+    for (i = 0; i < size; i += 2)
+	b->insert(list, keys[i] + 1, (void *)(keys[i] + 1));
+    sum      = 0;
+    expected = 0;
+    count    = b->range(list, 0, ~0UL, sum_range, &sum);
+    for (i = 0; i < size; i++) expected += keys[i] + !(i & 1);
+    if (sum != expected || count != size) ++errors;
+    for (i = 0; i < size; i += 2)
+	if (b->lookup(list, keys[i] + 1, &value)) ++errors;
+    b->destroy(list);
+
+    list = b->create();
+    keys[1] = keys[0];
+    if (b->build(list, keys, values, size) != 1) ++errors; /* Unsorted */
+    keys[1] = 4;
+    b->destroy(list);
+
+    list = b->create();
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++) b->insert(list, keys[i], values[i]);
+    gettimeofday(&stop, NULL);
+    insert = (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		      - start.tv_sec * 1000000 - start.tv_usec) / size;
+    b->destroy(list);
+
+    printf("%s build of %d keys: %d errors, %0.3f microseconds per key"
+	   " (%0.3f to insert)\n", b->name, size, errors, build, insert);
+}
+
+/* Check that SLRandomLevel halves the frequency of each level, and time
+   it. */
+static void check_levels(void)
+{
+    unsigned long  seed = SL_RANDOM_SEED;
+    unsigned long  counts[SL_MAX_LEVEL + 1];
+    unsigned long  total = 10000000;
+    unsigned long  i;
+    int            level;
+    int            errors = 0;
+    struct timeval start, stop;
+    double         usec;
+
+    for (level = 0; level <= SL_MAX_LEVEL; level++) counts[level] = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < total; i++) ++counts[SLRandomLevel(&seed)];
+    gettimeofday(&stop, NULL);
+    usec = (double)(stop.tv_sec * 1000000 + stop.tv_usec
+		    - start.tv_sec * 1000000 - start.tv_usec);
+
+    if (counts[0]) ++errors;
+    for (level = 1; level < 10; level++) {
+	double expected = (double)total / (2 << (level - 1));
+	if (counts[level] < 0.95 * expected || counts[level] > 1.05 * expected)
+	    ++errors;
+    }
+    printf("Levels: %d errors, %0.2f ns per level\n",
+	   errors, usec * 1000.0 / total);
+}
+
+/* Check the array form of range lookups through the public interface. */
+static void check_range_array(void)
+{
+    static const unsigned long keys[] = { 10, 20, 30, 40, 50 };
+    unsigned long              found[8];
+    void                       *values[8];
+    void                       *list = N(SLCreate)();
+    int                        errors = 0;
+
+    N(SLBuildSorted)(list, keys, NULL, 5);
+    if (N(SLLookupRangeArray)(list, 15, 45, found, values, 8) != 3
+	|| found[0] != 20 || found[2] != 40 || values[1]) ++errors;
+    if (N(SLLookupRangeArray)(list, 0, ~0UL, found, NULL, 2) != 2
+	|| found[1] != 20) ++errors;
+    if (N(SLLookupRangeArray)(list, 51, 100, found, values, 8)) ++errors;
+    if (N(SLLookupRangeArray)(list, 30, 30, NULL, values, 8) != 1) ++errors;
+    printf("Range arrays: %d errors\n", errors);
+    N(SLDestroy)(list);
+}
+
+/* Check that lookups by entry (drmSLLookup) return an entry, and those
+   by value (drmSLLookupValue) the value. */
+static void check_lookup(SLBackend *b)
+{
+    void *list = b->create();
+    void *value;
+    void *entry;
+    int  errors = 0;
+
+    b->insert(list, 7, (void *)7UL);
+    if (b->lookup(list, 7, &value) || value != (void *)7UL) ++errors;
+    if (b->entry(list, 7, &entry) || !entry || entry == value) ++errors;
+    if (!b->entry(list, 8, &entry) || entry) ++errors;
+    if (!b->lookup(list, 8, &value) || value) ++errors;
+    printf("Lookups: %d errors\n", errors);
+    b->destroy(list);
+}
+
+static void print_neighbors(SLBackend *b, void *list, unsigned long key)
 {
     unsigned long prev_key = 0;
     unsigned long next_key = 0;
@@ -431,59 +1488,71 @@ static void print_neighbors(void *list, unsigned long key)
     void          *next_value;
     int           retval;
 
-    retval = drmSLLookupNeighbors(list, key,
-				  &prev_key, &prev_value,
-				  &next_key, &next_value);
+    retval = b->neighbors(list, key,
+			  &prev_key, &prev_value,
+			  &next_key, &next_value);
     printf("Neighbors of %5lu: %d %5lu %5lu\n",
 	   key, retval, prev_key, next_key);
 }
 
 int main(void)
 {
-    SkipListPtr    list;
-    double         usec, usec2, usec3, usec4;
+    SLBackend      *b;
+    void           *list;
+    double         usec, usec2;
+    int            i, size;
 
-    list = N(SLCreate)();
-    printf( "list at %p\n", list);
+    for (b = backends; b < backends + sizeof(backends)/sizeof(*b); b++) {
+	printf("%s layout\n\n", b->name);
 
-    print(list);
-    printf("\n==============================\n\n");
+	list = b->create();
+	printf( "list at %p\n", list);
 
-    N(SLInsert)(list, 123, NULL);
-    N(SLInsert)(list, 213, NULL);
-    N(SLInsert)(list, 50, NULL);
-    print(list);
-    printf("\n==============================\n\n");
+	print(b, list);
+	printf("\n==============================\n\n");
+
+	b->insert(list, 123, NULL);
+	b->insert(list, 213, NULL);
+	b->insert(list, 50, NULL);
+	print(b, list);
+	printf("\n==============================\n\n");
     
-    print_neighbors(list, 0);
-    print_neighbors(list, 50);
-    print_neighbors(list, 51);
-    print_neighbors(list, 123);
-    print_neighbors(list, 200);
-    print_neighbors(list, 213);
-    print_neighbors(list, 256);
-    printf("\n==============================\n\n");    
+	print_neighbors(b, list, 0);
+	print_neighbors(b, list, 50);
+	print_neighbors(b, list, 51);
+	print_neighbors(b, list, 123);
+	print_neighbors(b, list, 200);
+	print_neighbors(b, list, 213);
+	print_neighbors(b, list, 256);
+	printf("\n==============================\n\n");    
     
-    N(SLDelete)(list, 50);
-    print(list);
-    printf("\n==============================\n\n");
+	b->delete(list, 50);
+	print(b, list);
+	printf("\n==============================\n\n");
 
-    N(SLDump)(list);
-    N(SLDestroy)(list);
+	b->dump(list);
+	b->destroy(list);
+	printf("\n==============================\n\n");
+
+	check_reuse(b, 100000);
+	printf("\n==============================\n\n");
+
+	check_build(b, 1000);
+	check_build(b, 1000000);
+	check_lookup(b);
+	printf("\n==============================\n\n");
+    }
+
+    check_levels();
+    check_range_array();
+    check_unrolled(1000000);
     printf("\n==============================\n\n");
 
-    usec  = do_time(100, 10000);
-    usec2 = do_time(1000, 500);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   1000.0/100.0, usec2 / usec);
-    
-    usec3 = do_time(10000, 50);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   10000.0/100.0, usec3 / usec);
-    
-    usec4 = do_time(100000, 4);
-    printf("Table size increased by %0.2f, search time increased by %0.2f\n",
-	   100000.0/100.0, usec4 / usec);
+    for (i = 0, size = 100; size <= 1000000; i++, size *= 10) {
+	usec  = do_time(&backends[0], size, 10000000 / size);
+	usec2 = do_time(&backends[1], size, 10000000 / size);
+	printf("Unrolled lookups are %0.2f times as fast\n\n", usec / usec2);
+    }
 
     return 0;
 }
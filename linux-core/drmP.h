@@ -68,7 +68,7 @@
 #define DRM_KERNEL_CONTEXT    0	 /* Change drm_resctx if changed	  */
 #define DRM_RESERVED_CONTEXTS 1	 /* Change drm_resctx if changed	  */
 #define DRM_LOOPING_LIMIT     5000000
-#define DRM_BSZ		      1024 /* Buffer size for /dev/drm? output	  */
+#define DRM_BSZ		      4096 /* Buffer size for /dev/drm? output	  */
 #define DRM_TIME_SLICE	      (HZ/20)  /* Time slice for GLXContexts	  */
 #define DRM_LOCK_SLICE	      1	/* Time slice for lock, in jiffies	  */
 
@@ -289,6 +289,13 @@ typedef struct drm_histogram {
 	atomic_t	  ctx[DRM_DMA_HISTOGRAM_SLOTS];
 	atomic_t	  lacq[DRM_DMA_HISTOGRAM_SLOTS];
 	atomic_t	  lhld[DRM_DMA_HISTOGRAM_SLOTS];
+
+				/* Lock handoff to a sleeping waiter:
+				   lhnd = lwak + lsch + lcas */
+	atomic_t	  lhnd[DRM_DMA_HISTOGRAM_SLOTS]; /* free to held     */
+	atomic_t	  lwak[DRM_DMA_HISTOGRAM_SLOTS]; /* free to woken    */
+	atomic_t	  lsch[DRM_DMA_HISTOGRAM_SLOTS]; /* woken to running */
+	atomic_t	  lcas[DRM_DMA_HISTOGRAM_SLOTS]; /* running to held  */
 } drm_histogram_t;
 #endif
 
@@ -499,6 +506,8 @@ typedef struct drm_device {
 	struct tq_struct  tq;
 	cycles_t	  ctx_start;
 	cycles_t	  lck_start;
+	cycles_t	  lck_free;	/* Lock word last cleared	   */
+	cycles_t	  lck_woke;	/* Waiters last woken		   */
 #if DRM_DMA_HISTOGRAM
 	drm_histogram_t	  histo;
 #endif
@@ -509,6 +518,8 @@ typedef struct drm_device {
 	char		  *buf_rp;	/* Read pointer			   */
 	char		  *buf_wp;	/* Write pointer		   */
 	char		  *buf_end;	/* End pointer			   */
+	drm_event_format_t buf_format;	/* Format of context switch requests */
+	unsigned int	  buf_sequence;	/* Context switch requests queued  */
 	struct fasync_struct *buf_async;/* Processes waiting for SIGIO	   */
 	wait_queue_head_t buf_readers;	/* Processes waiting to read	   */
 	wait_queue_head_t buf_writers;	/* Processes waiting to ctx switch */
@@ -538,6 +549,9 @@ extern int	     drm_fasync(int fd, struct file *filp, int on);
 extern ssize_t	     drm_read(struct file *filp, char *buf, size_t count,
 			      loff_t *off);
 extern int	     drm_write_string(drm_device_t *dev, const char *s);
+extern int	     drm_write_event(drm_device_t *dev, int old, int new);
+extern int	     drm_eventmode(struct inode *inode, struct file *filp,
+				   unsigned int cmd, unsigned long arg);
 extern unsigned int  drm_poll(struct file *filp, struct poll_table_struct *wait);
 
 				/* Mapping support (vm.c) */
@@ -701,6 +715,10 @@ extern int	     drm_lock_transfer(drm_device_t *dev,
 extern int	     drm_lock_free(drm_device_t *dev,
 				   __volatile__ unsigned int *lock,
 				   unsigned int context);
+#if DRM_DMA_HISTOGRAM
+extern void	     drm_lock_histogram(drm_device_t *dev, cycles_t woke,
+					cycles_t held);
+#endif
 extern int	     drm_finish(struct inode *inode, struct file *filp,
 				unsigned int cmd, unsigned long arg);
 extern int	     drm_flush_unblock(drm_device_t *dev, int context,
@@ -1156,6 +1156,12 @@ int i810_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 	DECLARE_WAITQUEUE(entry, current);
 	int		  ret	= 0;
 	drm_lock_t	  lock;
+#if DRM_DMA_HISTOGRAM
+	cycles_t	  start;
+	cycles_t	  woke	= 0;
+
+	dev->lck_start = start = get_cycles();
+#endif
 
 	copy_from_user_ret(&lock, (drm_lock_t *)arg, sizeof(lock), -EFAULT);
 
@@ -1188,6 +1194,9 @@ int i810_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 				dev->lock.pid	    = current->pid;
 				dev->lock.lock_time = jiffies;
 				atomic_inc(&dev->total_locks);
+#if DRM_DMA_HISTOGRAM
+				drm_lock_histogram(dev, woke, get_cycles());
+#endif
 				break;	/* Got lock */
 			}
 			
@@ -1196,6 +1205,9 @@ int i810_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 			current->state = TASK_INTERRUPTIBLE;
 		   	DRM_DEBUG("Calling lock schedule\n");
 			schedule();
+#if DRM_DMA_HISTOGRAM
+			woke = get_cycles();
+#endif
 			if (signal_pending(current)) {
 				ret = -ERESTARTSYS;
 				break;
@@ -1213,6 +1225,10 @@ int i810_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 		}
 	}
 	DRM_DEBUG("%d %s\n", lock.context, ret ? "interrupted" : "has lock");
+
+#if DRM_DMA_HISTOGRAM
+	atomic_inc(&dev->histo.lacq[drm_histogram_slot(get_cycles() - start)]);
+#endif
 	return ret;
 }
 
@@ -92,6 +92,7 @@ static drm_ioctl_desc_t	      r128_ioctls[] = {
 	[DRM_IOCTL_NR(DRM_IOCTL_LOCK)]	      = { r128_lock,	   1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_UNLOCK)]      = { r128_unlock,	   1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_FINISH)]      = { drm_finish,	   1, 0 },
+	[DRM_IOCTL_NR(DRM_IOCTL_EVENT_MODE)]  = { drm_eventmode,    1, 1 },
 
 #ifdef DRM_AGP
 	[DRM_IOCTL_NR(DRM_IOCTL_AGP_ACQUIRE)] = { drm_agp_acquire, 1, 1 },
@@ -202,10 +203,14 @@ static int r128_setup(drm_device_t *dev)
 
 	dev->ctx_start	    = 0;
 	dev->lck_start	    = 0;
+	dev->lck_free	    = 0;
+	dev->lck_woke	    = 0;
 
 	dev->buf_rp	  = dev->buf;
 	dev->buf_wp	  = dev->buf;
 	dev->buf_end	  = dev->buf + DRM_BSZ;
+	dev->buf_format	  = _DRM_EVENT_TEXT;
+	dev->buf_sequence = 0;
 	dev->buf_async	  = NULL;
 	init_waitqueue_head(&dev->buf_readers);
 	init_waitqueue_head(&dev->buf_writers);
@@ -552,6 +557,7 @@ int r128_lock(struct inode *inode, struct file *filp, unsigned int cmd,
         drm_lock_t        lock;
 #if DRM_DMA_HISTOGRAM
         cycles_t          start;
+        cycles_t          woke  = 0;
 
         dev->lck_start = start = get_cycles();
 #endif
@@ -607,6 +613,9 @@ int r128_lock(struct inode *inode, struct file *filp, unsigned int cmd,
                                 dev->lock.pid       = current->pid;
                                 dev->lock.lock_time = jiffies;
                                 atomic_inc(&dev->total_locks);
+#if DRM_DMA_HISTOGRAM
+                                drm_lock_histogram(dev, woke, get_cycles());
+#endif
                                 break;  /* Got lock */
                         }
 
@@ -617,6 +626,9 @@ int r128_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 			current->policy |= SCHED_YIELD;
 #endif
                         schedule();
+#if DRM_DMA_HISTOGRAM
+                        woke = get_cycles();
+#endif
                         if (signal_pending(current)) {
                                 ret = -ERESTARTSYS;
                                 break;
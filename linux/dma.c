@@ -205,7 +205,6 @@ void drm_reclaim_buffers(drm_device_t *dev, pid_t pid)
 
 int drm_context_switch(drm_device_t *dev, int old, int new)
 {
-	char	    buf[64];
 	drm_queue_t *q;
 
 	atomic_inc(&dev->total_ctx);
@@ -242,8 +241,7 @@ int drm_context_switch(drm_device_t *dev, int old, int new)
 	if (drm_flags & DRM_FLAG_NOCTX) {
 		drm_context_switch_complete(dev, new);
 	} else {
-		sprintf(buf, "C %d %d\n", old, new);
-		drm_write_string(dev, buf);
+		drm_write_event(dev, old, new);
 	}
 	
 	atomic_dec(&q->use_count);
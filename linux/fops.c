@@ -145,8 +145,8 @@ ssize_t drm_read(struct file *filp, char *buf, size_t count, loff_t *off)
 {
 	drm_file_t    *priv   = filp->private_data;
 	drm_device_t  *dev    = priv->dev;
-	int	      left;
 	int	      avail;
+	int	      total;
 	int	      send;
 	int	      cur;
 
@@ -165,53 +165,54 @@ ssize_t drm_read(struct file *filp, char *buf, size_t count, loff_t *off)
 		DRM_DEBUG("  awake\n");
 	}
 
-	left  = (dev->buf_rp + DRM_BSZ - dev->buf_wp) % DRM_BSZ;
-	avail = DRM_BSZ - left;
-	send  = DRM_MIN(avail, count);
+	avail = (dev->buf_wp + DRM_BSZ - dev->buf_rp) % DRM_BSZ;
+	total = DRM_MIN(avail, count);
+				/* Never split a binary record */
+	if (dev->buf_format == _DRM_EVENT_BINARY && total < avail) {
+		total -= total % sizeof(drm_ctx_event_t);
+		if (!total) return -EINVAL;
+	}
 
-	while (send) {
+	for (send = total; send; send -= cur) {
 		if (dev->buf_wp > dev->buf_rp) {
 			cur = DRM_MIN(send, dev->buf_wp - dev->buf_rp);
 		} else {
 			cur = DRM_MIN(send, dev->buf_end - dev->buf_rp);
 		}
 		copy_to_user_ret(buf, dev->buf_rp, cur, -EINVAL);
+		buf	    += cur;
 		dev->buf_rp += cur;
 		if (dev->buf_rp == dev->buf_end) dev->buf_rp = dev->buf;
-		send -= cur;
 	}
 	
 	wake_up_interruptible(&dev->buf_writers);
-	return DRM_MIN(avail, count);;
+	return total;
 }
 
-int drm_write_string(drm_device_t *dev, const char *s)
+/* Queue size bytes for the reader, all or nothing.  One byte of the ring
+   is left unused, so that a full ring can be told from an empty one. */
+
+static int drm_write_buffer(drm_device_t *dev, const void *data, int size)
 {
-	int left   = (dev->buf_rp + DRM_BSZ - dev->buf_wp) % DRM_BSZ;
-	int send   = strlen(s);
-	int count;
+	const char *s	 = data;
+	int	   left  = (dev->buf_rp + DRM_BSZ - dev->buf_wp - 1) % DRM_BSZ;
+	int	   count;
 
 	DRM_DEBUG("%d left, %d to send (%p, %p)\n",
-		  left, send, dev->buf_rp, dev->buf_wp);
+		  left, size, dev->buf_rp, dev->buf_wp);
 	
-	if (left == 1 || dev->buf_wp != dev->buf_rp) {
-		DRM_ERROR("Buffer not empty (%d left, wp = %p, rp = %p)\n",
-			  left,
-			  dev->buf_wp,
-			  dev->buf_rp);
+	if (size > left) {
+		DRM_ERROR("Buffer full (%d left, %d to send)\n", left, size);
+		return -EBUSY;
 	}
 
-	while (send) {
-		if (dev->buf_wp >= dev->buf_rp) {
-			count = DRM_MIN(send, dev->buf_end - dev->buf_wp);
-			if (count == left) --count; /* Leave a hole */
-		} else {
-			count = DRM_MIN(send, dev->buf_rp - dev->buf_wp - 1);
-		}
-		strncpy(dev->buf_wp, s, count);
+	while (size) {
+		count = DRM_MIN(size, dev->buf_end - dev->buf_wp);
+		memcpy(dev->buf_wp, s, count);
 		dev->buf_wp += count;
 		if (dev->buf_wp == dev->buf_end) dev->buf_wp = dev->buf;
-		send -= count;
+		s    += count;
+		size -= count;
 	}
 
 #if LINUX_VERSION_CODE < 0x020315 && !defined(KILLFASYNCHASTHREEPARAMETERS)
@@ -230,6 +231,57 @@ int drm_write_string(drm_device_t *dev, const char *s)
 	return 0;
 }
 
+int drm_write_string(drm_device_t *dev, const char *s)
+{
+	return drm_write_buffer(dev, s, strlen(s));
+}
+
+/* Ask the X server to switch from context old to context new, in the
+   format it selected with DRM_IOCTL_EVENT_MODE.  Requests queue in the
+   ring until it is full, so that one read can drain several. */
+
+int drm_write_event(drm_device_t *dev, int old, int new)
+{
+	drm_ctx_event_t event;
+	struct timeval	tv;
+	char		buf[64];
+
+	++dev->buf_sequence;
+	if (dev->buf_format != _DRM_EVENT_BINARY) {
+		sprintf(buf, "C %d %d\n", old, new);
+		return drm_write_string(dev, buf);
+	}
+
+	do_gettimeofday(&tv);
+	event.type     = _DRM_EVENT_CONTEXT;
+	event.sequence = dev->buf_sequence;
+	event.old      = old;
+	event.new      = new;
+	event.tv_sec   = tv.tv_sec;
+	event.tv_usec  = tv.tv_usec;
+	return drm_write_buffer(dev, &event, sizeof(event));
+}
+
+int drm_eventmode(struct inode *inode, struct file *filp, unsigned int cmd,
+		  unsigned long arg)
+{
+	drm_file_t	 *priv	 = filp->private_data;
+	drm_device_t	 *dev	 = priv->dev;
+	drm_event_mode_t mode;
+
+	copy_from_user_ret(&mode, (drm_event_mode_t *)arg, sizeof(mode),
+			   -EFAULT);
+	DRM_DEBUG("%d\n", mode.format);
+	switch (mode.format) {
+	case _DRM_EVENT_TEXT:
+	case _DRM_EVENT_BINARY:
+		dev->buf_format = mode.format;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 unsigned int drm_poll(struct file *filp, struct poll_table_struct *wait)
 {
 	drm_file_t   *priv = filp->private_data;
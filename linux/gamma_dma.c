@@ -738,6 +738,7 @@ int gamma_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 	drm_queue_t	  *q;
 #if DRM_DMA_HISTOGRAM
 	cycles_t	  start;
+	cycles_t	  woke	= 0;
 
 	dev->lck_start = start = get_cycles();
 #endif
@@ -785,6 +786,9 @@ int gamma_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 				dev->lock.lock_time = jiffies;
 				atomic_inc(&dev->total_locks);
 				atomic_inc(&q->total_locks);
+#if DRM_DMA_HISTOGRAM
+				drm_lock_histogram(dev, woke, get_cycles());
+#endif
 				break;	/* Got lock */
 			}
 			
@@ -792,6 +796,9 @@ int gamma_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 			atomic_inc(&dev->total_sleeps);
 			current->state = TASK_INTERRUPTIBLE;
 			schedule();
+#if DRM_DMA_HISTOGRAM
+			woke = get_cycles();
+#endif
 			if (signal_pending(current)) {
 				ret = -ERESTARTSYS;
 				break;
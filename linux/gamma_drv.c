@@ -101,6 +101,7 @@ static drm_ioctl_desc_t	      gamma_ioctls[] = {
 	[DRM_IOCTL_NR(DRM_IOCTL_LOCK)]	     = { gamma_lock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_UNLOCK)]     = { gamma_unlock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_FINISH)]     = { drm_finish,	  1, 0 },
+	[DRM_IOCTL_NR(DRM_IOCTL_EVENT_MODE)] = { drm_eventmode,   1, 1 },
 };
 #define GAMMA_IOCTL_COUNT DRM_ARRAY_SIZE(gamma_ioctls)
 
@@ -198,10 +199,14 @@ static int gamma_setup(drm_device_t *dev)
 #endif
 	dev->ctx_start	    = 0;
 	dev->lck_start	    = 0;
+	dev->lck_free	    = 0;
+	dev->lck_woke	    = 0;
 	
 	dev->buf_rp	  = dev->buf;
 	dev->buf_wp	  = dev->buf;
 	dev->buf_end	  = dev->buf + DRM_BSZ;
+	dev->buf_format	  = _DRM_EVENT_TEXT;
+	dev->buf_sequence = 0;
 	dev->buf_async	  = NULL;
 	init_waitqueue_head(&dev->buf_readers);
 	init_waitqueue_head(&dev->buf_writers);
@@ -95,6 +95,7 @@ static drm_ioctl_desc_t	      i810_ioctls[] = {
 	[DRM_IOCTL_NR(DRM_IOCTL_LOCK)]	      = { i810_lock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_UNLOCK)]      = { i810_unlock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_FINISH)]      = { drm_finish,	  1, 0 },
+	[DRM_IOCTL_NR(DRM_IOCTL_EVENT_MODE)]  = { drm_eventmode,   1, 1 },
 
 	[DRM_IOCTL_NR(DRM_IOCTL_AGP_ACQUIRE)] = { drm_agp_acquire, 1, 1 },
 	[DRM_IOCTL_NR(DRM_IOCTL_AGP_RELEASE)] = { drm_agp_release, 1, 1 },
@@ -208,10 +209,14 @@ static int i810_setup(drm_device_t *dev)
 #endif
 	dev->ctx_start	    = 0;
 	dev->lck_start	    = 0;
+	dev->lck_free	    = 0;
+	dev->lck_woke	    = 0;
 	
 	dev->buf_rp	  = dev->buf;
 	dev->buf_wp	  = dev->buf;
 	dev->buf_end	  = dev->buf + DRM_BSZ;
+	dev->buf_format	  = _DRM_EVENT_TEXT;
+	dev->buf_sequence = 0;
 	dev->buf_async	  = NULL;
 	init_waitqueue_head(&dev->buf_readers);
 	init_waitqueue_head(&dev->buf_writers);
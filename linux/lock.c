@@ -113,10 +113,41 @@ int drm_lock_free(drm_device_t *dev,
 			  pid);
 		return 1;
 	}
+#if DRM_DMA_HISTOGRAM
+	dev->lck_free = get_cycles();
+#endif
 	wake_up_interruptible(&dev->lock.lock_queue);
+#if DRM_DMA_HISTOGRAM
+	dev->lck_woke = get_cycles();
+#endif
 	return 0;
 }
 
+#if DRM_DMA_HISTOGRAM
+/* Called by the *_lock ioctls when a waiter that slept has taken the
+   lock.  woke is when it returned from schedule(), held when its
+   drm_lock_take succeeded.  The handoff from the last drm_lock_free is
+   split into issuing the wakeup (lwak), the scheduler running the
+   waiter (lsch) and retaking the lock word (lcas).  lck_free and
+   lck_woke are read without a lock.  On the fastest handoffs the
+   waiter runs on another CPU before its waker has stamped lck_woke;
+   the wakeup then took at most until the waiter woke, so those samples
+   count that as lwak and no time in lsch.  Only a sample whose lck_free
+   is from a later drm_lock_free than the one that woke it is dropped. */
+void drm_lock_histogram(drm_device_t *dev, cycles_t woke, cycles_t held)
+{
+	cycles_t freed = dev->lck_free;
+	cycles_t waked = dev->lck_woke;
+
+	if (!woke || woke < freed || held < woke) return;
+	if (waked < freed || waked > woke) waked = woke;
+	atomic_inc(&dev->histo.lhnd[drm_histogram_slot(held - freed)]);
+	atomic_inc(&dev->histo.lwak[drm_histogram_slot(waked - freed)]);
+	atomic_inc(&dev->histo.lsch[drm_histogram_slot(woke - waked)]);
+	atomic_inc(&dev->histo.lcas[drm_histogram_slot(held - woke)]);
+}
+#endif
+
 static int drm_flush_queue(drm_device_t *dev, int context)
 {
 	DECLARE_WAITQUEUE(entry, current);
@@ -44,8 +44,6 @@ static int mga_alloc_queue(drm_device_t *dev)
 
 int mga_context_switch(drm_device_t *dev, int old, int new)
 {
-        char        buf[64];
-
         atomic_inc(&dev->total_ctx);
 
         if (test_and_set_bit(0, &dev->context_flag)) {
@@ -67,8 +65,7 @@ int mga_context_switch(drm_device_t *dev, int old, int new)
         if (drm_flags & DRM_FLAG_NOCTX) {
                 mga_context_switch_complete(dev, new);
         } else {
-                sprintf(buf, "C %d %d\n", old, new);
-                drm_write_string(dev, buf);
+                drm_write_event(dev, old, new);
         }
         
         return 0;
@@ -1017,6 +1017,12 @@ int mga_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 	DECLARE_WAITQUEUE(entry, current);
 	int		  ret	= 0;
 	drm_lock_t	  lock;
+#if DRM_DMA_HISTOGRAM
+	cycles_t	  start;
+	cycles_t	  woke	= 0;
+
+	dev->lck_start = start = get_cycles();
+#endif
 
 	DRM_DEBUG("%s\n", __FUNCTION__);
 	copy_from_user_ret(&lock, (drm_lock_t *)arg, sizeof(lock), -EFAULT);
@@ -1051,6 +1057,9 @@ int mga_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 				dev->lock.pid	    = current->pid;
 				dev->lock.lock_time = jiffies;
 				atomic_inc(&dev->total_locks);
+#if DRM_DMA_HISTOGRAM
+				drm_lock_histogram(dev, woke, get_cycles());
+#endif
 				break;	/* Got lock */
 			}
 			
@@ -1058,6 +1067,9 @@ int mga_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 			atomic_inc(&dev->total_sleeps);
 			current->state = TASK_INTERRUPTIBLE;
 			schedule();
+#if DRM_DMA_HISTOGRAM
+			woke = get_cycles();
+#endif
 			if (signal_pending(current)) {
 				ret = -ERESTARTSYS;
 				break;
@@ -1076,6 +1088,10 @@ int mga_lock(struct inode *inode, struct file *filp, unsigned int cmd,
 	}
    
 	DRM_DEBUG("%d %s\n", lock.context, ret ? "interrupted" : "has lock");
+
+#if DRM_DMA_HISTOGRAM
+	atomic_inc(&dev->histo.lacq[drm_histogram_slot(get_cycles() - start)]);
+#endif
 	return ret;
 }
 		
@@ -97,6 +97,7 @@ static drm_ioctl_desc_t	      mga_ioctls[] = {
 	[DRM_IOCTL_NR(DRM_IOCTL_LOCK)]	      = { mga_lock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_UNLOCK)]      = { mga_unlock,	  1, 0 },
 	[DRM_IOCTL_NR(DRM_IOCTL_FINISH)]      = { drm_finish,	  1, 0 },
+	[DRM_IOCTL_NR(DRM_IOCTL_EVENT_MODE)]  = { drm_eventmode,   1, 1 },
 
 	[DRM_IOCTL_NR(DRM_IOCTL_AGP_ACQUIRE)] = { drm_agp_acquire, 1, 1 },
 	[DRM_IOCTL_NR(DRM_IOCTL_AGP_RELEASE)] = { drm_agp_release, 1, 1 },
@@ -207,10 +208,14 @@ static int mga_setup(drm_device_t *dev)
 
 	dev->ctx_start	    = 0;
 	dev->lck_start	    = 0;
+	dev->lck_free	    = 0;
+	dev->lck_woke	    = 0;
 	
 	dev->buf_rp	  = dev->buf;
 	dev->buf_wp	  = dev->buf;
 	dev->buf_end	  = dev->buf + DRM_BSZ;
+	dev->buf_format	  = _DRM_EVENT_TEXT;
+	dev->buf_sequence = 0;
 	dev->buf_async	  = NULL;
 	init_waitqueue_head(&dev->buf_readers);
 	init_waitqueue_head(&dev->buf_writers);
@@ -660,6 +665,10 @@ int mga_unlock(struct inode *inode, struct file *filp, unsigned int cmd,
 			  DRM_KERNEL_CONTEXT)) {
 	   DRM_ERROR("\n");
 	}
+#if DRM_DMA_HISTOGRAM
+	atomic_inc(&dev->histo.lhld[drm_histogram_slot(get_cycles()
+						       - dev->lck_start)]);
+#endif
 
 	return 0;
 }
@@ -556,6 +556,23 @@ static int _drm_histo_info(char *buf, char **start, off_t offset, int len,
 		prev_value = slot_value;
 		slot_value = DRM_DMA_HISTOGRAM_NEXT(slot_value);
 	}
+
+	slot_value = DRM_DMA_HISTOGRAM_INITIAL;
+	prev_value = 0;
+	DRM_PROC_PRINT("\n		       lhnd	  lwak	     lsch"
+		       "	lcas\n\n");
+	for (i = 0; i < DRM_DMA_HISTOGRAM_SLOTS; i++) {
+		DRM_PROC_PRINT("%s %10lu %10u %10u %10u %10u\n",
+			       i == DRM_DMA_HISTOGRAM_SLOTS - 1 ? ">=" : "< ",
+			       i == DRM_DMA_HISTOGRAM_SLOTS - 1
+			       ? prev_value : slot_value ,
+			       atomic_read(&dev->histo.lhnd[i]),
+			       atomic_read(&dev->histo.lwak[i]),
+			       atomic_read(&dev->histo.lsch[i]),
+			       atomic_read(&dev->histo.lcas[i]));
+		prev_value = slot_value;
+		slot_value = DRM_DMA_HISTOGRAM_NEXT(slot_value);
+	}
 	return len;
 }
 
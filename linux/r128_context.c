@@ -47,8 +47,6 @@ static int r128_alloc_queue(drm_device_t *dev)
 
 int r128_context_switch(drm_device_t *dev, int old, int new)
 {
-        char        buf[64];
-
         atomic_inc(&dev->total_ctx);
 
         if (test_and_set_bit(0, &dev->context_flag)) {
@@ -70,8 +68,7 @@ int r128_context_switch(drm_device_t *dev, int old, int new)
         if (drm_flags & DRM_FLAG_NOCTX) {
                 r128_context_switch_complete(dev, new);
         } else {
-                sprintf(buf, "C %d %d\n", old, new);
-                drm_write_string(dev, buf);
+                drm_write_event(dev, old, new);
         }
         
         return 0;
@@ -0,0 +1,555 @@
+/* containerbench.c -- Benchmark for the libdrm hash, skip list and random
+ *                     number support
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This program drives insert, lookup, delete and iteration on every
+ * container (drmHash, the concurrent drmHash and drmSL) for several table
+ * sizes and key distributions, and measures the drmRandom generators.  It
+ * is linked against the container objects only: drmMalloc and drmFree are
+ * supplied here, so that the memory used by each container can be counted.
+ *
+ * One JSON object is printed per line, so that the output can be kept and
+ * compared between versions.  Each line reports:
+ *
+ *   ns_per_op          mean time over a pass through every key
+ *   p50_ns, p99_ns     latency of individually timed operations on a
+ *                      random sample of keys (includes the clock_ns
+ *                      overhead of reading the clock)
+ *   bytes_per_entry    bytes allocated through drmMalloc per entry
+ *   allocs_per_entry   drmMalloc calls per entry
+ *   misses_per_op      hardware cache misses per operation, from
+ *                      perf_event_open, or -1 if unavailable
+ *
+ * Usage: containerbench [-s size]... [-c container] [-d distribution]
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include "xf86drm.h"
+
+#ifndef BENCH_PERF
+# ifdef __linux__
+#  define BENCH_PERF 1
+# else
+#  define BENCH_PERF 0
+# endif
+#endif
+
+#if BENCH_PERF
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#define BENCH_SAMPLES 10000	/* Individually timed operations */
+#define BENCH_MAX_SIZES 16
+#define BENCH_FILL    4096	/* Values per drmRandomFill call */
+
+/* ================================================================
+ * Counting allocator: the containers allocate through drmMalloc, which
+ * is normally in xf86drm.c.
+ */
+
+typedef union BenchHeader {	/* Keeps the allocation aligned */
+    int    size;
+    double d;
+    long   l;
+    void   *p;
+} BenchHeader;
+
+static unsigned long bench_bytes;
+static unsigned long bench_allocs;
+
+void *drmMalloc(int size)
+{
+    BenchHeader *pt;
+
+    if (!(pt = malloc(sizeof(*pt) + size))) return NULL;
+    memset(pt + 1, 0, size);
+    pt->size      = size;
+    bench_bytes  += size;
+    ++bench_allocs;
+    return pt + 1;
+}
+
+void drmFree(void *pt)
+{
+    BenchHeader *h;
+
+    if (pt) {
+	h            = (BenchHeader *)pt - 1;
+	bench_bytes -= h->size;
+	free(h);
+    }
+}
+
+/* ================================================================
+ * Timing and cache miss counting.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static int perf_fd = -1;
+
+static void perf_init(void)
+{
+#if BENCH_PERF
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void perf_start(void)
+{
+#if BENCH_PERF
+    if (perf_fd < 0) return;
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/* Return the number of cache misses since perf_start, or -1. */
+static double perf_stop(void)
+{
+#if BENCH_PERF
+    __u64 count;
+
+    if (perf_fd < 0) return -1;
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(perf_fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return (double)count;
+#else
+    return -1;
+#endif
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double *sample, int count, int p)
+{
+    return sample[(count - 1) * p / 100];
+}
+
+/* ================================================================
+ * Containers and key distributions.
+ */
+
+typedef struct Container {
+    const char *name;
+    void       *(*create)(void);
+    int        (*destroy)(void *t);
+    int        (*lookup)(void *t, unsigned long key, void **value);
+    int        (*insert)(void *t, unsigned long key, void *value);
+    int        (*delete)(void *t, unsigned long key);
+    int        (*first)(void *t, unsigned long *key, void **value);
+    int        (*next)(void *t, unsigned long *key, void **value);
+} Container;
+
+static Container containers[] = {
+    { "hash",            drmHashCreate,           drmHashDestroy,
+      drmHashLookup,     drmHashInsert,           drmHashDelete,
+      drmHashFirst,      drmHashNext },
+    { "hash_concurrent", drmHashCreateConcurrent, drmHashDestroy,
+      drmHashLookup,     drmHashInsert,           drmHashDelete,
+      drmHashFirst,      drmHashNext },
+    { "skiplist",        drmSLCreate,             drmSLDestroy,
+      drmSLLookupValue,  drmSLInsert,             drmSLDelete,
+      drmSLFirst,        drmSLNext },
+};
+
+/* Fill keys[0..count-1] with distinct keys.  The keys past the ones that
+   are inserted are used for unsuccessful lookups. */
+
+static void keys_sequential(unsigned long *keys, unsigned long count)
+{
+    unsigned long i;
+
+    for (i = 0; i < count; i++) keys[i] = i;
+}
+
+static void keys_pages(unsigned long *keys, unsigned long count)
+{
+    unsigned long i;
+
+    for (i = 0; i < count; i++) keys[i] = i * 4096;
+}
+
+static void keys_scattered(unsigned long *keys, unsigned long count)
+{
+    unsigned long i;
+
+    for (i = 0; i < count; i++) keys[i] = (i * 2654435761UL) & 0xffffffffUL;
+}
+
+/* drmRandom has a period of 2^31-2, so these are distinct too. */
+static void keys_random(unsigned long *keys, unsigned long count)
+{
+    void          *state = drmRandomCreate(1);
+
+    drmRandomFill(state, keys, (int)count);
+    drmRandomDestroy(state);
+}
+
+typedef struct Distribution {
+    const char *name;
+    void       (*fill)(unsigned long *keys, unsigned long count);
+} Distribution;
+
+static Distribution distributions[] = {
+    { "sequential", keys_sequential },
+    { "pages",      keys_pages      },
+    { "scattered",  keys_scattered  },
+    { "random",     keys_random     },
+};
+
+/* ================================================================
+ * Measurement.
+ */
+
+typedef struct Result {
+    double ns_per_op;
+    double p50;
+    double p99;
+    double misses_per_op;
+} Result;
+
+static double clock_ns;		/* Cost of reading the clock */
+
+static void report(const char *container, const char *dist,
+		   unsigned long size, const char *op, Result *r,
+		   double bytes, double allocs, unsigned long errors)
+{
+    printf("{\"container\":\"%s\",\"dist\":\"%s\",\"size\":%lu,"
+	   "\"op\":\"%s\",\"ns_per_op\":%.2f,\"p50_ns\":%.1f,"
+	   "\"p99_ns\":%.1f,\"clock_ns\":%.1f,\"bytes_per_entry\":%.2f,"
+	   "\"allocs_per_entry\":%.3f,\"misses_per_op\":%.3f,"
+	   "\"errors\":%lu}\n",
+	   container, dist, size, op, r->ns_per_op, r->p50, r->p99,
+	   clock_ns, bytes, allocs, r->misses_per_op, errors);
+}
+
+static void finish(Result *r, double start, double misses,
+		   unsigned long ops, double *sample, int count)
+{
+    r->ns_per_op     = (now() - start) / ops;
+    r->misses_per_op = misses < 0 ? -1 : misses / ops;
+    qsort(sample, count, sizeof(*sample), compare_double);
+    r->p50           = percentile(sample, count, 50);
+    r->p99           = percentile(sample, count, 99);
+}
+
+static void calibrate(void)
+{
+    double start;
+    int    i;
+
+    start = now();
+    for (i = 0; i < 1000000; i++) now();
+    clock_ns = (now() - start) / 1000000;
+}
+
+static void bench(Container *c, Distribution *d, unsigned long size)
+{
+    unsigned long *keys   = malloc(2 * size * sizeof(*keys));
+    unsigned long *order  = malloc(size * sizeof(*order));
+    double        *sample = malloc(BENCH_SAMPLES * sizeof(*sample));
+    int           count   = size < BENCH_SAMPLES ? size : BENCH_SAMPLES;
+    void          *state  = drmRandomCreate(2);
+    void          *table;
+    unsigned long bytes, allocs;
+    double        per_entry, allocs_per_entry;
+    unsigned long i, j, tmp;
+    unsigned long errors;
+    unsigned long key;
+    void          *value;
+    double        start, misses, t;
+    Result        ins, hit, miss, walk, del;
+    int           k;
+
+    d->fill(keys, 2 * size);
+    for (i = 0; i < size; i++) order[i] = i;
+    for (i = size - 1; i > 0; i--) { /* Shuffle the lookup order */
+	j        = drmRandom(state) % (i + 1);
+	tmp      = order[i];
+	order[i] = order[j];
+	order[j] = tmp;
+    }
+
+    bytes  = bench_bytes;
+    allocs = bench_allocs;
+    table  = c->create();
+
+				/* Insert */
+    errors = 0;
+    perf_start();
+    start  = now();
+    for (i = 0; i < size; i++)
+	if (c->insert(table, keys[i], (void *)i)) ++errors;
+    misses = perf_stop();
+    per_entry        = (double)(bench_bytes - bytes) / size;
+    allocs_per_entry = (double)(bench_allocs - allocs) / size;
+    ins.ns_per_op     = (now() - start) / size;
+    ins.misses_per_op = misses < 0 ? -1 : misses / size;
+
+				/* Successful lookups */
+    perf_start();
+    start = now();
+    for (i = 0; i < size; i++)
+	if (c->lookup(table, keys[order[i]], &value)) ++errors;
+    misses = perf_stop();
+    for (k = 0; k < count; k++) {
+	key       = keys[order[k]];
+	t         = now();
+	c->lookup(table, key, &value);
+	sample[k] = now() - t;
+    }
+    finish(&hit, start, misses, size, sample, count);
+
+				/* Unsuccessful lookups */
+    perf_start();
+    start = now();
+    for (i = size; i < 2 * size; i++)
+	if (!c->lookup(table, keys[i], &value)) ++errors;
+    misses = perf_stop();
+    for (k = 0; k < count; k++) {
+	key       = keys[size + order[k]];
+	t         = now();
+	c->lookup(table, key, &value);
+	sample[k] = now() - t;
+    }
+    finish(&miss, start, misses, size, sample, count);
+
+				/* Iterate */
+    perf_start();
+    start = now();
+    i     = 0;
+    if (c->first(table, &key, &value) == 1) {
+	do {
+	    ++i;
+	} while (c->next(table, &key, &value));
+    }
+    misses = perf_stop();
+    if (i != size) ++errors;
+    walk.ns_per_op     = (now() - start) / size;
+    walk.misses_per_op = misses < 0 ? -1 : misses / size;
+    walk.p50 = walk.p99 = walk.ns_per_op;
+
+				/* Individually timed deletes and inserts
+                                   of a sample of the keys */
+    for (k = 0; k < count; k++) {
+	key       = keys[order[k]];
+	t         = now();
+	c->delete(table, key);
+	sample[k] = now() - t;
+    }
+    qsort(sample, count, sizeof(*sample), compare_double);
+    del.p50 = percentile(sample, count, 50);
+    del.p99 = percentile(sample, count, 99);
+    for (k = 0; k < count; k++) {
+	key       = keys[order[k]];
+	t         = now();
+	c->insert(table, key, (void *)order[k]);
+	sample[k] = now() - t;
+    }
+    qsort(sample, count, sizeof(*sample), compare_double);
+    ins.p50 = percentile(sample, count, 50);
+    ins.p99 = percentile(sample, count, 99);
+
+				/* Delete */
+    perf_start();
+    start = now();
+    for (i = 0; i < size; i++)
+	if (c->delete(table, keys[order[i]])) ++errors;
+    misses = perf_stop();
+    del.ns_per_op     = (now() - start) / size;
+    del.misses_per_op = misses < 0 ? -1 : misses / size;
+
+    c->destroy(table);
+    if (bench_bytes != bytes) ++errors; /* Leak */
+
+    report(c->name, d->name, size, "insert",  &ins,  per_entry,
+	   allocs_per_entry, errors);
+    report(c->name, d->name, size, "hit",     &hit,  per_entry,
+	   allocs_per_entry, errors);
+    report(c->name, d->name, size, "miss",    &miss, per_entry,
+	   allocs_per_entry, errors);
+    report(c->name, d->name, size, "iterate", &walk, per_entry,
+	   allocs_per_entry, errors);
+    report(c->name, d->name, size, "delete",  &del,  per_entry,
+	   allocs_per_entry, errors);
+
+    drmRandomDestroy(state);
+    free(sample);
+    free(order);
+    free(keys);
+}
+
+static void bench_random(void)
+{
+    static unsigned long fill[BENCH_FILL];
+    static double        dfill[BENCH_FILL];
+    void          *state = drmRandomCreate(1);
+    unsigned long count  = 10000000;
+    unsigned long i;
+    unsigned long sum    = 0;
+    double        dsum   = 0;
+    double        start;
+    Result        r;
+
+    perf_start();
+    start           = now();
+    for (i = 0; i < count; i++) sum += drmRandom(state);
+    r.misses_per_op = perf_stop();
+    r.ns_per_op     = (now() - start) / count;
+    r.p50 = r.p99   = r.ns_per_op;
+    if (r.misses_per_op >= 0) r.misses_per_op /= count;
+    report("random", "-", count, "random", &r, 0, 0, sum ? 0 : 1);
+
+    perf_start();
+    start           = now();
+    for (i = 0; i < count; i++) dsum += drmRandomDouble(state);
+    r.misses_per_op = perf_stop();
+    r.ns_per_op     = (now() - start) / count;
+    r.p50 = r.p99   = r.ns_per_op;
+    if (r.misses_per_op >= 0) r.misses_per_op /= count;
+    report("random", "-", count, "double", &r, 0, 0, dsum > 0 ? 0 : 1);
+
+    perf_start();
+    start           = now();
+    for (i = 0; i < count; i += BENCH_FILL) {
+	drmRandomFill(state, fill, BENCH_FILL);
+	sum += fill[BENCH_FILL - 1];
+    }
+    r.misses_per_op = perf_stop();
+    r.ns_per_op     = (now() - start) / count;
+    r.p50 = r.p99   = r.ns_per_op;
+    if (r.misses_per_op >= 0) r.misses_per_op /= count;
+    report("random", "-", count, "fill", &r, 0, 0, sum ? 0 : 1);
+
+    perf_start();
+    start           = now();
+    for (i = 0; i < count; i += BENCH_FILL) {
+	drmRandomFillDouble(state, dfill, BENCH_FILL);
+	dsum += dfill[BENCH_FILL - 1];
+    }
+    r.misses_per_op = perf_stop();
+    r.ns_per_op     = (now() - start) / count;
+    r.p50 = r.p99   = r.ns_per_op;
+    if (r.misses_per_op >= 0) r.misses_per_op /= count;
+    report("random", "-", count, "fill_double", &r, 0, 0, dsum > 0 ? 0 : 1);
+
+    drmRandomDestroy(state);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+	    "usage: %s [-s size]... [-c container] [-d distribution]\n",
+	    name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long sizes[BENCH_MAX_SIZES];
+    int           nsizes    = 0;
+    const char    *container = NULL;
+    const char    *dist      = NULL;
+    void          *table;
+    unsigned int  i, j;
+    int           k;
+    int           c;
+
+    while ((c = getopt(argc, argv, "s:c:d:")) != EOF)
+	switch (c) {
+	case 's':
+	    if (nsizes == BENCH_MAX_SIZES) usage(argv[0]);
+	    if (!(sizes[nsizes++] = strtoul(optarg, NULL, 0))) usage(argv[0]);
+	    break;
+	case 'c': container = optarg; break;
+	case 'd': dist      = optarg; break;
+	default:  usage(argv[0]);
+	}
+
+    if (!nsizes) {
+	sizes[nsizes++] = 1000;
+	sizes[nsizes++] = 100000;
+	sizes[nsizes++] = 1000000;
+    }
+
+    perf_init();
+    calibrate();
+				/* The first table of each kind allocates
+                                   long-lived random number state, which
+                                   should not be counted as a leak. */
+    for (i = 0; i < sizeof(containers)/sizeof(containers[0]); i++) {
+	table = containers[i].create();
+	containers[i].insert(table, 0, NULL);
+	containers[i].destroy(table);
+    }
+
+    if (!container || !strcmp(container, "random")) bench_random();
+
+    for (k = 0; k < nsizes; k++)
+	for (i = 0; i < sizeof(containers)/sizeof(containers[0]); i++) {
+	    if (container && strcmp(container, containers[i].name)) continue;
+	    for (j = 0; j < sizeof(distributions)/sizeof(distributions[0]);
+		 j++) {
+		if (dist && strcmp(dist, distributions[j].name)) continue;
+		bench(&containers[i], &distributions[j], sizes[k]);
+		fflush(stdout);
+	    }
+	}
+
+    return 0;
+}
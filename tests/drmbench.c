@@ -0,0 +1,653 @@
+/* drmbench.c -- Multi-process load generator for a DRM device
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This program loads a DRM device the way several direct rendering
+ * clients do.  It forks a number of clients, each with its own descriptor
+ * and context, and for the given time each repeats:
+ *
+ *   lock     take the hardware lock (drmGetLockFast, or drmGetLock with -i)
+ *   dma      request one DMA buffer, waiting for a free one
+ *   free     free it, or with -S send it, so the hardware has work
+ *   unlock   after holding the lock for -H microseconds of busy work
+ *   switch   every -c iterations, ask for a switch to its context
+ *
+ * then sleeps for -G microseconds outside the lock.  The parent adds a
+ * SAREA holding the lock, and DMA buffers if there are none, and
+ * authenticates each client, so the run works as root or not.
+ *
+ * The result is one JSON object: throughput, the p50, p99 and p999
+ * latency of each step over all clients, and per client the iterations
+ * completed and its own lock latencies.  Fairness is Jain's index over
+ * the clients' lock acquisitions (1.0 when every client got the lock
+ * equally often) and the ratio of the fewest to the most.
+ *
+ * With -p the clients instead play lock ping-pong: each takes the lock
+ * through the kernel, holds it, stamps the time and unlocks, so that a
+ * client blocked in DRM_IOCTL_LOCK is handed the lock.  The handoff
+ * latency is from the holder's stamp to the waiter returning with the
+ * lock, counted only when the waiter asked before the holder let go.
+ * Each client is pinned to its own core (also available for the load
+ * above with -a), and a repeat is counted when a client takes the lock
+ * again straight after releasing it.  When the device's /proc/dri/N/histo
+ * is readable, the run also reports how the kernel's lacq, lhld and
+ * handoff histograms (lhnd = lwak + lsch + lcas: issuing the wakeup,
+ * scheduling the waiter and retaking the lock word) moved, in cycles.
+ *
+ * Latencies are kept in log-scale histograms with 16 buckets per power
+ * of two, so percentiles are accurate to about 3%.
+ *
+ * Any device works; without hardware, run against the loopback device:
+ *
+ *   LD_PRELOAD=./drmmock.so ./drmbench -o mock -n 8 -t 5
+ *   LD_PRELOAD=./drmmock.so ./drmbench -o mock -n 2 -p -H 20
+ *
+ * Usage: drmbench [-o name | -O busid] [-n clients] [-t seconds]
+ *                 [-b count,size] [-H usec] [-G usec] [-c switches]
+ *                 [-i] [-S] [-a] [-p]
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#ifdef __linux__
+#define _GNU_SOURCE		/* sched_setaffinity */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>	/* for minor() */
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "xf86drm.h"
+
+#ifndef minor
+#define minor(x) ((int)((x) & 0xff))
+#endif
+
+#define BENCH_CLIENTS 4
+#define BENCH_SECONDS 5
+#define BENCH_BUCKETS 1024	/* 16 per power of two, to 2^63 ns */
+#define BENCH_MAX     256	/* Most clients */
+
+#define BENCH_LOCK    0		/* Steps timed */
+#define BENCH_DMA     1
+#define BENCH_FREE    2
+#define BENCH_SWITCH  3
+#define BENCH_ITER    4
+#define BENCH_HANDOFF 5
+#define BENCH_STEPS   6
+
+static const char *bench_names[BENCH_STEPS] = {
+    "lock", "dma", "free", "switch", "iteration", "handoff"
+};
+
+				/* Kernel histograms reported by -p */
+#define BENCH_SLOTS   9		/* DRM_DMA_HISTOGRAM_SLOTS */
+#define BENCH_KCOLS   6
+
+static const char *bench_kcols[BENCH_KCOLS] = {
+    "lacq", "lhld", "lhnd", "lwak", "lsch", "lcas"
+};
+
+typedef struct BenchClient {
+    pid_t         pid;
+    drmMagic      magic;	/* Set by the client, for drmAuthMagic */
+    int           authenticated;
+    int           ready;
+    int           error;	/* -errno of the first failure */
+    int           cpu;		/* Pinned to, or -1 */
+    unsigned long iterations;
+    unsigned long repeats;	/* -p: took the lock again after itself */
+    unsigned long count[BENCH_STEPS];
+    unsigned long histo[BENCH_STEPS][BENCH_BUCKETS];
+} BenchClient;
+
+typedef struct BenchShared {
+    volatile int  start;
+    double        deadline;	/* ns */
+    volatile int  holder;	/* -p: last holder + 1; under the lock */
+    volatile double released;	/* -p: when it let go, ns */
+    BenchClient   client[1];
+} BenchShared;
+
+static const char *bench_name;
+static const char *bench_busid;
+static int        bench_hold;	/* usec */
+static int        bench_gap;	/* usec */
+static int        bench_switch;	/* iterations per switch; 0 for none */
+static int        bench_ioctl;	/* Always lock through the kernel */
+static int        bench_send;	/* Send buffers rather than free them */
+static int        bench_pin;	/* Pin each client to its own core */
+static int        bench_pingpong; /* Measure lock handoff only */
+static int        bench_size = 4096;
+static drmHandle  bench_sarea;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static int bucket(double ns)
+{
+    unsigned long v = ns < 0 ? 0 : (unsigned long)ns;
+    int           msb;
+
+    if (v < 16) return v;
+    for (msb = 4; msb < 63 && (v >> (msb + 1)); msb++);
+    return (msb - 3) * 16 + ((v >> (msb - 4)) & 15);
+}
+
+				/* The middle of the bucket, in ns */
+static double bucket_value(int b)
+{
+    int msb;
+
+    if (b < 16) return b;
+    msb = b / 16 + 3;
+    return ((16 + b % 16) + 0.5) * (double)(1UL << (msb - 4));
+}
+
+static void record(BenchClient *c, int step, double start, double end)
+{
+    ++c->count[step];
+    ++c->histo[step][bucket(end - start)];
+}
+
+static double percentile(const unsigned long *histo, unsigned long count,
+			 double p)
+{
+    unsigned long target = (unsigned long)(count * p);
+    unsigned long seen   = 0;
+    int           i;
+
+    if (!count) return 0;
+    if (target >= count) target = count - 1;
+    for (i = 0; i < BENCH_BUCKETS; i++) {
+	seen += histo[i];
+	if (seen > target) return bucket_value(i);
+    }
+    return bucket_value(BENCH_BUCKETS - 1);
+}
+
+static void spin(int usec)
+{
+    double end = now() + usec * 1000.0;
+
+    while (now() < end);
+}
+
+static int bench_open(void)
+{
+    return drmOpen(bench_name, bench_busid);
+}
+
+/* Pin client id to a core of its own while there are enough. */
+static int pin(int id)
+{
+#ifdef CPU_SET
+    cpu_set_t set;
+    long      cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int       cpu  = cpus > 0 ? id % cpus : 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (!sched_setaffinity(0, sizeof(set), &set)) return cpu;
+#endif
+    return -1;
+}
+
+/* Take and release the lock through the kernel until the deadline.  The
+   stamp and holder are written while holding the lock, so the next holder
+   reads them without a race. */
+static int pingpong(BenchShared *shared, BenchClient *c, int id, int fd,
+		    drmLockPtr lock, drmContext context)
+{
+    double t0, t1, released;
+    int    holder;
+    int    ret;
+
+    while ((t0 = now()) < shared->deadline) {
+	if (bench_ioctl) ret = drmGetLock(fd, context, 0);
+	else             ret = drmGetLockFast(fd, lock, context, 0);
+	if (ret) return ret;
+	t1       = now();
+	holder   = shared->holder;
+	released = shared->released;
+	record(c, BENCH_LOCK, t0, t1);
+	if (holder == id + 1)                 ++c->repeats;
+	else if (holder && t0 < released)     record(c, BENCH_HANDOFF,
+							 released, t1);
+
+	if (bench_hold) spin(bench_hold);
+	shared->holder   = id + 1;
+	shared->released = now();
+	if (bench_ioctl) drmUnlock(fd, context);
+	else             drmUnlockFast(fd, lock, context);
+
+	++c->iterations;
+	record(c, BENCH_ITER, t0, now());
+	if (bench_gap) usleep(bench_gap);
+    }
+    return 0;
+}
+
+/* Lock, get a buffer, free or send it, unlock, until the deadline. */
+static int load(BenchShared *shared, BenchClient *c, int fd,
+		drmLockPtr lock, drmContext context)
+{
+    drmDMAReq     dma;
+    int           idx;
+    int           size;
+    int           ret = 0;
+    double        t0, t1, t2, t3, t4;
+
+    dma.context       = context;
+    dma.request_size  = bench_size;
+    dma.request_list  = &idx;
+    dma.request_sizes = &size;
+
+    while ((t0 = now()) < shared->deadline) {
+	if (bench_ioctl) ret = drmGetLock(fd, context, 0);
+	else             ret = drmGetLockFast(fd, lock, context, 0);
+	if (ret) break;
+	t1 = now();
+	record(c, BENCH_LOCK, t0, t1);
+
+	dma.send_count    = 0;
+	dma.request_count = 1;
+	dma.flags         = DRM_DMA_WAIT;
+	if ((ret = drmDMA(fd, &dma)) || !dma.granted_count) {
+	    if (bench_ioctl) drmUnlock(fd, context);
+	    else             drmUnlockFast(fd, lock, context);
+	    if (!ret) ret = -EAGAIN;
+	    break;
+	}
+	t2 = now();
+	record(c, BENCH_DMA, t1, t2);
+
+	if (bench_send) {
+	    dma.send_count    = 1;
+	    dma.send_list     = &idx;
+	    dma.send_sizes    = &size;
+	    dma.request_count = 0;
+	    dma.flags         = DRM_DMA_WHILE_LOCKED;
+	    ret = drmDMA(fd, &dma);
+	} else {
+	    ret = drmFreeBufs(fd, 1, &idx);
+	}
+	t3 = now();
+	record(c, BENCH_FREE, t2, t3);
+
+	if (bench_hold) spin(bench_hold);
+	if (bench_ioctl) drmUnlock(fd, context);
+	else             drmUnlockFast(fd, lock, context);
+	if (ret) break;
+
+	++c->iterations;
+	if (bench_switch && !(c->iterations % bench_switch)) {
+	    t4 = now();
+	    drmSwitchToContext(fd, context);
+	    record(c, BENCH_SWITCH, t4, now());
+	}
+	record(c, BENCH_ITER, t0, now());
+	if (bench_gap) usleep(bench_gap);
+    }
+    return ret;
+}
+
+static void client(BenchShared *shared, int id)
+{
+    BenchClient   *c = &shared->client[id];
+    drmContext    context;
+    drmAddress    address;
+    int           fd;
+    int           ret;
+
+    c->pid = getpid();
+    c->cpu = bench_pin ? pin(id) : -1;
+    if ((fd = bench_open()) < 0) {
+	c->error = fd;
+	c->ready = 1;
+	_exit(1);
+    }
+    if ((ret = drmGetMagic(fd, &c->magic))) c->error = ret;
+    while (!c->authenticated && !c->error) usleep(1000);
+    if (!c->error && (ret = drmCreateContext(fd, &context))) c->error = ret;
+    if (!c->error && (ret = drmMap(fd, bench_sarea, getpagesize(),
+				   &address))) c->error = ret;
+    c->ready = 1;
+    if (c->error) _exit(1);
+
+    while (!shared->start) usleep(100);
+    if (bench_pingpong) ret = pingpong(shared, c, id, fd, address, context);
+    else                ret = load(shared, c, fd, address, context);
+    if (ret && !c->error) c->error = ret;
+    drmDestroyContext(fd, context);
+    drmClose(fd);
+    _exit(0);
+}
+
+/* A histogram column name: a letter, then letters and digits. */
+static int column_name(const char *pt)
+{
+    if (*pt < 'a' || *pt > 'z') return 0;
+    while (*++pt)
+	if ((*pt < 'a' || *pt > 'z') && (*pt < '0' || *pt > '9')) return 0;
+    return 1;
+}
+
+/* Read the bench_kcols columns of /proc/dri/<minor>/histo into histo.
+   Each table there is a header line of column names followed by one row
+   per slot: "<" or ">=", the slot's bound, then a count per column.
+   Returns the number of columns found, 0 when there is no such file (a
+   kernel built without DRM_DMA_HISTOGRAM, or a mock device). */
+static int read_histo(int fd, unsigned long histo[BENCH_KCOLS][BENCH_SLOTS])
+{
+    struct stat st;
+    char        name[64];
+    char        line[256];
+    char        *tok[16];
+    int         col[16];	/* Header column to kernel column, or -1 */
+    int         cols  = 0;
+    int         found = 0;
+    int         slot  = 0;
+    int         n, i, k;
+    char        *pt;
+    FILE        *f;
+
+    memset(histo, 0, sizeof(unsigned long) * BENCH_KCOLS * BENCH_SLOTS);
+    if (fstat(fd, &st) || !S_ISCHR(st.st_mode)) return 0;
+    sprintf(name, "/proc/dri/%d/histo", minor(st.st_rdev));
+    if (!(f = fopen(name, "r"))) return 0;
+
+    while (fgets(line, sizeof(line), f)) {
+	for (n = 0, pt = strtok(line, " \t\n"); pt && n < 16;
+	     pt = strtok(NULL, " \t\n")) tok[n++] = pt;
+	if (n > 2 && (!strcmp(tok[0], "<") || !strcmp(tok[0], ">="))) {
+	    for (i = 2; i < n && i - 2 < cols && slot < BENCH_SLOTS; i++)
+		if (col[i - 2] >= 0)
+		    histo[col[i - 2]][slot] = strtoul(tok[i], NULL, 10);
+	    ++slot;
+	    continue;
+	}
+	if (n < 4) continue;
+	for (i = 0; i < n && column_name(tok[i]); i++);
+	if (i < n) continue;
+				/* A header */
+	for (i = 0, cols = n, slot = 0; i < n; i++)
+	    for (col[i] = -1, k = 0; k < BENCH_KCOLS; k++)
+		if (!strcmp(tok[i], bench_kcols[k])) {
+		    col[i] = k;
+		    ++found;
+		}
+    }
+    fclose(f);
+    return found;
+}
+
+static void print_latency(const char *name, const unsigned long *histo,
+			  unsigned long count, int comma)
+{
+    printf("\"%s\":{\"count\":%lu,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+	   "\"p999_us\":%.3f}%s",
+	   name, count,
+	   percentile(histo, count, 0.50) / 1000.0,
+	   percentile(histo, count, 0.99) / 1000.0,
+	   percentile(histo, count, 0.999) / 1000.0,
+	   comma ? "," : "");
+}
+
+/* Whether step s is timed in this mode. */
+static int step_used(int s)
+{
+    if (bench_pingpong)
+	return s == BENCH_LOCK || s == BENCH_ITER || s == BENCH_HANDOFF;
+    return s != BENCH_HANDOFF;
+}
+
+static void print_kernel(unsigned long histo[BENCH_KCOLS][BENCH_SLOTS])
+{
+    unsigned long bound = 10;
+    int           k, i;
+
+    printf("\"kernel\":{\"unit\":\"cycles\",\"slots\":[");
+    for (i = 0; i < BENCH_SLOTS; i++, bound *= 10)
+	printf("\"%s%lu\"%s", i < BENCH_SLOTS - 1 ? "<" : ">=",
+	       i < BENCH_SLOTS - 1 ? bound : bound / 10,
+	       i < BENCH_SLOTS - 1 ? "," : "]");
+    for (k = 0; k < BENCH_KCOLS; k++) {
+	printf(",\"%s\":[", bench_kcols[k]);
+	for (i = 0; i < BENCH_SLOTS; i++)
+	    printf("%lu%s", histo[k][i], i < BENCH_SLOTS - 1 ? "," : "]");
+    }
+    printf("}");
+}
+
+static void report(BenchShared *shared, int clients, int seconds,
+		   unsigned long kernel[BENCH_KCOLS][BENCH_SLOTS])
+{
+    static unsigned long total[BENCH_STEPS][BENCH_BUCKETS];
+    unsigned long        count[BENCH_STEPS];
+    unsigned long        iterations = 0;
+    unsigned long        repeats    = 0;
+    unsigned long        least = 0;
+    unsigned long        most  = 0;
+    double               sum   = 0;
+    double               sum2  = 0;
+    double               x;
+    BenchClient          *c;
+    int                  comma;
+    int                  i, s, b;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < clients; i++) {
+	c = &shared->client[i];
+	iterations += c->iterations;
+	for (s = 0; s < BENCH_STEPS; s++) {
+	    count[s] += c->count[s];
+	    for (b = 0; b < BENCH_BUCKETS; b++) total[s][b] += c->histo[s][b];
+	}
+	repeats += c->repeats;
+	x     = c->count[BENCH_LOCK];
+	sum  += x;
+	sum2 += x * x;
+	if (!i || c->count[BENCH_LOCK] < least) least = c->count[BENCH_LOCK];
+	if (c->count[BENCH_LOCK] > most) most = c->count[BENCH_LOCK];
+    }
+
+    printf("{\"mode\":\"%s\",\"clients\":%d,\"seconds\":%d,"
+	   "\"lock\":\"%s\",\"pinned\":%s,",
+	   bench_pingpong ? "pingpong" : "load", clients, seconds,
+	   bench_ioctl ? "ioctl" : "fast", bench_pin ? "true" : "false");
+    printf("\"hold_us\":%d,\"gap_us\":%d,\"send\":%s,",
+	   bench_hold, bench_gap, bench_send ? "true" : "false");
+    printf("\"iterations\":%lu,\"iterations_per_sec\":%.1f,",
+	   iterations, (double)iterations / seconds);
+    if (bench_pingpong) printf("\"repeats\":%lu,", repeats);
+    printf("\"latency\":{");
+    for (s = 0, comma = 0; s < BENCH_STEPS; s++) {
+	if (!step_used(s)) continue;
+	if (comma++) printf(",");
+	print_latency(bench_names[s], total[s], count[s], 0);
+    }
+    printf("},\"fairness\":{\"jain\":%.4f,\"min_max\":%.4f},",
+	   sum2 ? sum * sum / (clients * sum2) : 0,
+	   most ? (double)least / most : 0);
+    if (kernel) print_kernel(kernel);
+    else        printf("\"kernel\":null");
+    printf(",\"per_client\":[");
+    for (i = 0; i < clients; i++) {
+	c = &shared->client[i];
+	printf("{\"client\":%d,\"pid\":%d,\"cpu\":%d,\"iterations\":%lu,"
+	       "\"iterations_per_sec\":%.1f,\"error\":%d,",
+	       i, (int)c->pid, c->cpu, c->iterations,
+	       (double)c->iterations / seconds, c->error);
+	if (bench_pingpong) {
+	    printf("\"repeats\":%lu,", c->repeats);
+	    print_latency("handoff", c->histo[BENCH_HANDOFF],
+			  c->count[BENCH_HANDOFF], 1);
+	}
+	print_latency("lock", c->histo[BENCH_LOCK], c->count[BENCH_LOCK], 0);
+	printf("}%s", i < clients - 1 ? "," : "");
+    }
+    printf("]}\n");
+}
+
+/* Release every client without running, after a setup failure. */
+static void bench_abort(BenchShared *shared, int clients)
+{
+    int i;
+
+    for (i = 0; i < clients; i++) shared->client[i].authenticated = 1;
+    shared->deadline = 0;
+    shared->start    = 1;
+    for (i = 0; i < clients; i++) wait(NULL);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+	    "usage: %s [-o name | -O busid] [-n clients] [-t seconds]\n"
+	    "       [-b count,size] [-H usec] [-G usec] [-c switches]"
+	    " [-i] [-S] [-a] [-p]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    BenchShared   *shared;
+    drmBufInfoPtr info;
+    unsigned long before[BENCH_KCOLS][BENCH_SLOTS];
+    unsigned long after[BENCH_KCOLS][BENCH_SLOTS];
+    unsigned long (*kernel)[BENCH_SLOTS];
+    size_t        length;
+    char          *pt;
+    int           clients = BENCH_CLIENTS;
+    int           seconds = BENCH_SECONDS;
+    int           count   = 64;
+    int           fd;
+    int           ret;
+    int           i, k;
+    int           c;
+
+    while ((c = getopt(argc, argv, "o:O:n:t:b:H:G:c:iSap")) != EOF)
+	switch (c) {
+	case 'o': bench_name   = optarg;                          break;
+	case 'O': bench_busid  = optarg;                          break;
+	case 'n': clients      = strtol(optarg, NULL, 0);         break;
+	case 't': seconds      = strtol(optarg, NULL, 0);         break;
+	case 'H': bench_hold   = strtol(optarg, NULL, 0);         break;
+	case 'G': bench_gap    = strtol(optarg, NULL, 0);         break;
+	case 'c': bench_switch = strtol(optarg, NULL, 0);         break;
+	case 'i': bench_ioctl  = 1;                               break;
+	case 'S': bench_send   = 1;                               break;
+	case 'a': bench_pin    = 1;                               break;
+	case 'p': bench_pingpong = bench_pin = 1;                 break;
+	case 'b':
+	    count      = strtol(optarg, &pt, 0);
+	    bench_size = *pt ? strtol(pt + 1, NULL, 0) : bench_size;
+	    break;
+	default: usage(argv[0]);
+	}
+    if ((!bench_name && !bench_busid) || clients < 1 || clients > BENCH_MAX
+	|| seconds < 1 || count < 1 || bench_size < 1) usage(argv[0]);
+
+    if ((fd = bench_open()) < 0) {
+	drmError(fd, argv[0]);
+	return 1;
+    }
+    if ((ret = drmAddMap(fd, 0, getpagesize(), DRM_SHM, DRM_CONTAINS_LOCK,
+			 &bench_sarea))) {
+	drmError(ret, argv[0]);
+	return 1;
+    }
+    if ((info = drmGetBufInfo(fd))) {
+	drmFree(info->list);
+	drmFree(info);
+    } else if ((ret = drmAddBufs(fd, count, bench_size, 0, 0)) < 0) {
+	drmError(ret, argv[0]);
+	return 1;
+    }
+
+    length = sizeof(*shared) + (clients - 1) * sizeof(BenchClient);
+    if ((shared = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+	perror("mmap");
+	return 1;
+    }
+    memset(shared, 0, length);
+
+    for (i = 0; i < clients; i++) {
+	switch (fork()) {
+	case -1:
+	    perror("fork");
+	    bench_abort(shared, i);
+	    return 1;
+	case 0:  client(shared, i);
+	}
+    }
+
+				/* Authenticate each client, and start them
+                                   together once all are ready. */
+    for (i = 0; i < clients; i++) {
+	while (!shared->client[i].magic && !shared->client[i].ready)
+	    usleep(1000);
+	if (shared->client[i].magic) {
+	    if ((ret = drmAuthMagic(fd, shared->client[i].magic)))
+		shared->client[i].error = ret;
+	    shared->client[i].authenticated = 1;
+	}
+	while (!shared->client[i].ready) usleep(1000);
+	if (shared->client[i].error) {
+	    drmError(shared->client[i].error, argv[0]);
+	    bench_abort(shared, clients);
+	    return 1;
+	}
+    }
+    kernel = read_histo(fd, before) ? after : NULL;
+    shared->deadline = now() + seconds * 1000000000.0;
+    shared->start    = 1;
+    for (i = 0; i < clients; i++) wait(NULL);
+
+    if (kernel && read_histo(fd, after))
+	for (k = 0; k < BENCH_KCOLS; k++)
+	    for (i = 0; i < BENCH_SLOTS; i++) after[k][i] -= before[k][i];
+    else kernel = NULL;
+    report(shared, clients, seconds, kernel);
+    drmClose(fd);
+    return 0;
+}
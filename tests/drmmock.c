@@ -0,0 +1,944 @@
+/* drmmock.c -- Loopback DRM device for running libdrm without hardware
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This library stands in for the kernel DRM module, so that libdrm,
+ * drmstat and the benchmarks can be run and profiled on a machine with no
+ * supported card.  It is loaded with LD_PRELOAD, and interposes on open,
+ * close, ioctl, mmap and the few path calls that drmOpen makes:
+ *
+ *   LD_PRELOAD=./drmmock.so ./drmstat -o mock -v
+ *
+ * /dev/dri/card0 opens as a FIFO, so that context switch requests can be
+ * read, polled and delivered by SIGIO just as from the kernel.  Every
+ * process that opens the device shares its state -- maps, DMA buffers,
+ * contexts and the hardware lock -- through a POSIX shared memory object,
+ * and the lock waits on a futex as the kernel's lock queue does.  Maps
+ * and DMA buffers are backed by the same object, so a map added by one
+ * process can be mapped by another.
+ *
+ * These ioctls are implemented: VERSION, GET_UNIQUE, SET_UNIQUE,
+ * GET_MAGIC, AUTH_MAGIC, IRQ_BUSID, BLOCK, UNBLOCK, CONTROL, ADD_MAP,
+ * ADD_BUFS, MARK_BUFS, INFO_BUFS, MAP_BUFS, FREE_BUFS, the context calls,
+ * ADD_DRAW, RM_DRAW, DMA, LOCK, UNLOCK, FINISH and EVENT_MODE.  The AGP
+ * and driver-specific ioctls fail with EINVAL, as on a kernel built
+ * without them.  Each ioctl makes one real system call, so that the cost
+ * of a round trip into the kernel is still counted.
+ *
+ * The environment configures the device:
+ *
+ *   DRM_MOCK_SHM      name of the shared state (default /drmmock); the
+ *                     event FIFO is /tmp<name>.events
+ *   DRM_MOCK_RESET    if set, discard any existing state
+ *   DRM_MOCK_DRIVER   driver name (default mock)
+ *   DRM_MOCK_BUSID    initial bus id (default PCI:1:0:0; empty for none)
+ *   DRM_MOCK_SIZE     bytes of shared memory for maps and buffers
+ *                     (default 64MB)
+ *   DRM_MOCK_LATENCY  microseconds from sending a DMA buffer until the
+ *                     simulated hardware completes it and it is free
+ *                     again (default 0)
+ *   DRM_MOCK_STATS    if set, print the ioctl counts at exit
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "drm.h"
+
+#define MOCK_MAGIC     0x4d4f434bLU
+#define MOCK_CARDS     1	/* Minors that open */
+#define MOCK_DEV       0x9100	/* makedev(DRM_FIXED_DEVICE_MAJOR, 0) */
+#define MOCK_FDS       1024
+#define MOCK_MAPS      64
+#define MOCK_BUFS      4096
+#define MOCK_CTXS      256
+#define MOCK_UNIQUE    64
+#define MOCK_HANDLE    0x40000000UL /* Handles of SHM maps start here */
+#define MOCK_SIZE      (64 << 20)
+#define MOCK_KERNEL_CONTEXT    0 /* As in drmP.h */
+#define MOCK_RESERVED_CONTEXTS 1
+
+#define MOCK_FREE      0	/* Buffer states */
+#define MOCK_CLIENT    1	/* Held by a process */
+#define MOCK_QUEUED    2	/* Sent, until done */
+
+typedef struct MockMap {
+    unsigned long   offset;	/* The mmap offset clients use */
+    unsigned long   size;
+    unsigned long   shm;	/* Offset in the shared object */
+    int             type;
+    int             flags;
+} MockMap;
+
+typedef struct MockBuf {
+    int             order;
+    int             state;
+    pid_t           pid;
+    int             context;
+    unsigned long   shm;
+    double          done;	/* usec; when a queued buffer completes */
+} MockBuf;
+
+typedef struct MockDesc {
+    int             count;
+    int             low_mark;
+    int             high_mark;
+} MockDesc;
+
+typedef struct MockState {
+    unsigned long   magic;
+    pthread_mutex_t mutex;	/* Process-shared, robust */
+    unsigned long   size;
+    unsigned long   heap;	/* Next free offset */
+    char            unique[MOCK_UNIQUE];
+    int             unique_len;
+    unsigned int    next_magic;
+    unsigned int    next_drawable;
+    int             map_count;
+    MockMap         maps[MOCK_MAPS];
+    unsigned long   lock_shm;	/* Offset of the hardware lock */
+    unsigned int    lock;	/* The lock until a SAREA is added */
+    int             buf_count;
+    int             buf_mapped;
+    MockBuf         bufs[MOCK_BUFS];
+    MockDesc        desc[DRM_MAX_ORDER + 1];
+    unsigned char   ctx_used[MOCK_CTXS];
+    int             ctx_flags[MOCK_CTXS];
+    int             last_context;
+    int             event_format;
+    unsigned int    event_sequence;
+    unsigned long   ioctls[0x40];
+    unsigned long   lock_waits;
+    unsigned long   buf_waits;
+} MockState;
+
+static int   (*real_open)(const char *, int, ...);
+static int   (*real_close)(int);
+static int   (*real_ioctl)(int, unsigned long, ...);
+static void  *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int   (*real_access)(const char *, int);
+static int   (*real_stat)(const char *, struct stat *);
+
+static pthread_once_t mock_syms = PTHREAD_ONCE_INIT;
+static pthread_once_t mock_once = PTHREAD_ONCE_INIT;
+static MockState      *mock;	/* NULL if the state cannot be created */
+static char           *mock_base;
+static int            mock_shm  = -1;
+static int            mock_post = -1; /* Write end of the event FIFO */
+static char           mock_fifo[256];
+static char           mock_driver[64];
+static double         mock_latency;
+static char           mock_fd[MOCK_FDS];
+
+static void mock_report(void)
+{
+    int i;
+
+    if (!mock) return;
+				/* Totals for the device, from every
+                                   process that has used it. */
+    fprintf(stderr, "drmmock: at exit of %d: %lu lock waits,"
+	    " %lu buffer waits\n", getpid(), mock->lock_waits,
+	    mock->buf_waits);
+    for (i = 0; i < 0x40; i++)
+	if (mock->ioctls[i])
+	    fprintf(stderr, "drmmock:   ioctl 0x%02x: %lu\n",
+		    i, mock->ioctls[i]);
+}
+
+static void mock_create(MockState *state, unsigned long size)
+{
+    pthread_mutexattr_t attr;
+    const char          *busid = getenv("DRM_MOCK_BUSID");
+
+    if (!busid) busid = "PCI:1:0:0";
+    memset(state, 0, sizeof(*state));
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&state->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    state->size       = size;
+    state->heap       = (sizeof(*state) + getpagesize() - 1)
+			& ~(getpagesize() - 1);
+    state->unique_len = strlen(busid) < MOCK_UNIQUE ? strlen(busid) : 0;
+    memcpy(state->unique, busid, state->unique_len);
+    state->next_magic    = 1;
+    state->next_drawable = 1;
+    state->lock_shm      = (char *)&state->lock - (char *)state;
+    __sync_synchronize();
+    state->magic = MOCK_MAGIC;
+}
+
+static void mock_lookup(void)
+{
+    *(void **)&real_open   = dlsym(RTLD_NEXT, "open");
+    *(void **)&real_close  = dlsym(RTLD_NEXT, "close");
+    *(void **)&real_ioctl  = dlsym(RTLD_NEXT, "ioctl");
+    *(void **)&real_mmap   = dlsym(RTLD_NEXT, "mmap");
+    *(void **)&real_access = dlsym(RTLD_NEXT, "access");
+    *(void **)&real_stat   = dlsym(RTLD_NEXT, "stat");
+}
+
+static void mock_symbols(void)
+{
+    pthread_once(&mock_syms, mock_lookup);
+}
+
+/* Attach to the shared state, creating it if this is the first process.
+   Only done when a device path is used, so that other programs that
+   inherit LD_PRELOAD are not affected. */
+static void mock_init(void)
+{
+    const char    *name = getenv("DRM_MOCK_SHM");
+    const char    *pt;
+    unsigned long size  = MOCK_SIZE;
+    struct stat   st;
+    int           created = 0;
+    int           i;
+
+    mock_symbols();
+    if (!name) name = "/drmmock";
+    if ((pt = getenv("DRM_MOCK_SIZE"))) size = strtoul(pt, NULL, 0);
+    if ((pt = getenv("DRM_MOCK_LATENCY"))) mock_latency = atof(pt);
+    pt = getenv("DRM_MOCK_DRIVER");
+    snprintf(mock_driver, sizeof(mock_driver), "%s", pt ? pt : "mock");
+    snprintf(mock_fifo, sizeof(mock_fifo), "/tmp%s.events", name);
+    if (getenv("DRM_MOCK_RESET")) {
+	shm_unlink(name);
+	unlink(mock_fifo);
+    }
+
+    if ((mock_shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+	if (ftruncate(mock_shm, size)) {
+	    shm_unlink(name);
+	    return;
+	}
+	created = 1;
+    } else if ((mock_shm = shm_open(name, O_RDWR, 0)) < 0) {
+	return;
+    }
+    if (fstat(mock_shm, &st)) return;
+    size = st.st_size ? st.st_size : size;
+    if ((mock_base = real_mmap(NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, mock_shm, 0)) == MAP_FAILED)
+	return;
+    if (created) {
+	mkfifo(mock_fifo, 0600);
+	mock_create((MockState *)mock_base, size);
+    } else {			/* Wait for the creator */
+	for (i = 0; i < 1000
+		 && ((MockState *)mock_base)->magic != MOCK_MAGIC; i++)
+	    usleep(1000);
+	if (((MockState *)mock_base)->magic != MOCK_MAGIC) return;
+    }
+    mock_post = real_open(mock_fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    mock      = (MockState *)mock_base;
+    if (getenv("DRM_MOCK_STATS")) atexit(mock_report);
+}
+
+static int mock_ready(void)
+{
+    pthread_once(&mock_once, mock_init);
+    return mock != NULL;
+}
+
+static void mock_lock(void)
+{
+    if (pthread_mutex_lock(&mock->mutex) == EOWNERDEAD)
+	pthread_mutex_consistent(&mock->mutex);
+}
+
+static void mock_unlock(void)
+{
+    pthread_mutex_unlock(&mock->mutex);
+}
+
+static double mock_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void mock_sleep(double usec)
+{
+    struct timespec ts;
+
+    if (usec < 1) usec = 1;
+    ts.tv_sec  = usec / 1000000;
+    ts.tv_nsec = (usec - ts.tv_sec * 1000000.0) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+/* Return "/dev/dri/cardN" or "/proc/dri/N..." minor N, or -1. */
+static int mock_minor(const char *path, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    int    minor;
+
+    if (strncmp(path, prefix, len)) return -1;
+    if (path[len] < '0' || path[len] > '9') return -1;
+    minor = path[len] - '0';
+    return minor < MOCK_CARDS ? minor : -1;
+}
+
+static unsigned long mock_alloc(unsigned long size)
+{
+    unsigned long page = getpagesize();
+    unsigned long off;
+
+    size = (size + page - 1) & ~(page - 1);
+    if (mock->heap + size > mock->size) return 0;
+    off         = mock->heap;
+    mock->heap += size;
+    return off;
+}
+
+static void mock_event(int oldctx, int newctx)
+{
+    drm_ctx_event_t event;
+    struct timeval  tv;
+    char            buf[64];
+
+    gettimeofday(&tv, NULL);
+    ++mock->event_sequence;
+    if (mock_post < 0) return;
+    if (mock->event_format == _DRM_EVENT_BINARY) {
+	event.type     = _DRM_EVENT_CONTEXT;
+	event.sequence = mock->event_sequence;
+	event.old      = oldctx;
+	event.new      = newctx;
+	event.tv_sec   = tv.tv_sec;
+	event.tv_usec  = tv.tv_usec;
+	if (write(mock_post, &event, sizeof(event)) < 0) return;
+    } else {
+	sprintf(buf, "C %d %d\n", oldctx, newctx);
+	if (write(mock_post, buf, strlen(buf)) < 0) return;
+    }
+}
+
+/* Complete queued buffers whose time has come.  Returns when the next
+   one completes, or 0 if none is queued. */
+static double mock_reap(double now)
+{
+    double next = 0;
+    int    i;
+
+    for (i = 0; i < mock->buf_count; i++) {
+	if (mock->bufs[i].state != MOCK_QUEUED) continue;
+	if (mock->bufs[i].done <= now) {
+	    mock->bufs[i].state = MOCK_FREE;
+	    mock->bufs[i].pid   = 0;
+	} else if (!next || mock->bufs[i].done < next) {
+	    next = mock->bufs[i].done;
+	}
+    }
+    return next;
+}
+
+static void mock_quiesce(void)
+{
+    double next;
+    double now;
+
+    for (;;) {
+	mock_lock();
+	now  = mock_now();
+	next = mock_reap(now);
+	mock_unlock();
+	if (!next) return;
+	mock_sleep(next - now);
+    }
+}
+
+static unsigned int *mock_hw_lock(void)
+{
+    return (unsigned int *)(mock_base + mock->lock_shm);
+}
+
+static int mock_futex(unsigned int *addr, int op, unsigned int val,
+		      const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* As drm_lock_take, but wait on the lock word itself rather than a
+   kernel queue: a waiter marks the lock contended, so that the holder's
+   unlock comes through DRM_IOCTL_UNLOCK and wakes it. */
+static int mock_take(drm_lock_t *lock)
+{
+    volatile unsigned int *word = mock_hw_lock();
+    struct timespec       timeout;
+    unsigned int          old;
+    unsigned int          new;
+
+    if (lock->context == MOCK_KERNEL_CONTEXT) return -EINVAL;
+    timeout.tv_sec  = 0;
+    timeout.tv_nsec = 10000000;
+    for (;;) {
+	old = *word;
+	if (old & _DRM_LOCK_HELD) new = old | _DRM_LOCK_CONT;
+	else                      new = lock->context | _DRM_LOCK_HELD;
+	if (!__sync_bool_compare_and_swap(word, old, new)) continue;
+	if (!(old & _DRM_LOCK_HELD)) break;
+	if (_DRM_LOCKING_CONTEXT(old) == (unsigned int)lock->context)
+	    break;		/* Already held; the kernel complains */
+	__sync_fetch_and_add(&mock->lock_waits, 1);
+	mock_futex((unsigned int *)word, FUTEX_WAIT, new, &timeout);
+    }
+    if (lock->flags & _DRM_LOCK_QUIESCENT) mock_quiesce();
+    return 0;
+}
+
+static int mock_free_lock(drm_lock_t *lock)
+{
+    volatile unsigned int *word = mock_hw_lock();
+
+    if (lock->context == MOCK_KERNEL_CONTEXT) return -EINVAL;
+    __sync_lock_test_and_set(word, 0);
+    mock_futex((unsigned int *)word, FUTEX_WAKE, 0x7fffffff, NULL);
+    return 0;
+}
+
+static int mock_copy(char *to, size_t *len, const char *from, size_t size)
+{
+    if (*len && to) memcpy(to, from, *len < size ? *len : size);
+    *len = size;
+    return 0;
+}
+
+static int mock_order(int size)
+{
+    int order;
+
+    for (order = DRM_MIN_ORDER; order < DRM_MAX_ORDER && (1 << order) < size;
+	 order++);
+    return order;
+}
+
+static int mock_add_map(drm_map_t *map)
+{
+    MockMap       *m;
+    unsigned long shm;
+
+    if (mock->map_count == MOCK_MAPS) return -ENOMEM;
+    if (!map->size || !(shm = mock_alloc(map->size))) return -ENOMEM;
+    m        = &mock->maps[mock->map_count];
+    m->shm   = shm;
+    m->size  = map->size;
+    m->type  = map->type;
+    m->flags = map->flags;
+    if (map->type == _DRM_SHM) {
+	m->offset = MOCK_HANDLE + shm;
+	if (map->flags & _DRM_CONTAINS_LOCK) {
+				/* As the kernel does, the first SAREA holds
+                                   the lock; keep its current value. */
+	    *(unsigned int *)(mock_base + shm) = *mock_hw_lock();
+	    mock->lock_shm = shm;
+	}
+    } else {
+	m->offset = map->offset;
+    }
+    map->handle = (void *)m->offset;
+    map->offset = m->offset;
+    ++mock->map_count;
+    return 0;
+}
+
+static int mock_add_bufs(drm_buf_desc_t *request)
+{
+    int           order = mock_order(request->size);
+    int           count;
+    unsigned long shm;
+
+    if (mock->buf_mapped) return -EBUSY;
+    if (request->count < 0 || order > DRM_MAX_ORDER) return -EINVAL;
+    if (mock->desc[order].count) return -ENOMEM; /* One call per order */
+    for (count = 0; count < request->count; count++) {
+	if (mock->buf_count == MOCK_BUFS
+	    || !(shm = mock_alloc(1 << order))) break;
+	mock->bufs[mock->buf_count].order = order;
+	mock->bufs[mock->buf_count].state = MOCK_FREE;
+	mock->bufs[mock->buf_count].shm   = shm;
+	++mock->buf_count;
+    }
+    mock->desc[order].count = count;
+    request->count          = count;
+    request->size           = 1 << order;
+    return count ? 0 : -ENOMEM;
+}
+
+static int mock_info_bufs(drm_buf_info_t *request)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0; i <= DRM_MAX_ORDER; i++) if (mock->desc[i].count) ++count;
+    if (request->count >= count) {
+	for (i = 0, count = 0; i <= DRM_MAX_ORDER; i++) {
+	    if (!mock->desc[i].count) continue;
+	    request->list[count].count     = mock->desc[i].count;
+	    request->list[count].size      = 1 << i;
+	    request->list[count].low_mark  = mock->desc[i].low_mark;
+	    request->list[count].high_mark = mock->desc[i].high_mark;
+	    request->list[count].flags     = 0;
+	    ++count;
+	}
+    }
+    request->count = count;
+    return 0;
+}
+
+static int mock_map_bufs(drm_buf_map_t *request)
+{
+    unsigned long start;
+    unsigned long end;
+    char          *virtual;
+    int           i;
+
+    if (!mock->buf_count) return -EINVAL;
+    if (request->count >= mock->buf_count) {
+	start = mock->bufs[0].shm;
+	end   = mock->bufs[mock->buf_count - 1].shm
+		+ (1 << mock->bufs[mock->buf_count - 1].order);
+	if ((virtual = real_mmap(NULL, end - start, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, mock_shm, start)) == MAP_FAILED)
+	    return -errno;
+	mock->buf_mapped = 1;
+	request->virtual = virtual;
+	for (i = 0; i < mock->buf_count; i++) {
+	    request->list[i].idx     = i;
+	    request->list[i].total   = 1 << mock->bufs[i].order;
+	    request->list[i].used    = 0;
+	    request->list[i].address = virtual + mock->bufs[i].shm - start;
+	}
+    }
+    request->count = mock->buf_count;
+    return 0;
+}
+
+static int mock_free_bufs(drm_buf_free_t *request)
+{
+    int i;
+    int idx;
+
+    for (i = 0; i < request->count; i++) {
+	idx = request->list[i];
+	if (idx < 0 || idx >= mock->buf_count) return -EINVAL;
+	if (mock->bufs[idx].state != MOCK_CLIENT
+	    || mock->bufs[idx].pid != getpid()) return -EINVAL;
+	mock->bufs[idx].state = MOCK_FREE;
+	mock->bufs[idx].pid   = 0;
+    }
+    return 0;
+}
+
+/* Send, then grant.  A sent buffer is free again once DRM_MOCK_LATENCY
+   has passed; with _DRM_DMA_BLOCK the call waits for that. */
+static int mock_dma(drm_dma_t *d)
+{
+    double now = mock_now();
+    double next;
+    double last = 0;
+    int    order;
+    int    i;
+    int    idx;
+
+    for (i = 0; i < d->send_count; i++) {
+	idx = d->send_indices[i];
+	if (idx < 0 || idx >= mock->buf_count) return -EINVAL;
+	if (mock->bufs[idx].state != MOCK_CLIENT
+	    || mock->bufs[idx].pid != getpid()) return -EINVAL;
+    }
+    for (i = 0; i < d->send_count; i++) {
+	idx = d->send_indices[i];
+	if (d->context != mock->last_context) {
+	    mock_event(mock->last_context, d->context);
+	    mock->last_context = d->context;
+	}
+	mock->bufs[idx].state   = MOCK_QUEUED;
+	mock->bufs[idx].context = d->context;
+	mock->bufs[idx].done    = last = now + mock_latency;
+    }
+
+    d->granted_count = 0;
+    if (d->request_count) {
+	order = mock_order(d->request_size);
+	while (order <= DRM_MAX_ORDER && !mock->desc[order].count
+	       && (d->flags & _DRM_DMA_LARGER_OK)) ++order;
+	for (;;) {
+	    next = mock_reap(mock_now());
+	    for (i = 0; i < mock->buf_count
+		     && d->granted_count < d->request_count; i++) {
+		if (mock->bufs[i].order != order
+		    || mock->bufs[i].state != MOCK_FREE) continue;
+		mock->bufs[i].state = MOCK_CLIENT;
+		mock->bufs[i].pid   = getpid();
+		d->request_indices[d->granted_count] = i;
+		d->request_sizes[d->granted_count]   = 1 << order;
+		++d->granted_count;
+	    }
+	    if (d->granted_count || !(d->flags & _DRM_DMA_WAIT)) break;
+	    if (!mock->desc[order < DRM_MAX_ORDER ? order : DRM_MAX_ORDER]
+		.count) return -EINVAL;
+	    ++mock->buf_waits;
+	    mock_unlock();	/* Wait for a completion, or a free */
+	    mock_sleep(next ? next - mock_now() : 100);
+	    mock_lock();
+	}
+    }
+
+    if ((d->flags & _DRM_DMA_BLOCK) && last) {
+	mock_unlock();
+	mock_sleep(last - mock_now());
+	mock_lock();
+	mock_reap(mock_now());
+    }
+    return 0;
+}
+
+static int mock_add_ctx(drm_ctx_t *ctx)
+{
+    int i;
+
+    for (i = MOCK_RESERVED_CONTEXTS; i < MOCK_CTXS; i++) {
+	if (!mock->ctx_used[i]) {
+	    mock->ctx_used[i]  = 1;
+	    mock->ctx_flags[i] = 0;
+	    ctx->handle        = i;
+	    return 0;
+	}
+    }
+    return -ENOMEM;
+}
+
+static int mock_ioctl(int fd, unsigned long request, void *arg)
+{
+    drm_version_t   *version = arg;
+    drm_unique_t    *unique  = arg;
+    drm_auth_t      *auth    = arg;
+    drm_irq_busid_t *irq     = arg;
+    drm_ctx_t       *ctx     = arg;
+    drm_ctx_res_t   *res     = arg;
+    drm_draw_t      *draw    = arg;
+    drm_buf_desc_t  *desc    = arg;
+    drm_event_mode_t *mode   = arg;
+    int             nr       = _IOC_NR(request);
+    int             ret      = 0;
+    int             i;
+
+    syscall(SYS_getppid);	/* The cost of entering the kernel */
+    if (_IOC_TYPE(request) != DRM_IOCTL_BASE || nr >= 0x40) {
+	errno = EINVAL;
+	return -1;
+    }
+
+				/* The lock calls wait without the mutex */
+    if (request == DRM_IOCTL_LOCK) {
+	__sync_fetch_and_add(&mock->ioctls[nr], 1);
+	ret = mock_take(arg);
+    } else if (request == DRM_IOCTL_UNLOCK) {
+	__sync_fetch_and_add(&mock->ioctls[nr], 1);
+	ret = mock_free_lock(arg);
+    } else if (request == DRM_IOCTL_FINISH) {
+	__sync_fetch_and_add(&mock->ioctls[nr], 1);
+	mock_quiesce();
+    } else {
+	mock_lock();
+	++mock->ioctls[nr];
+	switch (request) {
+	case DRM_IOCTL_VERSION:
+	    version->version_major      = 1;
+	    version->version_minor      = 0;
+	    version->version_patchlevel = 0;
+	    mock_copy(version->name, &version->name_len,
+		      mock_driver, strlen(mock_driver));
+	    mock_copy(version->date, &version->date_len, "20001017", 8);
+	    mock_copy(version->desc, &version->desc_len,
+		      "Loopback mock device", 20);
+	    break;
+	case DRM_IOCTL_GET_UNIQUE:
+	    mock_copy(unique->unique, &unique->unique_len,
+		      mock->unique, mock->unique_len);
+	    break;
+	case DRM_IOCTL_SET_UNIQUE:
+	    if (mock->unique_len) ret = -EBUSY;
+	    else if (!unique->unique_len
+		     || unique->unique_len >= MOCK_UNIQUE) ret = -EINVAL;
+	    else {
+		memcpy(mock->unique, unique->unique, unique->unique_len);
+		mock->unique_len = unique->unique_len;
+	    }
+	    break;
+	case DRM_IOCTL_GET_MAGIC:
+	    auth->magic = mock->next_magic++;
+	    break;
+	case DRM_IOCTL_AUTH_MAGIC:
+	    if (!auth->magic || auth->magic >= mock->next_magic)
+		ret = -EINVAL;
+	    break;
+	case DRM_IOCTL_IRQ_BUSID:
+	    irq->irq = 0;
+	    break;
+	case DRM_IOCTL_BLOCK:
+	case DRM_IOCTL_UNBLOCK:
+	case DRM_IOCTL_CONTROL:
+	    break;
+	case DRM_IOCTL_ADD_MAP:
+	    ret = mock_add_map(arg);
+	    break;
+	case DRM_IOCTL_ADD_BUFS:
+	    ret = mock_add_bufs(arg);
+	    break;
+	case DRM_IOCTL_MARK_BUFS:
+	    i = mock_order(desc->size);
+	    if (i > DRM_MAX_ORDER || !mock->desc[i].count) ret = -EINVAL;
+	    else {
+		mock->desc[i].low_mark  = desc->low_mark;
+		mock->desc[i].high_mark = desc->high_mark;
+	    }
+	    break;
+	case DRM_IOCTL_INFO_BUFS:
+	    ret = mock_info_bufs(arg);
+	    break;
+	case DRM_IOCTL_MAP_BUFS:
+	    ret = mock_map_bufs(arg);
+	    break;
+	case DRM_IOCTL_FREE_BUFS:
+	    ret = mock_free_bufs(arg);
+	    break;
+	case DRM_IOCTL_DMA:
+	    ret = mock_dma(arg);
+	    break;
+	case DRM_IOCTL_ADD_CTX:
+	    ret = mock_add_ctx(ctx);
+	    break;
+	case DRM_IOCTL_RM_CTX:
+	    if (ctx->handle >= MOCK_CTXS) ret = -EINVAL;
+	    else if (ctx->handle >= MOCK_RESERVED_CONTEXTS)
+		mock->ctx_used[ctx->handle] = 0;
+	    break;
+	case DRM_IOCTL_MOD_CTX:
+	    if (ctx->handle >= MOCK_CTXS) ret = -EINVAL;
+	    else mock->ctx_flags[ctx->handle] = ctx->flags;
+	    break;
+	case DRM_IOCTL_GET_CTX:
+	    if (ctx->handle >= MOCK_CTXS) ret = -EINVAL;
+	    else ctx->flags = mock->ctx_flags[ctx->handle];
+	    break;
+	case DRM_IOCTL_SWITCH_CTX:
+	    mock_event(mock->last_context, ctx->handle);
+	    break;
+	case DRM_IOCTL_NEW_CTX:
+	    mock->last_context = ctx->handle;
+	    break;
+	case DRM_IOCTL_RES_CTX:
+	    if (res->count >= MOCK_RESERVED_CONTEXTS) {
+		for (i = 0; i < MOCK_RESERVED_CONTEXTS; i++) {
+		    res->contexts[i].handle = i;
+		    res->contexts[i].flags  = 0;
+		}
+	    }
+	    res->count = MOCK_RESERVED_CONTEXTS;
+	    break;
+	case DRM_IOCTL_ADD_DRAW:
+	    draw->handle = mock->next_drawable++;
+	    break;
+	case DRM_IOCTL_RM_DRAW:
+	    break;
+	case DRM_IOCTL_EVENT_MODE:
+	    if (mode->format != _DRM_EVENT_TEXT
+		&& mode->format != _DRM_EVENT_BINARY) ret = -EINVAL;
+	    else mock->event_format = mode->format;
+	    break;
+	default:
+	    ret = -EINVAL;
+	    break;
+	}
+	mock_unlock();
+    }
+    if (ret) {
+	errno = -ret;
+	return -1;
+    }
+    return 0;
+}
+
+/* /proc/dri/N/name reads "name dev [busid]", as from the kernel. */
+static int mock_proc_name(int minor)
+{
+    char buf[256];
+    int  fds[2];
+    int  len;
+
+    if (pipe(fds)) return -1;
+    mock_lock();
+    len = snprintf(buf, sizeof(buf), "%s 0x%x%s%.*s\n", mock_driver,
+		   MOCK_DEV + minor, mock->unique_len ? " " : "",
+		   mock->unique_len, mock->unique);
+    mock_unlock();
+    if (write(fds[1], buf, len) != len) {
+	real_close(fds[0]);
+	fds[0] = -1;
+    }
+    real_close(fds[1]);
+    return fds[0];
+}
+
+static int mock_open(const char *path, int flags, mode_t mode)
+{
+    int minor;
+    int fd;
+
+    mock_symbols();
+    if ((minor = mock_minor(path, "/proc/dri/")) >= 0
+	&& !strcmp(path + strlen("/proc/dri/0"), "/name") && mock_ready())
+	return mock_proc_name(minor);
+    if (mock_minor(path, "/dev/dri/card") >= 0
+	&& !path[strlen("/dev/dri/card0")] && mock_ready()) {
+	if ((fd = real_open(mock_fifo, O_RDWR)) >= 0 && fd < MOCK_FDS)
+	    mock_fd[fd] = 1;
+	return fd;
+    }
+    return real_open(path, flags, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t  mode = 0;
+
+    if (flags & O_CREAT) {
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+    }
+    return mock_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t  mode = 0;
+
+    if (flags & O_CREAT) {
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+    }
+    return mock_open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+    mock_symbols();
+    if (fd >= 0 && fd < MOCK_FDS) mock_fd[fd] = 0;
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    void    *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    if (fd >= 0 && fd < MOCK_FDS && mock_fd[fd])
+	return mock_ioctl(fd, request, arg);
+    mock_symbols();
+    return real_ioctl(fd, request, arg);
+}
+
+/* Map a map's backing; the offset is the handle drmAddMap returned. */
+void *mmap(void *addr, size_t length, int prot, int flags, int fd,
+	   off_t offset)
+{
+    MockMap *m;
+    int     i;
+
+    mock_symbols();
+    if (fd < 0 || fd >= MOCK_FDS || !mock_fd[fd])
+	return real_mmap(addr, length, prot, flags, fd, offset);
+
+    mock_lock();
+    for (i = 0, m = NULL; i < mock->map_count; i++)
+	if (mock->maps[i].offset == (unsigned long)offset) m = &mock->maps[i];
+    mock_unlock();
+    if (!m || length > m->size) {
+	errno = EINVAL;
+	return MAP_FAILED;
+    }
+    return real_mmap(addr, length, prot, flags, mock_shm, m->shm);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd,
+	     off_t offset)
+{
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+int access(const char *path, int mode)
+{
+    mock_symbols();
+    if (mock_minor(path, "/proc/dri/") >= 0 && mock_ready()) return 0;
+    return real_access(path, mode);
+}
+
+/* drmOpenDevice checks that the node is the device it expects. */
+int stat(const char *path, struct stat *st)
+{
+    int minor;
+
+    mock_symbols();
+    if ((minor = mock_minor(path, "/dev/dri/card")) >= 0
+	&& !path[strlen("/dev/dri/card0")] && mock_ready()) {
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFCHR | 0666;
+	st->st_rdev = MOCK_DEV + minor;
+	return 0;
+    }
+    return real_stat(path, st);
+}
@@ -110,7 +110,7 @@ int main(int argc, char **argv)
     int            secs;
 
     while ((c = getopt(argc, argv,
-		       "lc:vo:O:f:s:w:W:b:r:R:P:L:C:XS:B:F:")) != EOF)
+		       "lc:vo:O:f:s:w:W:b:M:r:R:P:L:K:C:XS:B:F:D:Q:")) != EOF)
 	switch (c) {
 	case 'F':
 	    count  = strtoul(optarg, NULL, 0);
@@ -158,7 +158,8 @@ int main(int argc, char **argv)
 	case 'B':		/* Test buffer allocation */
 	    count  = strtoul(optarg, &pt, 0);
 	    size   = strtoul(pt+1, &pt, 0);
-	    secs   = strtoul(pt+1, NULL, 0);
+	    secs   = strtoul(pt+1, &pt, 0);
+	    loops  = *pt ? strtoul(pt+1, NULL, 0) : 0;
 	    {
 		drmDMAReq      dma;
 		int            *indices, *sizes;
@@ -183,6 +184,60 @@ int main(int argc, char **argv)
 		sleep(secs);
 		drmFreeBufs(fd, dma.granted_count, indices);
 	    }
+	    if (loops) {		/* Per-buffer ioctls vs. drmBufPool */
+		struct timeval  start, end;
+		drmDMAReq       dma;
+		drmBufPoolStats stats;
+		void            *pool;
+		int             *indices, idx, sz, j;
+
+		indices = alloca(sizeof(*indices) * count);
+		dma.context         = context;
+		dma.send_count      = 0;
+		dma.request_count   = 1;
+		dma.request_size    = size;
+		dma.request_sizes   = &sz;
+		dma.flags           = DRM_DMA_WAIT;
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    for (j = 0; j < count; j++) {
+			dma.request_list = &indices[j];
+			if ((r = drmDMA(fd, &dma))) {
+			    drmError(r, argv[0]);
+			    return 1;
+			}
+		    }
+		    for (j = 0; j < count; j++) drmFreeBufs(fd, 1, &indices[j]);
+		}
+		gettimeofday(&end, NULL);
+		printf( "ioctl: %.3f usec per get/put\n",
+			usec(&end, &start) / (loops * count));
+
+		if (!(pool = drmBufPoolCreate(fd, context, size,
+					      count, count, 2 * count))) {
+		    drmError(0, argv[0]);
+		    return 1;
+		}
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    for (j = 0; j < count; j++) {
+			if ((idx = drmBufPoolGet(pool)) < 0) {
+			    drmError(idx, argv[0]);
+			    return 1;
+			}
+			indices[j] = idx;
+		    }
+		    for (j = 0; j < count; j++) drmBufPoolPut(pool, indices[j]);
+		}
+		gettimeofday(&end, NULL);
+		printf( "pool:  %.3f usec per get/put\n",
+			usec(&end, &start) / (loops * count));
+		drmBufPoolGetStats(pool, &stats);
+		printf( "%lu gets, %.1f%% hits, %lu ioctls, %lu saved\n",
+			stats.gets, 100.0 * stats.hits / stats.gets,
+			stats.dma_ioctls + stats.free_ioctls, stats.saved);
+		drmBufPoolDestroy(pool);
+	    }
 	    break;
 	case 'b':
 	    count   = strtoul(optarg, &pt, 0);
@@ -238,6 +293,33 @@ int main(int argc, char **argv)
 	    system(buf);
 #endif
 	    break;
+	case 'M':		/* Time mapping and first touch of buffers;
+				   flags: 1 prefault, 2 large pages */
+	    {
+		struct timeval start, mapped, touched;
+		volatile char  *page;
+		int            flags = strtoul(optarg, NULL, 0);
+		int            j;
+
+		gettimeofday(&start, NULL);
+		if (!(bufs = drmMapBufsFlags(fd, flags))) {
+		    drmError(0, argv[0]);
+		    return 1;
+		}
+		gettimeofday(&mapped, NULL);
+		for (i = 0; i < bufs->count; i++)
+		    for (page = bufs->list[i].address, j = 0;
+			 j < bufs->list[i].total;
+			 j += getpagesize())
+			(void)page[j];
+		gettimeofday(&touched, NULL);
+		printf( "%d bufs, flags 0x%x: map %.0f usec,"
+			" first touch %.0f usec\n",
+			bufs->count, flags,
+			usec(&mapped, &start), usec(&touched, &mapped));
+		drmFreeBufMap(bufs);
+	    }
+	    break;
 	case 'f':
 	    offset  = strtoul(optarg, &pt, 0);
 	    size    = strtoul(pt+1, NULL, 0);
@@ -407,6 +489,148 @@ int main(int argc, char **argv)
 	    printf( "unlock: 0x%08x\n", lock->lock);
 #endif
 	    break;
+	case 'K':		/* Uncontended lock/unlock cost */
+	    context = strtoul(optarg, &pt, 0);
+	    offset  = strtoul(pt+1, &pt, 0);
+	    size    = strtoul(pt+1, &pt, 0);
+	    loops   = strtoul(pt+1, NULL, 0);
+	    address = NULL;
+	    if ((r = drmMap(fd, offset, size, &address))) {
+		drmError(r, argv[0]);
+		return 1;
+	    }
+	    lock       = address;
+	    {
+		struct timeval start, end;
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    drmGetLock(fd, context, 0);
+		    drmUnlock(fd, context);
+		}
+		gettimeofday(&end, NULL);
+		printf( "ioctl:   %.3f usec per lock/unlock\n",
+			usec(&end, &start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    drmGetLockFast(fd, lock, context, 0);
+		    drmUnlockFast(fd, lock, context);
+		}
+		gettimeofday(&end, NULL);
+		printf( "fast:    %.3f usec per lock/unlock\n",
+			usec(&end, &start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    drmGetLockTimeout(fd, lock, context, 0, 1000);
+		    drmUnlockFast(fd, lock, context);
+		}
+		gettimeofday(&end, NULL);
+		printf( "timeout: %.3f usec per lock/unlock\n",
+			usec(&end, &start) / loops);
+	    }
+	    break;
+	case 'D':		/* Per-buffer sends vs. drmDMABatch */
+	    count   = strtoul(optarg, &pt, 0);
+	    size    = strtoul(pt+1, &pt, 0);
+	    secs    = strtoul(pt+1, &pt, 0);
+	    loops   = strtoul(pt+1, NULL, 0);
+	    {
+		struct timeval   start, end;
+		drmDMAReq        dma;
+		drmDMABatchStats stats;
+		drmBufPoolStats  pstats;
+		void             *batch, *pool;
+		int              idx, sz;
+
+		dma.context         = context;
+		dma.send_count      = 0;
+		dma.request_count   = 1;
+		dma.request_size    = size;
+		dma.request_list    = &idx;
+		dma.request_sizes   = &sz;
+		dma.flags           = DRM_DMA_WAIT;
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    if ((r = drmDMA(fd, &dma))) {
+			drmError(r, argv[0]);
+			return 1;
+		    }
+		    dma.send_count    = 1;
+		    dma.send_list     = &idx;
+		    dma.send_sizes    = &sz;
+		    dma.request_count = 0;
+		    if ((r = drmDMA(fd, &dma))) {
+			drmError(r, argv[0]);
+			return 1;
+		    }
+		    dma.send_count    = 0;
+		    dma.request_count = 1;
+		}
+		gettimeofday(&end, NULL);
+		printf( "ioctl: %.3f usec, 2.000 ioctls per buffer\n",
+			usec(&end, &start) / loops);
+
+		pool  = drmBufPoolCreate(fd, context, size, count, 0, count);
+		batch = drmDMABatchCreate(fd, 0, count, 0, secs * 1000000);
+		if (!pool || !batch) {
+		    drmError(0, argv[0]);
+		    return 1;
+		}
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    if ((idx = drmBufPoolGet(pool)) < 0
+			|| (r = drmDMABatchAdd(batch, context, idx, size))) {
+			drmError(idx < 0 ? idx : r, argv[0]);
+			return 1;
+		    }
+		}
+		drmDMABatchFlush(batch);
+		gettimeofday(&end, NULL);
+		drmDMABatchGetStats(batch, &stats);
+		drmBufPoolGetStats(pool, &pstats);
+		printf( "batch: %.3f usec, %.3f ioctls per buffer\n",
+			usec(&end, &start) / loops,
+			(double)(stats.ioctls + pstats.dma_ioctls)
+			/ stats.buffers);
+		printf( "%lu buffers, %lu bytes; flushes: %lu count,"
+			" %lu bytes, %lu age, %lu explicit; %lu errors\n",
+			stats.buffers, stats.bytes, stats.count_flushes,
+			stats.byte_flushes, stats.age_flushes,
+			stats.explicit_flushes, stats.errors);
+		drmDMABatchDestroy(batch);
+		drmBufPoolDestroy(pool);
+	    }
+	    break;
+	case 'Q':		/* Query cost, with and without arenas */
+	    loops = strtoul(optarg, NULL, 0);
+	    {
+		struct timeval start, end;
+		drmVersionPtr  version;
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    if ((version = drmGetVersion(fd))) drmFreeVersion(version);
+		    if ((info = drmGetBufInfo(fd))) {
+			drmFree(info->list);
+			drmFree(info);
+		    }
+		}
+		gettimeofday(&end, NULL);
+		printf( "malloc: %.3f usec per version and buf info\n",
+			usec(&end, &start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < loops; i++) {
+		    if ((version = drmGetVersionArena(fd))) drmFreeArena(version);
+		    if ((info = drmGetBufInfoArena(fd))) drmFreeArena(info);
+		}
+		gettimeofday(&end, NULL);
+		printf( "arena:  %.3f usec per version and buf info\n",
+			usec(&end, &start) / loops);
+	    }
+	    break;
 	default:
 	    fprintf( stderr, "Usage: drmstat [options]\n" );
 	    return 1;
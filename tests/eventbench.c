@@ -0,0 +1,280 @@
+/* eventbench.c -- Benchmark for the libdrm event loop
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This program measures the cost of delivering one context switch request
+ * as the number of registered descriptors grows.  Pipes stand in for DRM
+ * devices: a request written into the write end of a randomly chosen pipe
+ * looks, to libdrm, just like one written by the kernel (the
+ * DRM_IOCTL_NEW_CTX that follows fails harmlessly on a pipe).
+ *
+ * Two dispatchers are compared:
+ *
+ *   loop   drmEventLoopDispatch, which reads only the ready descriptor
+ *   scan   a non-blocking read of every descriptor, which is what the
+ *          SIGIO handler does on each signal
+ *
+ * One JSON object is printed per line, reporting the mean, p50 and p99
+ * time from the write to the callback.  With the event loop the figures
+ * should stay flat as descriptors are added; the scan grows linearly.
+ * With -b, requests are written as binary drm_ctx_event_t records rather
+ * than text.
+ *
+ * Usage: eventbench [-b] [-n descriptors]... [-i iterations]
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "xf86drm.h"
+#include "drm.h"
+
+#define BENCH_MAX_SIZES 16
+#define BENCH_ITER      10000	/* Events per measurement */
+
+static double *sample;
+static int    pending;		/* Descriptor awaiting its callback */
+static int    binary;		/* Post drm_ctx_event_t records */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double *s, int count, int p)
+{
+    return s[(count - 1) * p / 100];
+}
+
+static void report(const char *method, int count, int iter)
+{
+    double total = 0;
+    int    i;
+
+    for (i = 0; i < iter; i++) total += sample[i];
+    qsort(sample, iter, sizeof(*sample), compare_double);
+    printf("{\"method\":\"%s\",\"fds\":%d,\"ns_per_event\":%.1f,"
+	   "\"p50_ns\":%.1f,\"p99_ns\":%.1f}\n",
+	   method, count, total / iter,
+	   percentile(sample, iter, 50), percentile(sample, iter, 99));
+    fflush(stdout);
+}
+
+static void callback(int fd, void *oldctx, void *newctx)
+{
+    if (fd != pending) {
+	fprintf(stderr, "callback for %d, expected %d\n", fd, pending);
+	exit(1);
+    }
+    pending = -1;
+}
+
+static void post(int fd)
+{
+    static const char      request[] = "C 1 2\n";
+    static drm_ctx_event_t event;
+    const void             *data     = request;
+    int                    size      = sizeof(request) - 1;
+
+    if (binary) {
+	event.type = _DRM_EVENT_CONTEXT;
+	++event.sequence;
+	event.old  = 1;
+	event.new  = 2;
+	data       = &event;
+	size       = sizeof(event);
+    }
+    if (write(fd, data, size) != size) {
+	perror("write");
+	exit(1);
+    }
+}
+
+static void bench_loop(int (*fds)[2], int count, void *state, int iter)
+{
+    void   *loop;
+    double start;
+    int    i, j;
+    int    ret;
+
+    if (!(loop = drmEventLoopCreate())) {
+	fprintf(stderr, "drmEventLoopCreate failed\n");
+	exit(1);
+    }
+    for (i = 0; i < count; i++) {
+	if ((ret = drmEventLoopAdd(loop, fds[i][0], callback))) {
+	    fprintf(stderr, "drmEventLoopAdd: %s\n", strerror(-ret));
+	    exit(1);
+	}
+    }
+
+    for (i = 0; i < iter; i++) {
+	j       = drmRandom(state) % count;
+	pending = fds[j][0];
+	start   = now();
+	post(fds[j][1]);
+	while (pending >= 0) {
+	    if ((ret = drmEventLoopDispatch(loop, -1)) < 0) {
+		fprintf(stderr, "drmEventLoopDispatch: %s\n",
+			strerror(-ret));
+		exit(1);
+	    }
+	}
+	sample[i] = now() - start;
+    }
+    report("loop", count, iter);
+
+    for (i = 0; i < count; i++) drmEventLoopRemove(loop, fds[i][0]);
+    drmEventLoopDestroy(loop);
+}
+
+				/* The SIGIO handler cannot tell which
+                                   descriptor raised the signal, so it
+                                   tries a read on every one. */
+static void bench_scan(int (*fds)[2], int count, void *state, int iter)
+{
+    char   buf[256];
+    double start;
+    int    i, j, k;
+
+    for (i = 0; i < count; i++)
+	fcntl(fds[i][0], F_SETFL, fcntl(fds[i][0], F_GETFL) | O_NONBLOCK);
+
+    for (i = 0; i < iter; i++) {
+	j       = drmRandom(state) % count;
+	pending = fds[j][0];
+	start   = now();
+	post(fds[j][1]);
+	for (k = 0; k < count; k++) {
+	    if (read(fds[k][0], buf, sizeof(buf) - 1) > 0)
+		callback(fds[k][0], NULL, NULL);
+	}
+	sample[i] = now() - start;
+	if (pending >= 0) {
+	    fprintf(stderr, "request on %d was lost\n", pending);
+	    exit(1);
+	}
+    }
+    report("scan", count, iter);
+
+    for (i = 0; i < count; i++)
+	fcntl(fds[i][0], F_SETFL, fcntl(fds[i][0], F_GETFL) & ~O_NONBLOCK);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-b] [-n descriptors]... [-i iterations]\n",
+	    name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int           sizes[BENCH_MAX_SIZES];
+    int           nsizes = 0;
+    int           iter   = BENCH_ITER;
+    int           max    = 0;
+    int           (*fds)[2];
+    struct rlimit limit;
+    void          *state;
+    int           i;
+    int           c;
+
+    while ((c = getopt(argc, argv, "bn:i:")) != EOF)
+	switch (c) {
+	case 'b': binary = 1; break;
+	case 'n':
+	    if (nsizes == BENCH_MAX_SIZES) usage(argv[0]);
+	    if ((sizes[nsizes++] = strtol(optarg, NULL, 0)) <= 0)
+		usage(argv[0]);
+	    break;
+	case 'i':
+	    if ((iter = strtol(optarg, NULL, 0)) <= 0) usage(argv[0]);
+	    break;
+	default: usage(argv[0]);
+	}
+
+    if (!nsizes)
+	for (i = 1; i <= 1024 && nsizes < BENCH_MAX_SIZES; i *= 4)
+	    sizes[nsizes++] = i;
+    for (i = 0; i < nsizes; i++) if (sizes[i] > max) max = sizes[i];
+
+				/* Two descriptors per pipe, plus a few
+                                   for stdio and the epoll descriptor. */
+    if (!getrlimit(RLIMIT_NOFILE, &limit)
+	&& limit.rlim_cur < (rlim_t)(2 * max + 16)) {
+	limit.rlim_cur = 2 * max + 16;
+	if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+	    limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (!(fds = malloc(max * sizeof(*fds)))
+	|| !(sample = malloc(iter * sizeof(*sample)))) {
+	fprintf(stderr, "out of memory\n");
+	return 1;
+    }
+    for (i = 0; i < max; i++) {
+	if (pipe(fds[i])) {
+	    perror("pipe");
+	    return 1;
+	}
+    }
+
+    state = drmRandomCreate(1);
+    for (i = 0; i < nsizes; i++) {
+	bench_loop(fds, sizes[i], state, iter);
+	bench_scan(fds, sizes[i], state, iter);
+    }
+    drmRandomDestroy(state);
+
+    for (i = 0; i < max; i++) {
+	close(fds[i][0]);
+	close(fds[i][1]);
+    }
+    free(fds);
+    free(sample);
+    return 0;
+}
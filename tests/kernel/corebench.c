@@ -0,0 +1,862 @@
+/* corebench.c -- Stress tests and microbenchmarks for the DRM core
+ * Created: Sat Oct 17 2026
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * This program runs lists.c, lock.c, dma.c and ctxbitmap.c, built
+ * unchanged against kshim.h, from several threads at once.  Each thread
+ * is a task; calls that the kernel makes from an ioctl are made under
+ * the big kernel lock, and calls made from the interrupt handler are not.
+ *
+ * The stress tests (-s, the default) each run for -d seconds:
+ *
+ *   freelist   threads get buffers from one freelist and put them back;
+ *              no buffer may be handed to two threads at once, and the
+ *              list must hold every buffer at the end
+ *   dma        clients get buffers (sleeping at the low water mark) and
+ *              queue them on their own context's waitlist, while a
+ *              dispatcher picks queues with drm_select_queue, switches
+ *              context and frees what it sends; every buffer must arrive
+ *              once, in order for its context
+ *   lock       threads take the hardware lock through the lock ioctl's
+ *              wait loop or the userspace compare-and-swap, and release
+ *              it the same two ways; at most one may hold it
+ *   ctxbitmap  threads allocate and free context handles; no handle may
+ *              be given out twice
+ *
+ * Each prints one JSON line and the program exits non-zero if any
+ * failed, if DRM_ERROR was called, or if memory was leaked.  A watchdog
+ * fails a test that stops making progress, such as after a lost wakeup.
+ *
+ * The microbenchmarks (-b) print one JSON line each, with the mean time
+ * per operation: freelist get and put, waitlist put and get, an
+ * uncontended lock take and free, a lock handoff between two threads
+ * through the wait queue, context handle allocation with part of the
+ * bitmap in use, and drm_select_queue over many queues.
+ *
+ * With -u nothing takes the big kernel lock, to show what depends on it:
+ * drm_freelist_try is then open to ABA and drm_ctxbitmap_next to handing
+ * out a handle twice.
+ *
+ * Usage: corebench [-s] [-b] [-t threads] [-d seconds] [-u] [-v]
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include "drmP.h"
+
+#define CORE_BUFS     64	/* Buffers in the freelist */
+#define CORE_SIZE     4096	/* Bytes per buffer */
+#define CORE_STALL    5		/* Seconds without progress to fail */
+#define CORE_MAX      64	/* Most threads */
+
+typedef struct CoreThread {
+    pthread_t          thread;
+    struct task_struct *task;
+    drm_device_t       *dev;
+    int                id;
+    int                context;
+    unsigned long      ops;
+    unsigned long      seq;	/* dma: last sequence queued */
+} CoreThread;
+
+static int           core_threads = 4;
+static int           core_seconds = 2;
+static int           core_nobkl;
+static int           core_failures;
+static volatile int  core_stop;
+static volatile int  core_owner[DRM_MAX_CTXBITMAP];
+
+/* Entry to and exit from an ioctl. */
+static void enter(void)
+{
+    if (!core_nobkl) lock_kernel();
+}
+
+static void leave(void)
+{
+    if (!core_nobkl) unlock_kernel();
+}
+
+static int stopped(void)
+{
+    return __atomic_load_n(&core_stop, __ATOMIC_ACQUIRE);
+}
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (__atomic_fetch_add(&core_failures, 1, __ATOMIC_RELAXED) > 10) return;
+    va_start(ap, fmt);
+    fprintf(stderr, "corebench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+/* Mark owner[idx] as held by id, failing if another thread holds it. */
+static void claim(volatile int *owner, int idx, int id, const char *what)
+{
+    int old = 0;
+
+    if (!__atomic_compare_exchange_n(&owner[idx], &old, id + 1, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	fail("%s %d given to thread %d while thread %d holds it",
+	     what, idx, id, old - 1);
+}
+
+static void release(volatile int *owner, int idx)
+{
+    __atomic_store_n(&owner[idx], 0, __ATOMIC_RELEASE);
+}
+
+/* ================================================================
+ * A device with one freelist of CORE_BUFS buffers and a queue for each
+ * context, set up as drm_addbufs and drm_init_queue would. */
+
+static drm_device_t *core_create(int queues)
+{
+    drm_device_t     *dev;
+    drm_device_dma_t *dma;
+    drm_buf_entry_t  *entry;
+    drm_buf_t        *buf;
+    drm_queue_t      *q;
+    int              order = drm_order(CORE_SIZE);
+    int              i;
+
+    if (!(dev = calloc(1, sizeof(*dev)))) abort();
+    if (!(dev->lock.hw_lock = calloc(1, sizeof(*dev->lock.hw_lock))))
+	abort();
+    init_waitqueue_head(&dev->lock.lock_queue);
+    init_waitqueue_head(&dev->context_wait);
+    sema_init(&dev->struct_sem, 1);
+
+    drm_dma_setup(dev);
+    dma              = dev->dma;
+    entry            = &dma->bufs[order];
+    entry->buf_size  = CORE_SIZE;
+    entry->buf_count = CORE_BUFS;
+    entry->buflist   = drm_alloc(CORE_BUFS * sizeof(*entry->buflist),
+				 DRM_MEM_BUFS);
+    dma->buflist     = drm_alloc(CORE_BUFS * sizeof(*dma->buflist),
+				 DRM_MEM_BUFS);
+    dma->buf_count   = CORE_BUFS;
+    memset(entry->buflist, 0, CORE_BUFS * sizeof(*entry->buflist));
+    drm_freelist_create(&entry->freelist, CORE_BUFS);
+    for (i = 0; i < CORE_BUFS; i++) {
+	buf        = &entry->buflist[i];
+	buf->idx   = i;
+	buf->total = CORE_SIZE;
+	buf->order = order;
+	init_waitqueue_head(&buf->dma_wait);
+	dma->buflist[i] = buf;
+	drm_freelist_put(dev, &entry->freelist, buf);
+    }
+
+    dev->queuelist = drm_alloc(queues * sizeof(*dev->queuelist),
+			       DRM_MEM_QUEUES);
+    for (i = 0; i < queues; i++) {
+	q = drm_alloc(sizeof(*q), DRM_MEM_QUEUES);
+	memset(q, 0, sizeof(*q));
+	atomic_set(&q->use_count, 1);
+	init_waitqueue_head(&q->read_queue);
+	init_waitqueue_head(&q->write_queue);
+	init_waitqueue_head(&q->flush_queue);
+	drm_waitlist_create(&q->waitlist, dma->buf_count);
+	dev->queuelist[i] = q;
+    }
+    dev->queue_count = dev->queue_slots = queues;
+    drm_ctxbitmap_init(dev);
+    return dev;
+}
+
+static drm_freelist_t *core_freelist(drm_device_t *dev)
+{
+    return &dev->dma->bufs[drm_order(CORE_SIZE)].freelist;
+}
+
+static void core_destroy(drm_device_t *dev)
+{
+    int i;
+
+    for (i = 0; i < dev->queue_count; i++) {
+	drm_waitlist_destroy(&dev->queuelist[i]->waitlist);
+	drm_free(dev->queuelist[i], sizeof(*dev->queuelist[i]),
+		 DRM_MEM_QUEUES);
+    }
+    drm_free(dev->queuelist, dev->queue_slots * sizeof(*dev->queuelist),
+	     DRM_MEM_QUEUES);
+    drm_ctxbitmap_cleanup(dev);
+    drm_dma_takedown(dev);
+    free(dev->lock.hw_lock);
+    free(dev);
+}
+
+/* Every buffer must be on the freelist exactly once. */
+static void core_check_freelist(drm_device_t *dev, const char *test)
+{
+    drm_freelist_t *fl   = core_freelist(dev);
+    char           seen[CORE_BUFS];
+    drm_buf_t      *buf;
+    int            n     = 0;
+
+    memset(seen, 0, sizeof(seen));
+    for (buf = fl->next; buf && n <= CORE_BUFS; buf = buf->next, n++) {
+	if (seen[buf->idx]++) {
+	    fail("%s: buffer %d is on the freelist twice", test, buf->idx);
+	    return;
+	}
+	if (buf->list != DRM_LIST_FREE)
+	    fail("%s: buffer %d on the freelist is on list %d",
+		 test, buf->idx, buf->list);
+    }
+    if (n != CORE_BUFS || atomic_read(&fl->count) != CORE_BUFS)
+	fail("%s: freelist holds %d buffers and counts %d, not %d",
+	     test, n, atomic_read(&fl->count), CORE_BUFS);
+}
+
+/* ================================================================
+ * Threads */
+
+static void core_start(CoreThread *t, int n, drm_device_t *dev,
+		       void *(*fn)(void *))
+{
+    int i;
+
+    __atomic_store_n(&core_stop, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < n; i++) {
+	memset(&t[i], 0, sizeof(t[i]));
+	t[i].dev = dev;
+	t[i].id  = i;
+	if (pthread_create(&t[i].thread, NULL, fn, &t[i])) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+}
+
+static unsigned long core_ops(CoreThread *t, int n)
+{
+    unsigned long total = 0;
+    int           i;
+
+    for (i = 0; i < n; i++)
+	total += __atomic_load_n(&t[i].ops, __ATOMIC_RELAXED);
+    return total;
+}
+
+/* Let n threads run for the test's time, failing the test if their
+   operation count stops moving, then stop them.  Every thread is sent a
+   signal, so that one asleep can be joined, before any is told to stop:
+   a thread may exit, and free its task, once it has seen either. */
+static void core_run(CoreThread *t, int n, const char *test)
+{
+    unsigned long last = 0, ops;
+    cycles_t      end  = get_cycles() + core_seconds * 1000000000ULL;
+    cycles_t      moved = get_cycles();
+    int           i;
+
+    while (get_cycles() < end) {
+	usleep(10000);
+	if ((ops = core_ops(t, n)) != last) {
+	    last  = ops;
+	    moved = get_cycles();
+	} else if (get_cycles() - moved > CORE_STALL * 1000000000ULL) {
+	    fail("%s: no progress for %d seconds", test, CORE_STALL);
+	    break;
+	}
+    }
+    for (i = 0; i < n; i++) {
+	while (!__atomic_load_n(&t[i].task, __ATOMIC_ACQUIRE)) sched_yield();
+	kshim_signal(t[i].task);
+    }
+    __atomic_store_n(&core_stop, 1, __ATOMIC_RELEASE);
+}
+
+static void core_join(CoreThread *t, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) pthread_join(t[i].thread, NULL);
+}
+
+static void core_report(const char *test, CoreThread *t, int n,
+			int failures)
+{
+    printf("{\"test\":\"%s\",\"threads\":%d,\"seconds\":%d,\"bkl\":%s,"
+	   "\"ops\":%lu,\"result\":\"%s\"}\n",
+	   test, n, core_seconds, core_nobkl ? "false" : "true",
+	   core_ops(t, n),
+	   __atomic_load_n(&core_failures, __ATOMIC_RELAXED) == failures
+	   ? "ok" : "FAIL");
+    fflush(stdout);
+}
+
+static void core_attach(CoreThread *t)
+{
+    __atomic_store_n(&t->task, current, __ATOMIC_RELEASE);
+}
+
+/* ================================================================
+ * freelist */
+
+static void *freelist_thread(void *arg)
+{
+    CoreThread     *t  = arg;
+    drm_freelist_t *fl = core_freelist(t->dev);
+    drm_buf_t      *buf;
+
+    core_attach(t);
+    while (!stopped()) {
+	enter();
+	buf = drm_freelist_get(fl, 0);
+	leave();
+	if (!buf) {
+	    sched_yield();
+	    continue;
+	}
+	claim(core_owner, buf->idx, t->id, "buffer");
+	buf->pid = current->pid;
+	release(core_owner, buf->idx);
+				/* Freed from the interrupt handler */
+	drm_freelist_put(t->dev, fl, buf);
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void test_freelist(void)
+{
+    CoreThread   t[CORE_MAX];
+    drm_device_t *dev      = core_create(1);
+    int          failures  = core_failures;
+
+    core_start(t, core_threads, dev, freelist_thread);
+    core_run(t, core_threads, "freelist");
+    core_join(t, core_threads);
+    core_check_freelist(dev, "freelist");
+    core_report("freelist", t, core_threads, failures);
+    core_destroy(dev);
+}
+
+/* ================================================================
+ * dma: thread 0 dispatches, the others are clients on contexts 1..n-1 */
+
+static volatile int core_clients_done;
+
+static void *dma_client(void *arg)
+{
+    CoreThread *t = arg;
+    drm_dma_t  d;
+    int        idx;
+    int        size;
+    int        sent;
+
+    core_attach(t);
+    while (!stopped()) {
+	memset(&d, 0, sizeof(d));
+	d.context         = t->context;
+	d.request_count   = 1;
+	d.request_size    = CORE_SIZE;
+	d.request_indices = &idx;
+	d.request_sizes   = &size;
+	d.flags           = _DRM_DMA_WAIT;
+	enter();
+	drm_dma_get_buffers(t->dev, &d);
+	leave();
+	if (!d.granted_count) continue;
+
+	sent           = ++t->seq;	/* Carried to the dispatcher in used */
+	d.send_count   = 1;
+	d.send_indices = &idx;
+	d.send_sizes   = &sent;
+	d.request_count = 0;
+	d.flags        = 0;
+	enter();
+	if (drm_dma_enqueue(t->dev, &d)) fail("dma: enqueue failed");
+	leave();
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* The interrupt handler's half: pick a queue, switch to its context
+   holding the lock for the kernel, send a buffer and complete it. */
+static void *dma_dispatcher(void *arg)
+{
+    CoreThread   *t   = arg;
+    drm_device_t *dev = t->dev;
+    unsigned long last[CORE_MAX];
+    drm_buf_t    *buf;
+    int          done;
+    int          i;
+
+    core_attach(t);
+    memset(last, 0, sizeof(last));
+    for (;;) {
+	done = __atomic_load_n(&core_clients_done, __ATOMIC_ACQUIRE);
+	if ((i = drm_select_queue(dev, NULL)) < 0) {
+	    if (done) break;
+	    sched_yield();
+	    continue;
+	}
+	if (i != dev->last_context) {
+	    while (!drm_lock_take(&dev->lock.hw_lock->lock,
+				  DRM_KERNEL_CONTEXT)) sched_yield();
+	    drm_context_switch_complete(dev, i);
+	}
+	if (!(buf = drm_waitlist_get(&dev->queuelist[i]->waitlist)))
+	    continue;
+	if (buf->context != i)
+	    fail("dma: buffer %d for context %d on queue %d",
+		 buf->idx, buf->context, i);
+	else if ((unsigned long)buf->used != last[i] + 1)
+	    fail("dma: context %d sent %d after %lu",
+		 i, buf->used, last[i]);
+	else
+	    last[i] = buf->used;
+	buf->waiting = 0;
+	buf->pending = 1;
+	drm_free_buffer(dev, buf);
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *dma_thread(void *arg)
+{
+    CoreThread *t = arg;
+
+    t->context = t->id;
+    return t->id ? dma_client(arg) : dma_dispatcher(arg);
+}
+
+static void test_dma(void)
+{
+    CoreThread     t[CORE_MAX];
+    drm_device_t   *dev;
+    drm_freelist_t *fl;
+    unsigned long  queued   = 0;
+    int            failures = core_failures;
+    int            i;
+
+    if (core_threads < 2) return; /* No clients */
+    dev = core_create(core_threads);
+    fl  = core_freelist(dev);
+    fl->low_mark  = CORE_BUFS / 4;
+    fl->high_mark = CORE_BUFS / 2;
+    __atomic_store_n(&core_clients_done, 0, __ATOMIC_RELEASE);
+
+    core_start(t, core_threads, dev, dma_thread);
+    core_run(t, core_threads, "dma");
+    core_join(t + 1, core_threads - 1);
+    __atomic_store_n(&core_clients_done, 1, __ATOMIC_RELEASE);
+    core_join(t, 1);
+
+    for (i = 1; i < core_threads; i++) queued += t[i].seq;
+    if (queued != t[0].ops)
+	fail("dma: %lu buffers queued, %lu sent", queued, t[0].ops);
+    core_check_freelist(dev, "dma");
+    core_report("dma", t, core_threads, failures);
+    core_destroy(dev);
+}
+
+/* ================================================================
+ * lock */
+
+static volatile int core_holder;
+
+/* The wait loop of the *_lock ioctls, as in gamma_lock. */
+static int core_lock(drm_device_t *dev, int context)
+{
+    DECLARE_WAITQUEUE(entry, current);
+    cycles_t woke = 0;
+    int      ret  = 0;
+
+    add_wait_queue(&dev->lock.lock_queue, &entry);
+    for (;;) {
+	if (drm_lock_take(&dev->lock.hw_lock->lock, context)) {
+	    dev->lock.pid       = current->pid;
+	    dev->lock.lock_time = jiffies;
+	    atomic_inc(&dev->total_locks);
+	    drm_lock_histogram(dev, woke, get_cycles());
+	    break;
+	}
+	atomic_inc(&dev->total_sleeps);
+	current->state = TASK_INTERRUPTIBLE;
+	schedule();
+	woke = get_cycles();
+	if (signal_pending(current)) {
+	    ret = -ERESTARTSYS;
+	    break;
+	}
+    }
+    current->state = TASK_RUNNING;
+    remove_wait_queue(&dev->lock.lock_queue, &entry);
+    return ret;
+}
+
+static void *lock_thread(void *arg)
+{
+    CoreThread    *t    = arg;
+    drm_device_t  *dev  = t->dev;
+    volatile unsigned int *lock = &dev->lock.hw_lock->lock;
+    unsigned int  held;
+    unsigned int  word;
+    int           fast;
+    int           ret;
+
+    core_attach(t);
+    enter();
+    t->context = drm_ctxbitmap_next(dev);
+    leave();
+    held = t->context | _DRM_LOCK_HELD;
+
+    while (!stopped()) {
+	fast = t->ops & 1;	/* Alternate the two ways in and out */
+				/* As DRM_LIGHT_LOCK */
+	if (!fast || cmpxchg(lock, t->context, held) != t->context) {
+	    enter();
+	    ret = core_lock(dev, t->context);
+	    leave();
+	    if (ret) break;
+	}
+	if (__atomic_exchange_n(&core_holder, t->id + 1, __ATOMIC_ACQ_REL))
+	    fail("lock: thread %d took the lock while it was held", t->id);
+	word = __atomic_load_n(lock, __ATOMIC_RELAXED);
+	if (_DRM_LOCKING_CONTEXT(word) != (unsigned)t->context)
+	    fail("lock: thread %d holds the lock for context %d",
+		 t->id, _DRM_LOCKING_CONTEXT(word));
+	if (t->ops % 7 == 0) sched_yield();
+	__atomic_store_n(&core_holder, 0, __ATOMIC_RELEASE);
+
+				/* As DRM_UNLOCK: a contended lock is left
+				   to the ioctl, which wakes the waiters */
+	if (!fast || cmpxchg(lock, held, t->context) != held) {
+	    enter();
+	    drm_lock_free(dev, lock, t->context);
+	    leave();
+	}
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+    }
+    enter();
+    drm_ctxbitmap_free(dev, t->context);
+    leave();
+    return NULL;
+}
+
+static void test_lock(void)
+{
+    CoreThread   t[CORE_MAX];
+    drm_device_t *dev     = core_create(1);
+    int          failures = core_failures;
+
+    core_start(t, core_threads, dev, lock_thread);
+    core_run(t, core_threads, "lock");
+    core_join(t, core_threads);
+    if (_DRM_LOCK_IS_HELD(dev->lock.hw_lock->lock))
+	fail("lock: lock word is 0x%08x after the test",
+	     dev->lock.hw_lock->lock);
+    core_report("lock", t, core_threads, failures);
+    core_destroy(dev);
+}
+
+/* ================================================================
+ * ctxbitmap */
+
+#define CORE_HANDLES 64		/* Held by each thread at once */
+
+static void *ctxbitmap_thread(void *arg)
+{
+    CoreThread   *t  = arg;
+    int          held[CORE_HANDLES];
+    int          n   = 0;
+    int          h;
+
+    core_attach(t);
+    while (!stopped()) {
+	if (n == CORE_HANDLES) {
+	    h = held[t->ops % CORE_HANDLES];
+	    held[t->ops % CORE_HANDLES] = held[--n];
+	    release(core_owner, h);
+	    enter();
+	    drm_ctxbitmap_free(t->dev, h);
+	    leave();
+	}
+	enter();
+	h = drm_ctxbitmap_next(t->dev);
+	leave();
+	if (h < 0) {
+	    sched_yield();
+	    continue;
+	}
+	claim(core_owner, h, t->id, "context");
+	held[n++] = h;
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+    }
+    while (n) {
+	h = held[--n];
+	release(core_owner, h);
+	enter();
+	drm_ctxbitmap_free(t->dev, h);
+	leave();
+    }
+    return NULL;
+}
+
+static void test_ctxbitmap(void)
+{
+    CoreThread   t[CORE_MAX];
+    drm_device_t *dev     = core_create(1);
+    int          failures = core_failures;
+    int          h;
+
+    core_start(t, core_threads, dev, ctxbitmap_thread);
+    core_run(t, core_threads, "ctxbitmap");
+    core_join(t, core_threads);
+    if ((h = drm_ctxbitmap_next(dev)) != DRM_RESERVED_CONTEXTS)
+	fail("ctxbitmap: first free handle is %d after the test", h);
+    core_report("ctxbitmap", t, core_threads, failures);
+    core_destroy(dev);
+}
+
+/* ================================================================
+ * Microbenchmarks */
+
+#define CORE_OPS 1000000
+
+static void bench_report(const char *bench, int threads, const char *param,
+			 long value, unsigned long ops, cycles_t ns)
+{
+    printf("{\"bench\":\"%s\",\"threads\":%d,", bench, threads);
+    if (param) printf("\"%s\":%ld,", param, value);
+    printf("\"bkl\":%s,\"ops\":%lu,\"ns_per_op\":%.1f}\n",
+	   core_nobkl ? "false" : "true", ops, ops ? (double)ns / ops : 0);
+    fflush(stdout);
+}
+
+static void *bench_freelist_thread(void *arg)
+{
+    CoreThread     *t  = arg;
+    drm_freelist_t *fl = core_freelist(t->dev);
+    drm_buf_t      *buf;
+    int            i;
+
+    core_attach(t);
+    for (i = 0; i < CORE_OPS; i++) {
+	enter();
+	buf = drm_freelist_get(fl, 0);
+	leave();
+	if (buf) drm_freelist_put(t->dev, fl, buf);
+    }
+    t->ops = CORE_OPS;
+    return NULL;
+}
+
+static void bench_freelist(int threads)
+{
+    CoreThread   t[CORE_MAX];
+    drm_device_t *dev = core_create(1);
+    cycles_t     start = get_cycles();
+
+    core_start(t, threads, dev, bench_freelist_thread);
+    core_join(t, threads);
+				/* Wall time per operation, all threads */
+    bench_report("freelist_get_put", threads, NULL, 0, core_ops(t, threads),
+		 get_cycles() - start);
+    core_destroy(dev);
+}
+
+static void bench_waitlist(void)
+{
+    drm_device_t   *dev = core_create(1);
+    drm_waitlist_t *wl  = &dev->queuelist[0]->waitlist;
+    drm_buf_t      *buf = dev->dma->buflist[0];
+    cycles_t       start;
+    int            i;
+
+    start = get_cycles();
+    for (i = 0; i < CORE_OPS; i++) {
+	drm_waitlist_put(wl, buf);
+	buf = drm_waitlist_get(wl);
+    }
+    bench_report("waitlist_put_get", 1, NULL, 0, CORE_OPS,
+		 get_cycles() - start);
+    buf->list = DRM_LIST_NONE;
+    core_destroy(dev);
+}
+
+static void bench_lock(void)
+{
+    drm_device_t *dev = core_create(1);
+    cycles_t     start;
+    int          i;
+
+    start = get_cycles();
+    for (i = 0; i < CORE_OPS; i++) {
+	drm_lock_take(&dev->lock.hw_lock->lock, 1);
+	drm_lock_free(dev, &dev->lock.hw_lock->lock, 1);
+    }
+    bench_report("lock_take_free", 1, NULL, 0, CORE_OPS,
+		 get_cycles() - start);
+    core_destroy(dev);
+}
+
+#define CORE_HANDOFFS 100000
+
+static void *bench_handoff_thread(void *arg)
+{
+    CoreThread   *t   = arg;
+    drm_device_t *dev = t->dev;
+    int          i;
+
+    core_attach(t);
+    for (i = 0; i < CORE_HANDOFFS; i++) {
+	enter();
+	core_lock(dev, t->id + 1);
+	leave();
+	__atomic_store_n(&t->ops, t->ops + 1, __ATOMIC_RELAXED);
+	enter();
+	drm_lock_free(dev, &dev->lock.hw_lock->lock, t->id + 1);
+	leave();
+    }
+    return NULL;
+}
+
+static void bench_handoff(void)
+{
+    CoreThread   t[2];
+    drm_device_t *dev = core_create(1);
+    cycles_t     start = get_cycles();
+
+    core_start(t, 2, dev, bench_handoff_thread);
+    core_join(t, 2);
+    bench_report("lock_ioctl_2_threads", 2, "sleeps",
+		 atomic_read(&dev->total_sleeps), core_ops(t, 2),
+		 get_cycles() - start);
+    core_destroy(dev);
+}
+
+static void bench_ctxbitmap(int used)
+{
+    drm_device_t *dev = core_create(1);
+    cycles_t     start;
+    int          i, h;
+
+    for (i = DRM_RESERVED_CONTEXTS; i < used; i++) drm_ctxbitmap_next(dev);
+    start = get_cycles();
+    for (i = 0; i < CORE_OPS / 10; i++) {
+	h = drm_ctxbitmap_next(dev);
+	drm_ctxbitmap_free(dev, h);
+    }
+    bench_report("ctxbitmap_next_free", 1, "used", used, CORE_OPS / 10,
+		 get_cycles() - start);
+    core_destroy(dev);
+}
+
+/* One buffer waits on the last queue, and it is not the last context. */
+static void bench_select(int queues)
+{
+    drm_device_t   *dev = core_create(queues);
+    drm_freelist_t *fl  = core_freelist(dev);
+    drm_buf_t      *buf = drm_freelist_get(fl, 0);
+    cycles_t       start;
+    int            i;
+
+    drm_waitlist_put(&dev->queuelist[queues - 1]->waitlist, buf);
+    start = get_cycles();
+    for (i = 0; i < CORE_OPS / 10; i++) {
+	dev->last_checked = 0;
+	if (drm_select_queue(dev, NULL) != queues - 1)
+	    fail("select: wrong queue");
+    }
+    bench_report("select_queue", 1, "queues", queues, CORE_OPS / 10,
+		 get_cycles() - start);
+    drm_waitlist_get(&dev->queuelist[queues - 1]->waitlist);
+    buf->list = DRM_LIST_NONE;
+    drm_freelist_put(dev, fl, buf);
+    core_destroy(dev);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+	    "usage: %s [-s] [-b] [-t threads] [-d seconds] [-u] [-v]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int stress = 0;
+    int bench  = 0;
+    int quiet  = 1;
+    int c;
+
+    while ((c = getopt(argc, argv, "sbt:d:uv")) != EOF)
+	switch (c) {
+	case 's': stress       = 1;                       break;
+	case 'b': bench        = 1;                       break;
+	case 't': core_threads = strtol(optarg, NULL, 0); break;
+	case 'd': core_seconds = strtol(optarg, NULL, 0); break;
+	case 'u': core_nobkl   = 1;                       break;
+	case 'v': quiet        = 0;                       break;
+	default:  usage(argv[0]);
+	}
+    if (core_threads < 1 || core_threads > CORE_MAX || core_seconds < 1)
+	usage(argv[0]);
+    if (!bench) stress = 1;
+    kshim_quiet(quiet);
+
+    if (stress) {
+	test_freelist();
+	test_dma();
+	test_lock();
+	test_ctxbitmap();
+    }
+    if (bench) {
+	bench_freelist(1);
+	bench_freelist(core_threads);
+	bench_waitlist();
+	bench_lock();
+	bench_handoff();
+	bench_ctxbitmap(DRM_RESERVED_CONTEXTS);
+	bench_ctxbitmap(1024);
+	bench_ctxbitmap(DRM_MAX_CTXBITMAP / 2);
+	bench_select(2);
+	bench_select(64);
+	bench_select(1024);
+    }
+
+    if (kshim_errors())
+	fail("DRM_ERROR called %d times (-v to see them)", kshim_errors());
+    if (kshim_mem_outstanding())
+	fail("%ld bytes still allocated", kshim_mem_outstanding());
+    return core_failures ? 1 : 0;
+}
@@ -0,0 +1,366 @@
+/* kshim.c -- Kernel interfaces for building the DRM core in userspace
+ * Created: Sat Oct 17 2026
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * The kernel services behind kshim.h, and the pieces of memory.c, bufs.c,
+ * fops.c and init.c that lists.c, lock.c, dma.c and ctxbitmap.c call.
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <sched.h>
+#include <time.h>
+#include "drmP.h"
+
+int			drm_flags;
+
+static int		kshim_error_count;
+static int		kshim_quiet_flag;
+static long		kshim_mem;
+static pid_t		kshim_next_pid = 1;
+static pthread_key_t	kshim_task_key;
+static pthread_once_t	kshim_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t	kernel_flag = PTHREAD_MUTEX_INITIALIZER;
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int	len = 0;
+
+	if (!strncmp(fmt, KERN_ERR, 3))
+		__atomic_add_fetch(&kshim_error_count, 1, __ATOMIC_RELAXED);
+	if (kshim_quiet_flag) return 0;
+	if (fmt[0] == '<' && fmt[1] && fmt[2] == '>') fmt += 3;
+	va_start(ap, fmt);
+	len = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+int kshim_errors(void)
+{
+	return __atomic_load_n(&kshim_error_count, __ATOMIC_RELAXED);
+}
+
+void kshim_quiet(int quiet)
+{
+	kshim_quiet_flag = quiet;
+}
+
+cycles_t get_cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (cycles_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long kshim_jiffies(void)
+{
+	return get_cycles() / (1000000000ULL / HZ);
+}
+
+				/* Bit operations */
+void set_bit(int nr, volatile void *addr)
+{
+	volatile unsigned int *word = (volatile unsigned int *)addr + (nr >> 5);
+
+	__atomic_fetch_or(word, 1U << (nr & 31), __ATOMIC_SEQ_CST);
+}
+
+void clear_bit(int nr, volatile void *addr)
+{
+	volatile unsigned int *word = (volatile unsigned int *)addr + (nr >> 5);
+
+	__atomic_fetch_and(word, ~(1U << (nr & 31)), __ATOMIC_SEQ_CST);
+}
+
+int test_bit(int nr, const volatile void *addr)
+{
+	const volatile unsigned int *word
+		= (const volatile unsigned int *)addr + (nr >> 5);
+
+	return (__atomic_load_n(word, __ATOMIC_RELAXED) >> (nr & 31)) & 1;
+}
+
+int test_and_set_bit(int nr, volatile void *addr)
+{
+	volatile unsigned int *word = (volatile unsigned int *)addr + (nr >> 5);
+	unsigned int	      mask  = 1U << (nr & 31);
+
+	return !!(__atomic_fetch_or(word, mask, __ATOMIC_SEQ_CST) & mask);
+}
+
+int test_and_clear_bit(int nr, volatile void *addr)
+{
+	volatile unsigned int *word = (volatile unsigned int *)addr + (nr >> 5);
+	unsigned int	      mask  = 1U << (nr & 31);
+
+	return !!(__atomic_fetch_and(word, ~mask, __ATOMIC_SEQ_CST) & mask);
+}
+
+int find_first_zero_bit(const volatile void *addr, unsigned int size)
+{
+	const volatile unsigned int *words = addr;
+	unsigned int		    i, w;
+
+	for (i = 0; i < size; i += 32) {
+		w = __atomic_load_n(&words[i >> 5], __ATOMIC_RELAXED);
+		if (~w) return DRM_MIN(i + __builtin_ctz(~w), size);
+	}
+	return size;
+}
+
+				/* Spinlocks */
+void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_exchange_n(&lock->lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED))
+			sched_yield();
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->lock, 0, __ATOMIC_RELEASE);
+}
+
+				/* Tasks */
+/* Taking the mutex waits out a kshim_signal() still in progress. */
+static void kshim_task_free(void *data)
+{
+	struct task_struct *task = data;
+
+	pthread_mutex_lock(&task->mutex);
+	pthread_mutex_unlock(&task->mutex);
+	pthread_mutex_destroy(&task->mutex);
+	pthread_cond_destroy(&task->cond);
+	free(task);
+}
+
+static void kshim_init(void)
+{
+	pthread_key_create(&kshim_task_key, kshim_task_free);
+}
+
+struct task_struct *kshim_current(void)
+{
+	struct task_struct *task;
+
+	pthread_once(&kshim_once, kshim_init);
+	if ((task = pthread_getspecific(kshim_task_key))) return task;
+	if (!(task = calloc(1, sizeof(*task)))) abort();
+	task->pid = __atomic_fetch_add(&kshim_next_pid, 1, __ATOMIC_RELAXED);
+	pthread_mutex_init(&task->mutex, NULL);
+	pthread_cond_init(&task->cond, NULL);
+	pthread_setspecific(kshim_task_key, task);
+	return task;
+}
+
+void kshim_signal(struct task_struct *task)
+{
+	pthread_mutex_lock(&task->mutex);
+	__atomic_store_n(&task->sigpending, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->mutex);
+}
+
+void lock_kernel(void)
+{
+	struct task_struct *task = current;
+
+	if (!task->lock_depth++) pthread_mutex_lock(&kernel_flag);
+}
+
+void unlock_kernel(void)
+{
+	struct task_struct *task = current;
+
+	if (!--task->lock_depth) pthread_mutex_unlock(&kernel_flag);
+}
+
+/* Sleep until woken, with the big kernel lock dropped as in 2.4.  A task
+   that is still TASK_RUNNING only yields.  timeout is in jiffies, or
+   negative to sleep until woken. */
+static long kshim_schedule(long timeout)
+{
+	struct task_struct *task = current;
+	struct timespec	   until;
+	cycles_t	   end	 = 0;
+	int		   ret	 = 0;
+
+	if (task->lock_depth) pthread_mutex_unlock(&kernel_flag);
+	if (task->state == TASK_RUNNING) {
+		++task->yields;
+		sched_yield();
+	} else {
+		++task->sleeps;
+		if (timeout >= 0) {
+			end = get_cycles() + timeout * (1000000000ULL / HZ);
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec  += timeout / HZ;
+			until.tv_nsec += timeout % HZ * (1000000000L / HZ);
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_nsec -= 1000000000L;
+				++until.tv_sec;
+			}
+		}
+		pthread_mutex_lock(&task->mutex);
+		while (!task->woken && !signal_pending(task) && !ret) {
+			if (timeout < 0)
+				pthread_cond_wait(&task->cond, &task->mutex);
+			else
+				ret = pthread_cond_timedwait(&task->cond,
+							     &task->mutex,
+							     &until);
+		}
+		task->woken = 0;
+		pthread_mutex_unlock(&task->mutex);
+		task->state = TASK_RUNNING;
+	}
+	if (task->lock_depth) pthread_mutex_lock(&kernel_flag);
+	if (timeout < 0 || !end) return 0;
+	timeout = (long)((end - DRM_MIN(end, get_cycles()))
+			 / (1000000000ULL / HZ));
+	return timeout;
+}
+
+void schedule(void)
+{
+	kshim_schedule(-1);
+}
+
+long schedule_timeout(long timeout)
+{
+	return kshim_schedule(timeout);
+}
+
+				/* Wait queues */
+void add_wait_queue(wait_queue_head_t *q, wait_queue_t *wait)
+{
+	spin_lock(&q->lock);
+	wait->prev = NULL;
+	wait->next = q->head;
+	if (q->head) q->head->prev = wait;
+	q->head = wait;
+	spin_unlock(&q->lock);
+}
+
+void remove_wait_queue(wait_queue_head_t *q, wait_queue_t *wait)
+{
+	spin_lock(&q->lock);
+	if (wait->prev) wait->prev->next = wait->next;
+	else		q->head		 = wait->next;
+	if (wait->next) wait->next->prev = wait->prev;
+	wait->next = wait->prev = NULL;
+	spin_unlock(&q->lock);
+}
+
+void wake_up(wait_queue_head_t *q)
+{
+	wait_queue_t *wait;
+
+	spin_lock(&q->lock);
+	for (wait = q->head; wait; wait = wait->next) {
+		pthread_mutex_lock(&wait->task->mutex);
+		wait->task->woken = 1;
+		pthread_cond_signal(&wait->task->cond);
+		pthread_mutex_unlock(&wait->task->mutex);
+	}
+	spin_unlock(&q->lock);
+}
+
+int waitqueue_active(wait_queue_head_t *q)
+{
+	int active;
+
+	spin_lock(&q->lock);
+	active = q->head != NULL;
+	spin_unlock(&q->lock);
+	return active;
+}
+
+				/* Memory management support (memory.c) */
+void *drm_alloc(size_t size, int area)
+{
+	void *pt;
+
+	if (!size) return NULL;
+	if ((pt = malloc(size)))
+		__atomic_add_fetch(&kshim_mem, (long)size, __ATOMIC_RELAXED);
+	return pt;
+}
+
+void drm_free(void *pt, size_t size, int area)
+{
+	if (!pt) {
+		DRM_ERROR("Attempt to free NULL pointer (area %d)\n", area);
+		return;
+	}
+	__atomic_sub_fetch(&kshim_mem, (long)size, __ATOMIC_RELAXED);
+	free(pt);
+}
+
+unsigned long drm_alloc_pages(int order, int area)
+{
+	void *pt;
+
+	if (posix_memalign(&pt, PAGE_SIZE, PAGE_SIZE << order)) return 0;
+	__atomic_add_fetch(&kshim_mem, (long)PAGE_SIZE << order,
+			   __ATOMIC_RELAXED);
+	return (unsigned long)pt;
+}
+
+void drm_free_pages(unsigned long address, int order, int area)
+{
+	__atomic_sub_fetch(&kshim_mem, (long)PAGE_SIZE << order,
+			   __ATOMIC_RELAXED);
+	free((void *)address);
+}
+
+long kshim_mem_outstanding(void)
+{
+	return __atomic_load_n(&kshim_mem, __ATOMIC_RELAXED);
+}
+
+				/* From bufs.c */
+int drm_order(unsigned long size)
+{
+	int	      order;
+	unsigned long tmp;
+
+	for (order = 0, tmp = size; tmp >>= 1; ++order);
+	if (size & ~(1 << order)) ++order;
+	return order;
+}
+
+				/* From fops.c: the X server is not there
+				   to answer, so the request is dropped. */
+int drm_write_event(drm_device_t *dev, int old, int new)
+{
+	++dev->buf_sequence;
+	return 0;
+}
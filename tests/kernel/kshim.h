@@ -0,0 +1,235 @@
+/* kshim.h -- Kernel interfaces for building the DRM core in userspace
+ * Created: Sat Oct 17 2026
+ *
+ * Copyright 2000 VA Linux Systems, Inc., Sunnyvale, California.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * Every kernel header that drmP.h, lists.c, lock.c, dma.c and ctxbitmap.c
+ * include is a one-line file under include/ that includes this one, so
+ * those files build unchanged with -D__KERNEL__ -Iinclude.
+ *
+ * Each thread is a task.  Spinlocks spin on an atomic word, atomics and
+ * cmpxchg are compiler builtins, and a wait queue is a list of tasks that
+ * sleep on a per-task condition variable, so ThreadSanitizer understands
+ * all of them.  A wakeup leaves a token that the task's next schedule()
+ * consumes: a waker that runs between a waiter's last test and its call
+ * to schedule() is never lost, and the cost is an occasional spurious
+ * return, which every wait loop in the DRM already tolerates.
+ *
+ * As in 2.2 and 2.4, process context runs under the big kernel lock:
+ * lock_kernel() is what the ioctl path takes, and schedule() drops and
+ * retakes it around a sleep.  Code that models an interrupt handler
+ * simply does not take it.
+ *
+ * get_cycles() counts nanoseconds, jiffies tick at HZ, and timers are
+ * recorded but never fire.
+ *
+ */
+
+#ifndef _KSHIM_H_
+#define _KSHIM_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define LINUX_VERSION_CODE	 KERNEL_VERSION(2,4,0)
+#define KERNEL_VERSION(a,b,c)	 (((a) << 16) + ((b) << 8) + (c))
+
+#define HZ			 100
+#define PAGE_SHIFT		 12
+#define PAGE_SIZE		 (1UL << PAGE_SHIFT)
+
+				/* GCC 3.4 stopped pasting __FUNCTION__
+				   as a string literal, which DRM_ERROR
+				   and DRM_DEBUG rely on. */
+#define __FUNCTION__		 ""
+
+#define ERESTARTSYS		 512
+
+#define KERN_ERR		 "<3>"
+#define KERN_WARNING		 "<4>"
+#define KERN_INFO		 "<6>"
+#define KERN_DEBUG		 "<7>"
+
+extern int printk(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)));
+
+				/* Time */
+typedef unsigned long long cycles_t;
+
+extern cycles_t	     get_cycles(void);
+extern unsigned long kshim_jiffies(void);
+#define jiffies		     kshim_jiffies()
+
+				/* Atomics */
+typedef struct { volatile int counter; } atomic_t;
+
+#define ATOMIC_INIT(i)		 { (i) }
+#define atomic_read(v)		 __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v,i)		 __atomic_store_n(&(v)->counter, (i),	      \
+						  __ATOMIC_RELAXED)
+#define atomic_add(i,v)		 ((void)__atomic_add_fetch(&(v)->counter, (i), \
+							   __ATOMIC_SEQ_CST))
+#define atomic_sub(i,v)		 ((void)__atomic_sub_fetch(&(v)->counter, (i), \
+							   __ATOMIC_SEQ_CST))
+#define atomic_inc(v)		 atomic_add(1, (v))
+#define atomic_dec(v)		 atomic_sub(1, (v))
+#define atomic_dec_and_test(v)	 (__atomic_sub_fetch(&(v)->counter, 1,	      \
+						     __ATOMIC_SEQ_CST) == 0)
+
+				/* drmP.h supplies an x86 cmpxchg unless
+				   the architecture has one. */
+#define __HAVE_ARCH_CMPXCHG	 1
+#define cmpxchg(ptr,o,n)	 __sync_val_compare_and_swap((ptr), (o), (n))
+
+				/* Bit operations, on 32-bit words as on
+				   x86, since they are also applied to int
+				   fields such as context_flag. */
+extern void	     set_bit(int nr, volatile void *addr);
+extern void	     clear_bit(int nr, volatile void *addr);
+extern int	     test_bit(int nr, const volatile void *addr);
+extern int	     test_and_set_bit(int nr, volatile void *addr);
+extern int	     test_and_clear_bit(int nr, volatile void *addr);
+extern int	     find_first_zero_bit(const volatile void *addr,
+					 unsigned int size);
+
+				/* Spinlocks; interrupts are not modelled */
+typedef struct { volatile int lock; } spinlock_t;
+
+#define SPIN_LOCK_UNLOCKED	 ((spinlock_t) { 0 })
+#define spin_lock_init(l)	 (*(l) = SPIN_LOCK_UNLOCKED)
+extern void	     spin_lock(spinlock_t *lock);
+extern void	     spin_unlock(spinlock_t *lock);
+#define spin_lock_irqsave(l,f)	 do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l,f) do { (void)(f); spin_unlock(l); } while (0)
+
+				/* Tasks */
+#define TASK_RUNNING		 0
+#define TASK_INTERRUPTIBLE	 1
+#define TASK_UNINTERRUPTIBLE	 2
+#define SCHED_YIELD		 0x10
+
+struct task_struct {
+	volatile long	state;	      /* Written by the task only	   */
+	unsigned long	policy;
+	pid_t		pid;
+	int		sigpending;   /* Set with kshim_signal		   */
+	int		lock_depth;   /* Big kernel lock nesting	   */
+	int		woken;	      /* Wakeup token, under mutex	   */
+	unsigned long	sleeps;	      /* schedule() calls that slept	   */
+	unsigned long	yields;	      /* schedule() calls while running	   */
+	pthread_mutex_t mutex;
+	pthread_cond_t	cond;
+};
+
+extern struct task_struct *kshim_current(void);
+#define current			 kshim_current()
+
+extern void	     schedule(void);
+extern long	     schedule_timeout(long timeout);
+#define signal_pending(t)	 __atomic_load_n(&(t)->sigpending,	      \
+						 __ATOMIC_ACQUIRE)
+
+extern void	     lock_kernel(void);
+extern void	     unlock_kernel(void);
+
+				/* Wait queues (2.3.1 and later) */
+typedef struct __wait_queue {
+	struct task_struct   *task;
+	struct __wait_queue  *next;
+	struct __wait_queue  *prev;
+} wait_queue_t;
+
+typedef struct __wait_queue_head {
+	spinlock_t	     lock;
+	wait_queue_t	     *head;
+} wait_queue_head_t;
+
+#define DECLARE_WAITQUEUE(name,tsk) wait_queue_t name = { (tsk), NULL, NULL }
+#define init_waitqueue_head(q)	 memset((q), 0, sizeof(*(q)))
+extern void	     add_wait_queue(wait_queue_head_t *q, wait_queue_t *wait);
+extern void	     remove_wait_queue(wait_queue_head_t *q,
+				       wait_queue_t *wait);
+extern void	     wake_up(wait_queue_head_t *q);
+extern int	     waitqueue_active(wait_queue_head_t *q);
+#define wake_up_interruptible(q) wake_up(q)
+
+				/* Semaphores */
+struct semaphore {
+	pthread_mutex_t	     mutex;
+};
+
+#define sema_init(s,v)		 pthread_mutex_init(&(s)->mutex, NULL)
+#define down(s)			 pthread_mutex_lock(&(s)->mutex)
+#define up(s)			 pthread_mutex_unlock(&(s)->mutex)
+
+				/* Timers and task queues, never run */
+struct timer_list {
+	unsigned long	     expires;
+	unsigned long	     data;
+	void		     (*function)(unsigned long);
+	int		     pending;
+};
+
+struct tq_struct {
+	void		     *next;
+	unsigned long	     sync;
+	void		     (*routine)(void *);
+	void		     *data;
+};
+
+#define init_timer(t)		 ((t)->pending = 0)
+#define add_timer(t)		 ((t)->pending = 1)
+#define del_timer(t)		 ((t)->pending = 0)
+
+				/* Files; "user" memory is ordinary memory */
+struct inode { int i_rdev; };
+struct file  { void *private_data; };
+struct vm_area_struct;
+struct page;
+struct poll_table_struct;
+struct fasync_struct;
+struct proc_dir_entry;
+
+#define copy_to_user(to,from,n)	  (memcpy((to), (from), (n)), 0)
+#define copy_from_user(to,from,n) (memcpy((to), (from), (n)), 0)
+#define copy_to_user_ret(to,from,n,retval)				      \
+	do { if (copy_to_user(to, from, n)) return retval; } while (0)
+#define copy_from_user_ret(to,from,n,retval)				      \
+	do { if (copy_from_user(to, from, n)) return retval; } while (0)
+
+				/* Harness support (kshim.c) */
+extern void	     kshim_signal(struct task_struct *task);
+extern int	     kshim_errors(void);
+extern void	     kshim_quiet(int quiet);
+extern long	     kshim_mem_outstanding(void);
+
+#endif